@@ -0,0 +1,299 @@
+#include "BatchConverter.h"
+#include "Converter.h"
+#include "WorkStealingPool.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <system_error>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct BatchJob {
+    std::string input;
+    std::string output;
+    ConversionResult result;
+    double milliseconds = 0.0;
+    bool named = false; // Output path given by a manifest rather than derived from the input
+};
+
+bool has_wildcard(const std::string& text) {
+    return text.find_first_of("*?") != std::string::npos;
+}
+
+// Matches '*' (any run of characters) and '?' (any single character).
+bool wildcard_match(const char* pattern, const char* name) {
+    const char* star = nullptr;
+    const char* resume = nullptr;
+    while (*name) {
+        if (*pattern == '?' || *pattern == *name) {
+            ++pattern;
+            ++name;
+        } else if (*pattern == '*') {
+            star = pattern++;
+            resume = name;
+        } else if (star) {
+            pattern = star + 1;
+            name = ++resume;
+        } else {
+            return false;
+        }
+    }
+    while (*pattern == '*') ++pattern;
+    return *pattern == '\0';
+}
+
+bool is_vgm_file(const fs::path& path) {
+    std::string ext = path.extension().string();
+    for (auto& c : ext) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    return ext == ".vgm" || ext == ".vgz";
+}
+
+std::string output_for(const BatchOptions& options, const fs::path& relative) {
+    fs::path out = fs::path(options.output_dir) / relative;
+    out.replace_extension(".mid");
+    return out.string();
+}
+
+void collect_directory(const BatchOptions& options, const fs::path& dir, std::vector<BatchJob>& jobs) {
+    std::error_code ec;
+    std::vector<fs::path> found;
+    for (fs::recursive_directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->is_regular_file(ec) && is_vgm_file(it->path())) {
+            found.push_back(it->path());
+        }
+    }
+    std::sort(found.begin(), found.end());
+    for (const auto& path : found) {
+        jobs.push_back({path.string(), output_for(options, path.lexically_relative(dir)), {}, 0.0});
+    }
+}
+
+void collect_glob(const BatchOptions& options, const std::string& pattern, std::vector<BatchJob>& jobs) {
+    fs::path pattern_path(pattern);
+    fs::path dir = pattern_path.has_parent_path() ? pattern_path.parent_path() : fs::path(".");
+    std::string name_pattern = pattern_path.filename().string();
+
+    std::error_code ec;
+    std::vector<fs::path> found;
+    for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->is_regular_file(ec) && wildcard_match(name_pattern.c_str(), it->path().filename().string().c_str())) {
+            found.push_back(it->path());
+        }
+    }
+    if (found.empty()) {
+        std::cerr << "Warning: pattern matched no files: " << pattern << std::endl;
+    }
+    std::sort(found.begin(), found.end());
+    for (const auto& path : found) {
+        jobs.push_back({path.string(), output_for(options, path.filename()), {}, 0.0});
+    }
+}
+
+bool collect_manifest(const BatchOptions& options, const std::string& manifest, std::vector<BatchJob>& jobs) {
+    std::ifstream file(manifest);
+    if (!file) {
+        std::cerr << "Cannot open manifest: " << manifest << std::endl;
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+
+        size_t tab = line.find('\t');
+        if (tab != std::string::npos) {
+            jobs.push_back({line.substr(0, tab), line.substr(tab + 1), {}, 0.0, true});
+        } else {
+            jobs.push_back({line, output_for(options, fs::path(line).filename()), {}, 0.0});
+        }
+    }
+    return true;
+}
+
+fs::path normalized(const std::string& path) {
+    std::error_code ec;
+    fs::path absolute = fs::absolute(path, ec);
+    return (ec ? fs::path(path) : absolute).lexically_normal();
+}
+
+// Longest leading directory shared by `a` and `b`.
+fs::path common_root(const fs::path& a, const fs::path& b) {
+    fs::path root;
+    for (auto i = a.begin(), j = b.begin(); i != a.end() && j != b.end() && *i == *j; ++i, ++j) root /= *i;
+    return root;
+}
+
+std::map<std::string, std::vector<size_t>> jobs_by_output(const std::vector<BatchJob>& jobs) {
+    std::map<std::string, std::vector<size_t>> groups;
+    for (size_t i = 0; i < jobs.size(); ++i) groups[normalized(jobs[i].output).string()].push_back(i);
+    return groups;
+}
+
+// Inputs with the same file name from different directories would all be written to
+// the same output and overwrite each other. Derived outputs that collide keep the
+// input's path relative to the colliding inputs' common directory instead, as for a
+// directory walk; an output that still collides (the same input twice, or a manifest
+// naming one output twice) fails all its jobs but the first.
+void resolve_output_collisions(const BatchOptions& options, std::vector<BatchJob>& jobs) {
+    for (const auto& group : jobs_by_output(jobs)) {
+        std::vector<size_t> derived;
+        for (size_t i : group.second) {
+            if (!jobs[i].named) derived.push_back(i);
+        }
+        if (derived.size() < 2) continue;
+        fs::path root = normalized(jobs[derived[0]].input).parent_path();
+        for (size_t i : derived) root = common_root(root, normalized(jobs[i].input).parent_path());
+        for (size_t i : derived) jobs[i].output = output_for(options, normalized(jobs[i].input).lexically_relative(root));
+    }
+    for (const auto& group : jobs_by_output(jobs)) {
+        const std::vector<size_t>& members = group.second;
+        for (size_t k = 1; k < members.size(); ++k) {
+            jobs[members[k]].result.error = "output " + jobs[members[k]].output + " is also written for " +
+                                            jobs[members[0]].input;
+        }
+    }
+}
+
+void run_job(const BatchOptions& options, BatchJob& job) {
+    auto start = std::chrono::steady_clock::now();
+
+    std::error_code ec;
+    uint64_t size = fs::file_size(job.input, ec);
+    if (ec) {
+        job.result.error = "cannot stat input: " + ec.message();
+    } else if (options.max_input_size != 0 && size > options.max_input_size) {
+        job.result.error = "input exceeds the per-worker size limit";
+    } else {
+        fs::path parent = fs::path(job.output).parent_path();
+        if (!parent.empty()) fs::create_directories(parent, ec);
+        try {
+            // Each worker keeps a warm converter, so its buffers are reused across files.
+            thread_local VgmConverter converter;
+            converter.set_options(options.conversion);
+            job.result = converter.convert_file(job.input, job.output);
+        } catch (const std::exception& e) {
+            job.result.success = false;
+            job.result.error = e.what();
+        }
+    }
+
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    job.milliseconds = elapsed.count();
+}
+
+// {"files":[{"input":...,"stats":{...}},...],"total":{...}}
+bool write_stats(const std::string& path, const std::vector<BatchJob>& jobs) {
+    std::ofstream file;
+    if (path != "-") {
+        file.open(path);
+        if (!file) {
+            std::cerr << "Cannot open statistics file: " << path << std::endl;
+            return false;
+        }
+    }
+    std::ostream& out = (path == "-") ? std::cout : file;
+
+    ConversionStats total;
+    out << "{\"files\":[";
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        const BatchJob& job = jobs[i];
+        total.merge(job.result.stats);
+        out << (i ? "," : "") << "{\"input\":";
+        write_json_string(out, job.input);
+        out << ",\"output\":";
+        write_json_string(out, job.output);
+        out << ",\"success\":" << (job.result.success ? "true" : "false")
+            << ",\"milliseconds\":" << job.milliseconds << ",\"stats\":";
+        job.result.stats.write_json(out);
+        out << '}';
+    }
+    out << "],\"total\":";
+    total.write_json(out);
+    out << '}' << std::endl;
+    return out.good();
+}
+
+} // namespace
+
+int run_batch(const BatchOptions& options) {
+    std::vector<BatchJob> jobs;
+    for (const auto& input : options.inputs) {
+        if (!input.empty() && input[0] == '@') {
+            if (!collect_manifest(options, input.substr(1), jobs)) return 1;
+        } else if (has_wildcard(input)) {
+            collect_glob(options, input, jobs);
+        } else if (fs::is_directory(input)) {
+            collect_directory(options, input, jobs);
+        } else {
+            jobs.push_back({input, output_for(options, fs::path(input).filename()), {}, 0.0});
+        }
+    }
+
+    if (jobs.empty()) {
+        std::cerr << "No input files found." << std::endl;
+        return 1;
+    }
+    resolve_output_collisions(options, jobs);
+
+    // Keep standard output clean when the statistics are written there.
+    std::ostream& report = (options.stats_path == "-") ? std::cerr : std::cout;
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        // The pool runs one job per worker at a time, and each worker thread converts
+        // its files with one warm VgmConverter (see run_job()), so at most pool.size()
+        // conversions are in flight. Their memory grows with the input, and is only
+        // bounded when --max-input-mb rejects large files.
+        WorkStealingPool pool(options.jobs);
+        report << "Converting " << jobs.size() << " file(s) on " << pool.size() << " thread(s)." << std::endl;
+        for (auto& job : jobs) {
+            if (!job.result.error.empty()) continue; // Output collision, see resolve_output_collisions()
+            BatchJob* target = &job;
+            pool.submit([&options, target] { run_job(options, *target); });
+        }
+        pool.wait();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    size_t succeeded = 0;
+    size_t thinned = 0;
+    size_t cached = 0;
+    for (const auto& job : jobs) {
+        if (job.result.success) {
+            ++succeeded;
+            thinned += job.result.expression_events_removed;
+            if (job.result.cached) ++cached;
+            report << (job.result.cached ? "CACHE " : "OK    ") << job.input << " -> " << job.output;
+        } else {
+            report << "FAIL  " << job.input << ": " << job.result.error;
+        }
+        report << " (" << std::fixed << std::setprecision(1) << job.milliseconds << " ms)" << std::endl;
+    }
+
+    double seconds = elapsed.count();
+    report << "\n--- Batch Summary ---" << std::endl;
+    report << "Files: " << jobs.size() << ", succeeded: " << succeeded
+              << ", failed: " << (jobs.size() - succeeded) << std::endl;
+    if (options.conversion.midi.expression_thinning.enabled()) {
+        report << "CC#11 events removed by thinning: " << thinned << std::endl;
+    }
+    if (options.conversion.cache) {
+        report << "Cache: " << cached << " of " << jobs.size() << " file(s) reused ("
+               << std::setprecision(1) << (100.0 * cached / jobs.size()) << "% hit rate)" << std::endl;
+    }
+    report << "Elapsed: " << std::setprecision(3) << seconds << " s, "
+              << std::setprecision(1) << (seconds > 0.0 ? jobs.size() / seconds : 0.0) << " files/s" << std::endl;
+
+    if (!options.stats_path.empty() && !write_stats(options.stats_path, jobs)) {
+        return 1;
+    }
+    return succeeded == jobs.size() ? 0 : 1;
+}
@@ -0,0 +1,26 @@
+#ifndef BATCH_CONVERTER_H
+#define BATCH_CONVERTER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Converter.h"
+
+struct BatchOptions {
+    // Directories (searched recursively for .vgm/.vgz files), glob patterns such as
+    // "rips/*.vgm", or "@list.txt" manifests with one input per line and an
+    // optional tab-separated output path.
+    std::vector<std::string> inputs;
+    std::string output_dir = ".";
+    unsigned jobs = 0;          // 0 = hardware concurrency
+    uint64_t max_input_size = 0; // Files larger than this are rejected, 0 = unlimited
+    std::string stats_path;     // Per-file and aggregate statistics as JSON, "-" = stdout
+    ConversionOptions conversion;
+};
+
+// Converts every input on a work-stealing thread pool and prints a per-file
+// summary plus aggregate throughput (on standard error if the statistics are written
+// to standard output). Returns the process exit code.
+int run_batch(const BatchOptions& options);
+
+#endif // BATCH_CONVERTER_H
@@ -0,0 +1,59 @@
+#ifndef BYTE_SPAN_H
+#define BYTE_SPAN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A read-only view over a contiguous block of bytes (file mapping, vector, RPC payload...).
+// All multi-byte reads are bounds-checked and assembled byte by byte, so they are
+// safe on unaligned addresses and independent of the host's endianness.
+class ByteSpan {
+public:
+    ByteSpan() : ptr(nullptr), length(0) {}
+    ByteSpan(const uint8_t* data, size_t size) : ptr(data), length(size) {}
+    ByteSpan(const std::vector<uint8_t>& data) : ptr(data.data()), length(data.size()) {}
+
+    const uint8_t* data() const { return ptr; }
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+    uint8_t operator[](size_t index) const { return ptr[index]; }
+
+    // True if [pos, pos + count) lies inside the span.
+    bool has(size_t pos, size_t count) const {
+        return pos <= length && count <= length - pos;
+    }
+
+    ByteSpan subspan(size_t pos, size_t count) const {
+        if (pos > length) return ByteSpan();
+        if (count > length - pos) count = length - pos;
+        return ByteSpan(ptr + pos, count);
+    }
+
+    bool read_u8(size_t pos, uint8_t& out) const {
+        if (!has(pos, 1)) return false;
+        out = ptr[pos];
+        return true;
+    }
+
+    bool read_le16(size_t pos, uint16_t& out) const {
+        if (!has(pos, 2)) return false;
+        out = static_cast<uint16_t>(ptr[pos] | (ptr[pos + 1] << 8));
+        return true;
+    }
+
+    bool read_le32(size_t pos, uint32_t& out) const {
+        if (!has(pos, 4)) return false;
+        out = static_cast<uint32_t>(ptr[pos]) |
+              (static_cast<uint32_t>(ptr[pos + 1]) << 8) |
+              (static_cast<uint32_t>(ptr[pos + 2]) << 16) |
+              (static_cast<uint32_t>(ptr[pos + 3]) << 24);
+        return true;
+    }
+
+private:
+    const uint8_t* ptr;
+    size_t length;
+};
+
+#endif // BYTE_SPAN_H
@@ -0,0 +1,350 @@
+#include "ChannelMidiEngine.h"
+#include "Logger.h"
+#include <algorithm>
+#include <numeric>
+
+// VGM samples per second.
+const uint64_t SAMPLE_RATE = 44100;
+
+ChannelMidiEngine::ChannelMidiEngine(MidiWriter& midi_writer)
+    : midi_writer(midi_writer),
+      added_channels(0),
+      bend_range(0),
+      current_time(0),
+      window_start(0),
+      window_end(UINT64_MAX),
+      current_tick(0),
+      tick_remainder(0),
+      window(Window::Open),
+      loop(Loop::None),
+      loop_start_time(0),
+      loop_end_time(0),
+      suppressed_window(Window::Open) {
+    initial_program.fill(-1);
+    set_time_base();
+}
+
+void ChannelMidiEngine::reset() {
+    channels = ChannelTrackingState();
+    initial_program.fill(-1);
+    added_channels = 0;
+    bend_range = 0;
+    current_time = 0;
+    window_start = 0;
+    window_end = UINT64_MAX;
+    window = Window::Open;
+    loop = Loop::None;
+    set_time_base();
+}
+
+// ticks = samples * ppqn * 10^6 / (44100 * tempo); the common factor 100 of 10^6 and
+// 44100 is taken out first, which keeps both terms below 2^32 for any valid PPQN and
+// tempo and so every product in midi_time_of() within 64 bits.
+void ChannelMidiEngine::set_time_base() {
+    uint64_t numerator = uint64_t(midi_writer.ticks_per_quarter()) * (1000000 / 100);
+    uint64_t denominator = (SAMPLE_RATE / 100) * midi_writer.tempo();
+    uint64_t divisor = std::gcd(numerator, denominator);
+    tick_numerator = numerator / divisor;
+    tick_denominator = denominator / divisor;
+    sync_tick();
+}
+
+// Recomputes current_tick after current_time or window_start jumped.
+void ChannelMidiEngine::sync_tick() {
+    uint64_t elapsed = current_time > window_start ? current_time - window_start : 0;
+    current_tick = midi_time_of(window_start + elapsed);
+    tick_remainder = (elapsed % tick_denominator) * tick_numerator % tick_denominator;
+}
+
+void ChannelMidiEngine::add_channel(int channel, const std::string& name, uint8_t program) {
+    midi_writer.set_track_name(channel, name);
+    midi_writer.add_program_change(channel, program, 0);
+    channels.program[channel] = program;
+    initial_program[channel] = program;
+    added_channels |= static_cast<uint16_t>(1u << channel);
+    if (bend_range > 0 && channel != PERCUSSION_CHANNEL) announce_bend_range(channel);
+}
+
+void ChannelMidiEngine::set_pitch_bend_range(int semitones) {
+    bend_range = std::min(std::max(semitones, 0), 24);
+    if (bend_range == 0) return;
+    // Deviation in cents -> bend value, so that update() does no division.
+    int span = bend_range * 100;
+    bend_for_cents.resize(2 * span + 1);
+    for (int cents = -span; cents <= span; ++cents) {
+        int value = ChannelTrackingState::PITCH_BEND_CENTER + (cents * 8192 + (cents < 0 ? -span : span) / 2) / span;
+        bend_for_cents[cents + span] = static_cast<uint16_t>(std::min(value, 16383));
+    }
+    for (int i = 0; i < CHANNEL_COUNT; ++i) {
+        if ((added_channels & (1u << i)) && i != PERCUSSION_CHANNEL) announce_bend_range(i);
+    }
+}
+
+void ChannelMidiEngine::announce_bend_range(int channel) {
+    midi_writer.add_control_change(channel, 101, 0, 0); // RPN 0: pitch bend sensitivity
+    midi_writer.add_control_change(channel, 100, 0, 0);
+    midi_writer.add_control_change(channel, 6, static_cast<uint8_t>(bend_range), 0);
+    midi_writer.add_control_change(channel, 38, 0, 0);
+    midi_writer.add_control_change(channel, 101, 127, 0); // RPN null, so later data entry does nothing
+    midi_writer.add_control_change(channel, 100, 127, 0);
+}
+
+void ChannelMidiEngine::bend(int channel, int deviation_cents, bool emit, uint32_t midi_time) {
+    int value = bend_for_cents[deviation_cents + bend_range * 100];
+    if (value == channels.pitch_bend[channel]) return;
+    if (emit) {
+        VGM_LOG_TRACE("tick %u ch%d pitch bend %d", midi_time, channel + 1, value);
+        midi_writer.add_pitch_bend(channel, static_cast<uint16_t>(value), midi_time);
+    }
+    channels.pitch_bend[channel] = value;
+}
+
+// The program is only resolved when a note starts: a driver uploads a wavetable one
+// byte at a time, and neither the waveforms in between nor one loaded while the
+// channel is silent or holding a note are heard as a new instrument.
+void ChannelMidiEngine::select_program(int channel, int program, bool emit, uint32_t midi_time) {
+    if (program < 0 || program == channels.program[channel]) return;
+    if (emit) {
+        VGM_LOG_DEBUG("tick %u ch%d program %d", midi_time, channel + 1, program);
+        midi_writer.add_program_change(channel, static_cast<uint8_t>(program), midi_time);
+    }
+    channels.program[channel] = program;
+}
+
+void ChannelMidiEngine::forget_programs() {
+    channels.program.fill(-1);
+}
+
+void ChannelMidiEngine::restore(uint64_t time, const ChannelTrackingState& state) {
+    current_time = time;
+    channels = state;
+    sync_tick();
+}
+
+void ChannelMidiEngine::set_window(const OutputWindow& output_window) {
+    window_start = output_window.start;
+    window_end = output_window.bounded ? std::max(output_window.start, output_window.end) : UINT64_MAX;
+    window = Window::Before;
+    sync_tick();
+    if (current_time >= window_start) open_window();
+}
+
+void ChannelMidiEngine::track_only() {
+    window_start = 0;
+    window_end = UINT64_MAX;
+    window = Window::Tracking;
+    sync_tick();
+}
+
+void ChannelMidiEngine::set_suppressed(bool suppressed) {
+    if (suppressed) {
+        suppressed_window = window;
+        window = Window::Before;
+    } else {
+        window = suppressed_window;
+    }
+}
+
+void ChannelMidiEngine::open_window() {
+    window = Window::Open;
+    VGM_LOG_DEBUG("window opens at sample %llu", static_cast<unsigned long long>(window_start));
+    for (int i = 0; i < CHANNEL_COUNT; ++i) {
+        if (channels.program[i] >= 0 && channels.program[i] != initial_program[i]) {
+            midi_writer.add_program_change(i, static_cast<uint8_t>(channels.program[i]), 0);
+        }
+        if (channels.expression[i] >= 0) midi_writer.add_control_change(i, 11, channels.expression[i], 0);
+        if (channels.pitch_bend[i] != ChannelTrackingState::PITCH_BEND_CENTER) {
+            midi_writer.add_pitch_bend(i, static_cast<uint16_t>(channels.pitch_bend[i]), 0);
+        }
+        if (channels.last_note[i] > 0) midi_writer.add_note_on(i, channels.last_note[i], channels.note_velocity[i], 0);
+    }
+    if (current_time >= window_end) close_window();
+}
+
+void ChannelMidiEngine::close_window() {
+    VGM_LOG_DEBUG("window closes at sample %llu", static_cast<unsigned long long>(window_end));
+    release_notes(midi_time_of(window_end));
+    window = Window::After;
+}
+
+void ChannelMidiEngine::release_notes(uint32_t midi_time) {
+    for (int i = 0; i < CHANNEL_COUNT; ++i) {
+        if (channels.last_note[i] > 0) {
+            midi_writer.add_note_off(i, channels.last_note[i], midi_time);
+        }
+    }
+}
+
+// Exact floor of (sample - window_start) * tick_numerator / tick_denominator, split
+// so that no product overflows.
+uint32_t ChannelMidiEngine::midi_time_of(uint64_t sample) const {
+    uint64_t elapsed = sample - window_start;
+    uint64_t ticks = elapsed / tick_denominator * tick_numerator +
+                     elapsed % tick_denominator * tick_numerator / tick_denominator;
+    return static_cast<uint32_t>(ticks);
+}
+
+void ChannelMidiEngine::mark_loop_start(uint32_t loop_samples) {
+    if (loop != Loop::None || loop_samples == 0 || window != Window::Open) return;
+    loop = Loop::Active;
+    loop_start_time = current_time;
+    loop_end_time = current_time + loop_samples;
+    // Writes of this timestamp are still pending, so the state is the one the first
+    // events of the loop start from.
+    loop_start_state = channels;
+    VGM_LOG_DEBUG("loop from sample %llu to %llu", static_cast<unsigned long long>(loop_start_time),
+                  static_cast<unsigned long long>(loop_end_time));
+
+    if (loop_options.markers) {
+        uint32_t midi_time = static_cast<uint32_t>(current_tick);
+        midi_writer.add_marker("loopStart", midi_time);
+        midi_writer.add_control_change(0, 111, 0, midi_time); // Loop start as understood by RPG Maker & co.
+    }
+    if (loop_options.stop_at_loop_end || loop_options.extra_loops > 0) {
+        window_end = std::min(window_end, loop_end_time);
+    }
+    if (loop_options.extra_loops > 0) midi_writer.begin_capture();
+}
+
+void ChannelMidiEngine::resume_loop(uint64_t start, uint64_t end) {
+    loop_start_time = start;
+    loop_end_time = end;
+    loop = current_time < end ? Loop::Active : Loop::Done;
+}
+
+void ChannelMidiEngine::end_loop() {
+    loop = Loop::Done;
+    loop_end_state = channels;
+    midi_writer.end_capture();
+    if (loop_options.markers) midi_writer.add_marker("loopEnd", midi_time_of(loop_end_time));
+}
+
+void ChannelMidiEngine::finish_loops() {
+    if (loop == Loop::Active) {
+        // The data ended before the declared loop length; loop what there is.
+        loop_end_time = current_time;
+        end_loop();
+    }
+    if (loop != Loop::Done || loop_options.extra_loops == 0) return;
+    if (window == Window::Open) {
+        release_notes(midi_time_of(loop_end_time));
+        window = Window::After;
+    }
+
+    uint64_t length = loop_end_time - loop_start_time;
+    uint32_t loop_start_tick = midi_time_of(loop_start_time);
+    for (unsigned pass = 0; pass < loop_options.extra_loops; ++pass) {
+        uint64_t start = loop_end_time + pass * length;
+        uint32_t start_tick = midi_time_of(start);
+        for (int i = 0; i < CHANNEL_COUNT; ++i) {
+            if (loop_start_state.program[i] >= 0 && loop_start_state.program[i] != loop_end_state.program[i]) {
+                midi_writer.add_program_change(i, static_cast<uint8_t>(loop_start_state.program[i]), start_tick);
+            }
+            if (loop_start_state.expression[i] >= 0) {
+                midi_writer.add_control_change(i, 11, loop_start_state.expression[i], start_tick);
+            }
+            if (loop_start_state.pitch_bend[i] != loop_end_state.pitch_bend[i]) {
+                midi_writer.add_pitch_bend(i, static_cast<uint16_t>(loop_start_state.pitch_bend[i]), start_tick);
+            }
+            if (loop_start_state.last_note[i] > 0) {
+                midi_writer.add_note_on(i, loop_start_state.last_note[i], loop_start_state.note_velocity[i], start_tick);
+            }
+        }
+        midi_writer.replay_capture(start_tick - loop_start_tick);
+        uint32_t end_tick = midi_time_of(start + length);
+        for (int i = 0; i < CHANNEL_COUNT; ++i) {
+            if (loop_end_state.last_note[i] > 0) midi_writer.add_note_off(i, loop_end_state.last_note[i], end_tick);
+        }
+    }
+    VGM_LOG_DEBUG("appended %u loop pass(es) of %llu samples", loop_options.extra_loops,
+                  static_cast<unsigned long long>(length));
+}
+
+void ChannelMidiEngine::advance_time(uint16_t samples) {
+    current_time += samples;
+    if (current_time > window_start) {
+        // Only the part of the wait after the window start counts.
+        uint64_t counted = std::min<uint64_t>(samples, current_time - window_start);
+        tick_remainder += counted * tick_numerator;
+        current_tick += tick_remainder / tick_denominator;
+        tick_remainder %= tick_denominator;
+    }
+    if (current_time >= loop_end_time && loop == Loop::Active) {
+        end_loop();
+    }
+    if (current_time >= window_end && window == Window::Open) {
+        close_window();
+    } else if (current_time >= window_start && window == Window::Before) {
+        open_window(); // Closes it again if the wait jumped past the end
+    }
+}
+
+void ChannelMidiEngine::update(int channel, const ChannelOutput& output) {
+    bool is_on = output.on;
+    int current_note_pitch = output.note;
+    // Periods close to the top of a chip's range are far above the MIDI range (drivers
+    // use them to silence a channel); such pitches cannot be encoded and are treated
+    // as silence.
+    if (current_note_pitch < 1 || current_note_pitch > 127) is_on = false;
+    int velocity = output.velocity;
+
+    int last_note = channels.last_note[channel];
+    bool was_on = last_note > 0;
+
+    // Outside the output window the state a restart would need is still tracked.
+    bool emit = window == Window::Open;
+    uint32_t midi_time = static_cast<uint32_t>(current_tick);
+
+    // Glide mode: a pitch within the bend range of the held note only bends it.
+    bool bends = bend_range > 0 && channel != PERCUSSION_CHANNEL;
+    int deviation = (current_note_pitch - last_note) * 100 + output.cents;
+    bool glide = bends && is_on && was_on && !output.retrigger &&
+                 deviation >= -bend_range * 100 && deviation <= bend_range * 100;
+
+    if (is_on && !was_on) {
+        select_program(channel, output.program, emit, midi_time);
+        if (bends) bend(channel, output.cents, emit, midi_time); // Ahead of the note-on (same tick)
+        if (emit) {
+            VGM_LOG_DEBUG("tick %u ch%d note on %d velocity %d", midi_time, channel + 1, current_note_pitch, velocity);
+            midi_writer.add_note_on(channel, current_note_pitch, velocity, midi_time);
+        }
+        channels.last_note[channel] = current_note_pitch;
+        channels.last_velocity[channel] = velocity;
+        channels.note_velocity[channel] = velocity;
+    } else if (!is_on && was_on) {
+        if (emit) {
+            VGM_LOG_DEBUG("tick %u ch%d note off %d", midi_time, channel + 1, last_note);
+            midi_writer.add_note_off(channel, last_note, midi_time);
+        }
+        channels.last_note[channel] = 0;
+        channels.last_velocity[channel] = -1;
+    } else if (is_on && was_on) {
+        // Note is currently on, check for changes
+        if (glide) {
+            bend(channel, deviation, emit, midi_time);
+        } else if (current_note_pitch != last_note || output.retrigger) {
+            // Pitch change (legato) or a restart of the same note
+            select_program(channel, output.program, emit, midi_time);
+            if (bends) bend(channel, output.cents, emit, midi_time);
+            if (emit) {
+                VGM_LOG_DEBUG("tick %u ch%d legato %d -> %d", midi_time, channel + 1, last_note, current_note_pitch);
+                midi_writer.add_note_off(channel, last_note, midi_time);
+                midi_writer.add_note_on(channel, current_note_pitch, velocity, midi_time);
+            }
+            channels.last_note[channel] = current_note_pitch;
+            channels.last_velocity[channel] = velocity;
+            channels.note_velocity[channel] = velocity;
+            return;
+        }
+        if (velocity != channels.last_velocity[channel]) {
+            // Volume change (software envelope)
+            // Use CC#11 (Expression) for dynamic volume changes, which is more standard than CC#7.
+            if (emit) {
+                VGM_LOG_TRACE("tick %u ch%d expression %d", midi_time, channel + 1, velocity);
+                midi_writer.add_control_change(channel, 11, velocity, midi_time); // CC 11 is Expression
+            }
+            channels.last_velocity[channel] = velocity;
+            channels.expression[channel] = velocity;
+        }
+    }
+}
@@ -0,0 +1,141 @@
+#ifndef CHANNEL_MIDI_ENGINE_H
+#define CHANNEL_MIDI_ENGINE_H
+
+#include "ChipBackend.h"
+#include "MidiWriter.h"
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// What each MIDI channel is currently sounding, as far as the chips' output goes.
+struct ChannelTrackingState {
+    static const int CHANNEL_COUNT = 16;
+    std::array<int, CHANNEL_COUNT> last_note{};     // 0 = silent; the held note in glide mode
+    std::array<int, CHANNEL_COUNT> last_velocity{}; // -1 = silent
+    std::array<int, CHANNEL_COUNT> note_velocity{}; // Note-on velocity of the sounding note
+    std::array<int, CHANNEL_COUNT> expression{};    // Last CC#11 value sent, -1 = none yet
+    std::array<int, CHANNEL_COUNT> pitch_bend{};    // Last pitch bend sent (14 bits), 8192 = none
+    std::array<int, CHANNEL_COUNT> program{};       // Last program change sent, -1 = none or unknown
+
+    ChannelTrackingState() {
+        last_velocity.fill(-1);
+        expression.fill(-1);
+        pitch_bend.fill(PITCH_BEND_CENTER);
+        program.fill(-1);
+    }
+
+    static constexpr int PITCH_BEND_CENTER = 8192;
+};
+
+// What to do with the loop declared in the VGM header (loop offset 0x1C, loop
+// sample count 0x20). The loop runs from the loop offset to the end of the data.
+struct LoopOptions {
+    bool markers = true;           // "loopStart"/"loopEnd" marker meta events plus CC#111 at the loop start
+    bool stop_at_loop_end = false; // Release all notes and stop at the end of the first pass
+    unsigned extra_loops = 0;      // Passes appended after the first one; implies stop_at_loop_end
+};
+
+// Part of the stream that produces MIDI output, in samples (44100 Hz).
+struct OutputWindow {
+    uint64_t start = 0;   // Shown as tick 0
+    uint64_t end = 0;     // First sample without output, if `bounded`
+    bool bounded = false; // Otherwise the output runs to the end of the stream
+
+    bool whole_stream() const { return start == 0 && !bounded; }
+};
+
+// Turns the per-channel output of the chip backends (ChannelOutput) into MIDI
+// events: note-on/off on changes of the audible state and of the note, CC#11 for
+// volume changes of a held note, and a program change ahead of a note that starts
+// with a different timbre (ChannelOutput::program). It also owns everything that is
+// independent of the chip: the stream time, the output window and the loop handling.
+//
+// In glide mode (set_pitch_bend_range()) a pitch change of a sounding channel bends
+// the held note instead of retriggering it, so vibrato and portamento keep a single
+// note; the note is only replaced when the pitch leaves the bend range.
+class ChannelMidiEngine {
+public:
+    static const int CHANNEL_COUNT = ChannelTrackingState::CHANNEL_COUNT;
+    // GM percussion (MIDI channel 10): notes select drums and are never bent.
+    static const int PERCUSSION_CHANNEL = 9;
+
+    explicit ChannelMidiEngine(MidiWriter& midi_writer);
+    // Back to time 0 with every channel silent; call after resetting the MidiWriter.
+    void reset();
+
+    // Names the channel's track and selects its instrument at tick 0.
+    void add_channel(int channel, const std::string& name, uint8_t program);
+    // Glide mode with a bend range of `semitones` (1-24), announced through RPN 0 at
+    // tick 0 on every channel; 0 retriggers notes on every semitone change. Call
+    // once per stream, before the first write.
+    void set_pitch_bend_range(int semitones);
+    int pitch_bend_range() const { return bend_range; }
+    // Compares a channel's output with what it sounded before and emits the events
+    // for the difference.
+    void update(int channel, const ChannelOutput& output);
+    void advance_time(uint16_t samples);
+
+    uint64_t time() const { return current_time; }
+    const ChannelTrackingState& tracking() const { return channels; }
+    void restore(uint64_t time, const ChannelTrackingState& state);
+    // Marks every channel's program unknown, so that the next note of each channel
+    // states its program (segments of the parallel parser).
+    void forget_programs();
+
+    // See ChipModel::set_window() and ChipModel::track_only().
+    void set_window(const OutputWindow& output_window);
+    void track_only();
+    bool window_closed() const { return window == Window::After; }
+    // Evaluations while suppressed only track state, like those before the window.
+    void set_suppressed(bool suppressed);
+
+    void set_loop_options(const LoopOptions& options) { loop_options = options; }
+    const LoopOptions& loop_settings() const { return loop_options; }
+    void mark_loop_start(uint32_t loop_samples);
+    void finish_loops();
+    void resume_loop(uint64_t start, uint64_t end);
+
+    MidiWriter& output() { return midi_writer; }
+
+private:
+    MidiWriter& midi_writer;
+    ChannelTrackingState channels;
+    uint16_t added_channels; // Bit n: add_channel(n) was called
+    int bend_range;          // Semitones, 0 = no glide
+    std::vector<uint16_t> bend_for_cents; // Pitch bend value by deviation + bend_range * 100 cents
+    uint64_t current_time;
+    uint64_t window_start;  // Sample shown as tick 0
+    uint64_t window_end;    // No output from here on; UINT64_MAX (never reached) if unbounded
+    // Samples -> ticks is the exact fraction tick_numerator / tick_denominator (in
+    // lowest terms, from the writer's PPQN and tempo). current_tick is the tick of
+    // current_time, advanced by every wait with the remainder carried over, so it
+    // never drifts from the exact value.
+    uint64_t tick_numerator;
+    uint64_t tick_denominator;
+    uint64_t current_tick;
+    uint64_t tick_remainder;
+    // Tracking: no output at all, the window never opens (track_only()).
+    enum class Window : uint8_t { Before, Open, After, Tracking } window;
+    LoopOptions loop_options;
+    enum class Loop : uint8_t { None, Active, Done } loop;
+    uint64_t loop_start_time;
+    uint64_t loop_end_time;
+    std::array<int, CHANNEL_COUNT> initial_program; // Selected by add_channel(), -1 = none
+    ChannelTrackingState loop_start_state; // Restated at the start of every unrolled pass
+    ChannelTrackingState loop_end_state;   // Notes released, bends and programs in effect at the end of every pass
+    Window suppressed_window; // Window state to return to after set_suppressed(false)
+
+    void open_window();
+    void close_window();
+    void end_loop();
+    void release_notes(uint32_t midi_time);
+    void announce_bend_range(int channel);
+    void select_program(int channel, int program, bool emit, uint32_t midi_time);
+    void bend(int channel, int deviation_cents, bool emit, uint32_t midi_time);
+    void set_time_base();
+    void sync_tick();
+    uint32_t midi_time_of(uint64_t sample) const;
+};
+
+#endif // CHANNEL_MIDI_ENGINE_H
@@ -0,0 +1,78 @@
+#ifndef CHIP_BACKEND_H
+#define CHIP_BACKEND_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Sound chips the converter can model. The values index VgmChipClocks and the
+// per-chip statistics.
+enum class ChipId : uint8_t {
+    WonderSwan, // 0xBC aa dd
+    Dmg,        // 0xB3 aa dd, Game Boy DMG APU
+    Sn76489,    // 0x50 dd
+};
+
+const size_t VGM_CHIP_COUNT = 3;
+
+inline const char* chip_name(ChipId id) {
+    static const char* const names[VGM_CHIP_COUNT] = {"wonderswan", "dmg", "sn76489"};
+    return names[static_cast<size_t>(id)];
+}
+
+// Clocks declared in the VGM header, in Hz; 0 = chip not used by the stream.
+using VgmChipClocks = std::array<uint32_t, VGM_CHIP_COUNT>;
+
+// What one chip channel sounds like right now, as handed to ChannelMidiEngine.
+struct ChannelOutput {
+    bool on = false;        // Audible: enabled, non-zero volume
+    int note = 0;           // MIDI note; outside 1-127 counts as silence
+    int cents = 0;          // Remainder from `note` to the exact pitch, -50..50
+    int velocity = 0;       // 0-127
+    bool retrigger = false; // The chip restarted the note (key-on while sounding)
+    int program = -1;       // GM program for the channel's timbre, -1 = leave as is
+};
+
+// A chip backend is a plain class that ChipModel<Backends...> holds by value and
+// calls without virtual dispatch. It decodes register writes into channel state and
+// leaves the note/velocity/event tracking to ChannelMidiEngine:
+//
+//   static constexpr ChipId ID;
+//   static constexpr int CHANNELS;            // At most 8
+//   static constexpr std::array<uint8_t, CHANNELS> MIDI_CHANNELS; // MIDI channel of each channel
+//   static constexpr size_t REGISTER_BYTES;   // Size of the saved register file
+//   static constexpr bool ALWAYS_ACTIVE;      // Active even if the header declares no clock
+//   static constexpr bool SEGMENTABLE;        // See below
+//   static constexpr bool TIMED;              // See below
+//   explicit Backend(const MidiMappingTables& mapping);
+//   void reset();                             // Power-on state
+//   void set_clock(uint32_t hz);              // From the VGM header, before the first write
+//   void set_stats(ConversionStats* stats);
+//   void set_waveform_cache(WaveformCache* cache); // Timbre classification memo, may be null
+//   uint8_t write_port(uint8_t reg, uint8_t value); // Returns the channels to re-evaluate
+//   ChannelOutput evaluate(int channel);      // Called once per timestamp for written channels
+//   void save_registers(uint8_t* out) const;  // REGISTER_BYTES bytes
+//   void load_registers(const uint8_t* in);
+//   static const char* channel_name(int channel);
+//   static uint8_t default_program(int channel);
+//
+// SEGMENTABLE backends have no state besides the last value written to each
+// register, so the parallel parser can rebuild their state at any wait from a scan
+// of the writes alone; they also provide
+//   static int register_index(uint8_t reg);   // Byte of the register file, -1 = none
+//   static bool starts_history(uint8_t reg, uint8_t value); // See below
+// A write for which starts_history() is true may make the state depend on time as
+// well (a running frequency sweep); a stream containing one is parsed sequentially.
+//
+// TIMED backends change channel state between writes, and are told how much time
+// passed at every wait, after the writes before it were evaluated:
+//   uint8_t advance(uint32_t samples);        // Returns the channels to re-evaluate
+// The state at the end of the wait is computed in one step, so the cost does not
+// depend on the length of the wait.
+//
+// Backends with sound RAM filled through a VGM memory write command (0xC6 for the
+// WonderSwan) keep it in their register file and also provide
+//   uint8_t write_memory(uint16_t offset, uint8_t value); // Returns the channels to re-evaluate
+//   static int memory_index(uint16_t offset);  // Byte of the register file, -1 = none
+
+#endif // CHIP_BACKEND_H
@@ -0,0 +1,386 @@
+#ifndef CHIP_MODEL_H
+#define CHIP_MODEL_H
+
+#include "ChipBackend.h"
+#include "ChannelMidiEngine.h"
+#include "MidiWriter.h"
+#include "MidiMapping.h"
+#include "ConversionStats.h"
+#include "Logger.h"
+#include "WonderSwanChip.h"
+#include "DmgChip.h"
+#include "Sn76489Chip.h"
+#include <array>
+#include <cstdint>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Backend channel mask (as returned by write_port()) -> MIDI channel mask.
+template <typename Backend>
+constexpr std::array<uint16_t, 256> make_midi_channel_masks() {
+    std::array<uint16_t, 256> masks{};
+    for (int bits = 0; bits < 256; ++bits) {
+        for (int channel = 0; channel < Backend::CHANNELS; ++channel) {
+            if (bits & (1 << channel)) masks[bits] |= static_cast<uint16_t>(1u << Backend::MIDI_CHANNELS[channel]);
+        }
+    }
+    return masks;
+}
+
+template <typename Backend>
+inline constexpr std::array<uint16_t, 256> MIDI_CHANNEL_MASKS = make_midi_channel_masks<Backend>();
+
+// Everything the chip model needs to continue a stream from a given sample: the
+// register files of the backends plus what each MIDI channel is currently sounding.
+// Stored in seek index checkpoints.
+struct ChipModelState {
+    uint64_t time = 0;            // Samples since the start of the stream
+    uint16_t dirty_channels = 0;  // MIDI channels written at `time`, not evaluated yet
+    std::vector<uint8_t> registers; // Register files of the backends, in model order
+    ChannelTrackingState channels;
+    uint8_t pitch_bend_range = 0; // Glide setting `channels` was tracked with
+};
+
+// The sound hardware of a VGM stream: one or more chip backends (ChipBackend.h)
+// feeding a shared ChannelMidiEngine. Register writes reach their backend through
+// write<ChipId>(), which is resolved at compile time, so there is no virtual call per
+// write. Written channels are evaluated once per timestamp, when advance_time() moves
+// time forward or flush() is called at the end of the stream, so a two-byte period
+// update cannot produce a spurious note-off/note-on pair from the half-written value.
+//
+// Backends declared by the VGM header (set_clocks()) and those that are ALWAYS_ACTIVE
+// get their MIDI channels named and their default programs at tick 0; writes to the
+// other backends are ignored.
+template <typename... Backends>
+class ChipModel {
+public:
+    static constexpr size_t BACKEND_COUNT = sizeof...(Backends);
+    static constexpr size_t REGISTER_BYTES = (Backends::REGISTER_BYTES + ...);
+
+    // `mapping` selects the pitch/velocity profile, see MidiMapping.h.
+    explicit ChipModel(MidiWriter& midi_writer, const MidiMappingTables& mapping = DEFAULT_MIDI_MAPPING)
+        : mapping(mapping), engine(midi_writer), backends(Backends(mapping)...), active(0), dirty_channels(0),
+          stats(nullptr), wave_cache(nullptr) {
+        activate_defaults();
+    }
+    ChipModel(const ChipModel&) = delete;
+    ChipModel& operator=(const ChipModel&) = delete;
+
+    template <ChipId Id>
+    void write(uint8_t reg, uint8_t value) {
+        constexpr size_t I = index_of<Id>();
+        if constexpr (I < BACKEND_COUNT) {
+            using Backend = std::tuple_element_t<I, std::tuple<Backends...>>;
+            if (!(active & (1u << I))) return;
+            VGM_LOG_TRACE("sample %llu %s 0x%02X = 0x%02X", static_cast<unsigned long long>(engine.time()), chip_name(Id), reg,
+                          value);
+            VGM_STATS(++stats->chip_writes[static_cast<size_t>(Id)]);
+            uint16_t marked = MIDI_CHANNEL_MASKS<Backend>[std::get<I>(backends).write_port(reg, value)];
+            VGM_STATS(if (marked != 0 && (marked & ~dirty_channels) == 0) ++stats->writes_coalesced);
+            dirty_channels |= marked;
+        }
+    }
+
+    // Write to the sound RAM of chip `Id` (VGM memory write command).
+    template <ChipId Id>
+    void write_memory(uint16_t offset, uint8_t value) {
+        constexpr size_t I = index_of<Id>();
+        if constexpr (I < BACKEND_COUNT) {
+            using Backend = std::tuple_element_t<I, std::tuple<Backends...>>;
+            if (!(active & (1u << I))) return;
+            VGM_LOG_TRACE("sample %llu %s RAM 0x%04X = 0x%02X", static_cast<unsigned long long>(engine.time()), chip_name(Id),
+                          offset, value);
+            VGM_STATS(++stats->chip_writes[static_cast<size_t>(Id)]);
+            uint16_t marked = MIDI_CHANNEL_MASKS<Backend>[std::get<I>(backends).write_memory(offset, value)];
+            VGM_STATS(if (marked != 0 && (marked & ~dirty_channels) == 0) ++stats->writes_coalesced);
+            dirty_channels |= marked;
+        }
+    }
+
+    void advance_time(uint16_t samples) {
+        if (samples == 0) return;
+        // Register writes are only evaluated once their timestamp is complete, so a
+        // multi-byte update (period low/high) yields one evaluation per channel.
+        flush();
+        engine.advance_time(samples);
+        for_each_backend([&](auto& backend, auto index) {
+            using Backend = std::decay_t<decltype(backend)>;
+            if constexpr (Backend::TIMED) {
+                if (active & (1u << decltype(index)::value)) {
+                    dirty_channels |= MIDI_CHANNEL_MASKS<Backend>[backend.advance(samples)];
+                }
+            }
+        });
+    }
+
+    // Evaluates channels written since the last time step; call at end of stream.
+    void flush() {
+        uint16_t dirty = dirty_channels;
+        if (dirty == 0) return;
+        dirty_channels = 0;
+        for_each_backend([&](auto& backend, auto) {
+            using Backend = std::decay_t<decltype(backend)>;
+            if ((dirty & MIDI_CHANNEL_MASKS<Backend>[0xFF]) == 0) return;
+            for (int channel = 0; channel < Backend::CHANNELS; ++channel) {
+                int midi_channel = Backend::MIDI_CHANNELS[channel];
+                if (dirty & (1u << midi_channel)) {
+                    VGM_STATS(++stats->channel_evaluations);
+                    engine.update(midi_channel, backend.evaluate(channel));
+                }
+            }
+        });
+    }
+
+    // Back to the power-on state for a new stream; call after resetting the MidiWriter.
+    void reset() {
+        for_each_backend([](auto& backend, auto) { backend.reset(); });
+        engine.reset();
+        active = 0;
+        dirty_channels = 0;
+        activate_defaults();
+    }
+
+    // Chip clocks from the VGM header: activates the backends the stream uses.
+    void set_clocks(const VgmChipClocks& clocks) {
+        for_each_backend([&](auto& backend, auto index) {
+            using Backend = std::decay_t<decltype(backend)>;
+            uint32_t clock = clocks[static_cast<size_t>(Backend::ID)];
+            if (clock == 0) return;
+            backend.set_clock(clock);
+            if (!(active & (1u << decltype(index)::value))) activate<decltype(index)::value>();
+        });
+    }
+
+    // True if every active backend is SEGMENTABLE and notes follow the registers
+    // without glide, so parallel parsing is possible.
+    bool segmentable() const {
+        bool result = engine.pitch_bend_range() == 0;
+        for_each_backend([&](const auto& backend, auto index) {
+            using Backend = std::decay_t<decltype(backend)>;
+            if (!Backend::SEGMENTABLE && (active & (1u << decltype(index)::value))) result = false;
+        });
+        return result;
+    }
+
+    // Counts register writes and channel evaluations into `stats` (may be null).
+    void set_stats(ConversionStats* stats) {
+        this->stats = stats;
+        for_each_backend([&](auto& backend, auto) { backend.set_stats(stats); });
+    }
+
+    // Memo of the waveform classification of the wavetable backends (may be null,
+    // may be shared between threads).
+    void set_waveform_cache(WaveformCache* cache) {
+        wave_cache = cache;
+        for_each_backend([&](auto& backend, auto) { backend.set_waveform_cache(cache); });
+    }
+    WaveformCache* waveform_cache() const { return wave_cache; }
+
+    uint64_t time() const { return engine.time(); }
+
+    ChipModelState save_state() const {
+        ChipModelState state;
+        state.time = engine.time();
+        state.dirty_channels = dirty_channels;
+        state.registers.resize(REGISTER_BYTES);
+        for_each_backend([&](const auto& backend, auto index) {
+            backend.save_registers(state.registers.data() + register_offset<decltype(index)::value>());
+        });
+        state.channels = engine.tracking();
+        state.pitch_bend_range = static_cast<uint8_t>(engine.pitch_bend_range());
+        return state;
+    }
+
+    // Fails without changing anything if the state was saved by a different model or
+    // with a different glide setting.
+    bool restore_state(const ChipModelState& state) {
+        if (state.registers.size() != REGISTER_BYTES || state.pitch_bend_range != engine.pitch_bend_range()) return false;
+        engine.restore(state.time, state.channels);
+        dirty_channels = state.dirty_channels;
+        for_each_backend([&](auto& backend, auto index) {
+            backend.load_registers(state.registers.data() + register_offset<decltype(index)::value>());
+        });
+        return true;
+    }
+
+    // Restricts MIDI output to samples [start, end) of `window` (to the end of the
+    // stream if it is not bounded), shifted so that `start` is tick 0. Before the
+    // window the model only tracks state; notes still sounding when it opens are
+    // started at tick 0, and notes held at `end` are released there.
+    void set_window(const OutputWindow& window) { engine.set_window(window); }
+    // No MIDI output at all, however long the stream: the model only tracks the state
+    // (for VgmReader::build_index()).
+    void track_only() { engine.track_only(); }
+    bool window_closed() const { return engine.window_closed(); }
+
+    void set_loop_options(const LoopOptions& options) { engine.set_loop_options(options); }
+    // Glide mode, see ChannelMidiEngine::set_pitch_bend_range(). Call after reset().
+    void set_pitch_bend_range(int semitones) { engine.set_pitch_bend_range(semitones); }
+    // Called by the reader at the first wait at or after the loop offset. The MIDI
+    // events of the next `loop_samples` samples are recorded when loops are unrolled.
+    void mark_loop_start(uint32_t loop_samples) { engine.mark_loop_start(loop_samples); }
+    // Call at end of stream, after flush(): appends the unrolled loop passes by
+    // replaying the recorded events rather than simulating the stream again.
+    void finish_loops() { engine.finish_loops(); }
+
+    // Segment models of the parallel parser (VgmReader::set_parse_threads).
+    const MidiMappingTables& midi_mapping() const { return mapping; }
+    const ChannelTrackingState& tracking() const { return engine.tracking(); }
+    const LoopOptions& loop_settings() const { return engine.loop_settings(); }
+    MidiWriter& output() { return engine.output(); }
+    // Byte of the model's register file that a write to `reg` of chip `Id` sets, or -1
+    // if the chip is not a SEGMENTABLE backend of this model. The parallel parser
+    // gives up on a stream with a write for which starts_history() is true.
+    template <ChipId Id>
+    static int register_index(uint8_t reg) {
+        constexpr size_t I = index_of<Id>();
+        if constexpr (I < BACKEND_COUNT) {
+            using Backend = std::tuple_element_t<I, std::tuple<Backends...>>;
+            if constexpr (Backend::SEGMENTABLE) {
+                int index = Backend::register_index(reg);
+                return index < 0 ? -1 : static_cast<int>(register_offset<I>()) + index;
+            }
+        }
+        return -1;
+    }
+    // Like register_index(), for write_memory().
+    template <ChipId Id>
+    static int memory_index(uint16_t offset) {
+        constexpr size_t I = index_of<Id>();
+        if constexpr (I < BACKEND_COUNT) {
+            using Backend = std::tuple_element_t<I, std::tuple<Backends...>>;
+            if constexpr (Backend::SEGMENTABLE) {
+                int index = Backend::memory_index(offset);
+                return index < 0 ? -1 : static_cast<int>(register_offset<I>()) + index;
+            }
+        }
+        return -1;
+    }
+    template <ChipId Id>
+    static bool starts_history(uint8_t reg, uint8_t value) {
+        constexpr size_t I = index_of<Id>();
+        if constexpr (I < BACKEND_COUNT) {
+            using Backend = std::tuple_element_t<I, std::tuple<Backends...>>;
+            if constexpr (Backend::SEGMENTABLE) return Backend::starts_history(reg, value);
+        }
+        return false;
+    }
+    // Continues a stream at `time` from the register files alone. Only valid for a
+    // segmentable() model where no channel is pending evaluation (right after a
+    // wait), as every channel then sounds exactly what its registers say. The
+    // note-on velocity and CC#11 history that set_window() and unrolled loops
+    // restate is not reconstructed. Neither is the program of the last note, which
+    // the waveform may no longer match: the first note of every channel states its
+    // program, for MidiWriter::append_collected() to drop if it is already in effect.
+    void resume_from_registers(uint64_t time, const std::vector<uint8_t>& registers) {
+        ChipModelState state;
+        state.time = time;
+        state.registers = registers;
+        state.pitch_bend_range = static_cast<uint8_t>(engine.pitch_bend_range());
+        restore_state(state);
+
+        // Evaluate every channel once from silence, without output or counters.
+        ConversionStats* saved_stats = stats;
+        stats = nullptr;
+        engine.set_suppressed(true);
+        for_each_backend([&](const auto& backend, auto index) {
+            using Backend = std::decay_t<decltype(backend)>;
+            if (active & (1u << decltype(index)::value)) {
+                dirty_channels |= MIDI_CHANNEL_MASKS<Backend>[0xFF];
+            }
+        });
+        flush();
+        engine.set_suppressed(false);
+        engine.forget_programs();
+        stats = saved_stats;
+    }
+    // For a model resumed inside a loop that started earlier: the loop end marker is
+    // emitted when the stream reaches `end`.
+    void resume_loop(uint64_t start, uint64_t end) { engine.resume_loop(start, end); }
+
+private:
+    const MidiMappingTables& mapping;
+    ChannelMidiEngine engine;
+    std::tuple<Backends...> backends;
+    uint8_t active;          // Bit n: backend n is in use
+    uint16_t dirty_channels; // Bit n set: MIDI channel n was written at the current time
+    ConversionStats* stats;
+    WaveformCache* wave_cache;
+
+    static_assert(BACKEND_COUNT <= 8, "at most 8 backends");
+
+    template <typename Backend>
+    static constexpr bool claim_channels(uint32_t& used) {
+        bool ok = Backend::CHANNELS <= 8;
+        for (uint8_t channel : Backend::MIDI_CHANNELS) {
+            ok = ok && channel < ChannelMidiEngine::CHANNEL_COUNT && (used & (1u << channel)) == 0;
+            used |= 1u << channel;
+        }
+        return ok;
+    }
+    static constexpr bool channels_disjoint() {
+        uint32_t used = 0;
+        return (claim_channels<Backends>(used) && ...);
+    }
+    static_assert(channels_disjoint(), "backends must play on distinct MIDI channels 0-15");
+
+    template <ChipId Id, size_t I = 0>
+    static constexpr size_t index_of() {
+        if constexpr (I == BACKEND_COUNT) {
+            return I;
+        } else if constexpr (std::tuple_element_t<I, std::tuple<Backends...>>::ID == Id) {
+            return I;
+        } else {
+            return index_of<Id, I + 1>();
+        }
+    }
+
+    template <size_t I>
+    static constexpr size_t register_offset() {
+        constexpr size_t sizes[] = {Backends::REGISTER_BYTES...};
+        size_t offset = 0;
+        for (size_t i = 0; i < I; ++i) offset += sizes[i];
+        return offset;
+    }
+
+    // Calls fn(backend, std::integral_constant<size_t, index>) for every backend in order.
+    template <typename Fn>
+    void for_each_backend(Fn&& fn) {
+        for_each_backend(fn, std::index_sequence_for<Backends...>());
+    }
+    template <typename Fn>
+    void for_each_backend(Fn&& fn) const {
+        for_each_backend(fn, std::index_sequence_for<Backends...>());
+    }
+    template <typename Fn, size_t... I>
+    void for_each_backend(Fn& fn, std::index_sequence<I...>) {
+        (fn(std::get<I>(backends), std::integral_constant<size_t, I>()), ...);
+    }
+    template <typename Fn, size_t... I>
+    void for_each_backend(Fn& fn, std::index_sequence<I...>) const {
+        (fn(std::get<I>(backends), std::integral_constant<size_t, I>()), ...);
+    }
+
+    template <size_t I>
+    void activate() {
+        using Backend = std::tuple_element_t<I, std::tuple<Backends...>>;
+        active |= 1u << I;
+        for (int channel = 0; channel < Backend::CHANNELS; ++channel) {
+            engine.add_channel(Backend::MIDI_CHANNELS[channel], Backend::channel_name(channel),
+                               Backend::default_program(channel));
+        }
+    }
+
+    void activate_defaults() {
+        for_each_backend([&](auto& backend, auto index) {
+            if (std::decay_t<decltype(backend)>::ALWAYS_ACTIVE) activate<decltype(index)::value>();
+        });
+    }
+};
+
+// The model VgmReader drives: every chip the converter knows.
+using VgmChipModel = ChipModel<WonderSwanChip, DmgChip, Sn76489Chip>;
+
+#endif // CHIP_MODEL_H
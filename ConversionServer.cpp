@@ -0,0 +1,429 @@
+#include "ConversionServer.h"
+#include "Converter.h"
+#include "Logger.h"
+#include "ResultCache.h"
+#include "ServerProtocol.h"
+#include "WorkStealingPool.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <csignal>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <cstdio>
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Reads until `size` bytes arrived or the input ended; returns the number read.
+size_t read_fully(int fd, uint8_t* data, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+#ifdef _WIN32
+        int n = _read(fd, data + done, static_cast<unsigned>(std::min<size_t>(size - done, INT_MAX)));
+#else
+        ssize_t n = ::read(fd, data + done, size - done);
+        if (n < 0 && errno == EINTR) continue;
+#endif
+        if (n <= 0) break;
+        done += static_cast<size_t>(n);
+    }
+    return done;
+}
+
+bool write_fully(int fd, const uint8_t* data, size_t size) {
+    while (size > 0) {
+#ifdef _WIN32
+        int n = _write(fd, data, static_cast<unsigned>(std::min<size_t>(size, INT_MAX)));
+#else
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0 && errno == EINTR) continue;
+#endif
+        if (n <= 0) return false;
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// One client: a socket, or stdin/stdout. Responses are written by the workers,
+// one complete frame at a time.
+class Connection {
+public:
+    Connection(int input_fd, int output_fd, bool owns_fds)
+        : input_fd(input_fd), output_fd(output_fd), owns_fds(owns_fds), broken(false) {}
+    ~Connection() {
+#ifndef _WIN32
+        if (owns_fds) {
+            ::close(input_fd);
+            if (output_fd != input_fd) ::close(output_fd);
+        }
+#endif
+    }
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+
+    int input() const { return input_fd; }
+
+    bool send(const ResponseHeader& header, const uint8_t* payload) {
+        uint8_t frame[RESPONSE_HEADER_SIZE];
+        encode_response_header(frame, header);
+        std::lock_guard<std::mutex> lock(write_mutex);
+        if (broken) return false;
+        broken = !write_fully(output_fd, frame, sizeof(frame)) || !write_fully(output_fd, payload, header.size);
+        return !broken;
+    }
+
+    // Makes a blocked read return, so the connection's reader can finish.
+    void shutdown_input() {
+#ifndef _WIN32
+        ::shutdown(input_fd, SHUT_RD);
+#endif
+    }
+
+private:
+    int input_fd;
+    int output_fd;
+    bool owns_fds;
+    std::mutex write_mutex;
+    bool broken; // A write failed (client went away), guarded by write_mutex
+};
+
+// Latencies of the most recent requests, for percentiles.
+class LatencyRecorder {
+public:
+    LatencyRecorder() : samples(WINDOW, 0.0), next(0), count(0) {}
+
+    void record(double milliseconds) {
+        std::lock_guard<std::mutex> lock(mutex);
+        samples[next] = milliseconds;
+        next = (next + 1) % WINDOW;
+        ++count;
+    }
+
+    // p50/p90/p99/max over the window, in milliseconds.
+    void write_json(std::ostream& out) {
+        std::vector<double> sorted;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            sorted.assign(samples.begin(), samples.begin() + static_cast<std::ptrdiff_t>(std::min<uint64_t>(count, WINDOW)));
+        }
+        std::sort(sorted.begin(), sorted.end());
+        auto at = [&](double fraction) {
+            if (sorted.empty()) return 0.0;
+            size_t index = static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5);
+            return sorted[index];
+        };
+        out << "{\"samples\":" << sorted.size() << ",\"p50\":" << at(0.50) << ",\"p90\":" << at(0.90)
+            << ",\"p99\":" << at(0.99) << ",\"max\":" << at(1.0) << '}';
+    }
+
+private:
+    static constexpr size_t WINDOW = 8192;
+    std::mutex mutex;
+    std::vector<double> samples;
+    size_t next;
+    uint64_t count;
+};
+
+// A converter and its output buffer, both reused from request to request.
+struct PooledConverter {
+    VgmConverter converter;
+    std::vector<uint8_t> midi;
+};
+
+class ConverterPool {
+public:
+    explicit ConverterPool(unsigned count) {
+        for (unsigned i = 0; i < count; ++i) {
+            entries.push_back(std::unique_ptr<PooledConverter>(new PooledConverter()));
+            idle.push_back(entries.back().get());
+        }
+    }
+
+    PooledConverter* acquire() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (idle.empty()) {
+            // More concurrent requests than workers (a worker helping out); grow.
+            entries.push_back(std::unique_ptr<PooledConverter>(new PooledConverter()));
+            return entries.back().get();
+        }
+        PooledConverter* converter = idle.back();
+        idle.pop_back();
+        return converter;
+    }
+
+    void release(PooledConverter* converter) {
+        std::lock_guard<std::mutex> lock(mutex);
+        idle.push_back(converter);
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<std::unique_ptr<PooledConverter>> entries;
+    std::vector<PooledConverter*> idle;
+};
+
+class Server {
+public:
+    explicit Server(const ServerOptions& options)
+        : options(options), pool(options.jobs), converters(pool.size()),
+          queued(0), in_flight(0), completed(0), failed(0), rejected(0), connections(0) {}
+
+    unsigned workers() const { return pool.size(); }
+
+    // Reads requests from the connection until it ends or sends a malformed frame.
+    void serve(const std::shared_ptr<Connection>& connection) {
+        ++connections;
+        for (;;) {
+            uint8_t frame[REQUEST_HEADER_SIZE];
+            size_t got = read_fully(connection->input(), frame, sizeof(frame));
+            if (got == 0) break; // Clean end of input
+
+            RequestHeader header;
+            auto received = std::chrono::steady_clock::now();
+            if (got < sizeof(frame) || !decode_request_header(ByteSpan(frame, got), header)) {
+                reject(*connection, header.id, "malformed request header");
+                break;
+            }
+
+            if (header.type == REQUEST_STATUS && header.size == 0) {
+                std::string json = status_json();
+                send_text(*connection, header.id, STATUS_OK, json);
+                continue;
+            }
+            if (header.type != REQUEST_CONVERT) {
+                reject(*connection, header.id, "unknown request type");
+                break;
+            }
+            if (header.size > options.max_request_size) {
+                reject(*connection, header.id, "request exceeds the size limit");
+                break;
+            }
+
+            auto payload = std::make_shared<std::vector<uint8_t>>(header.size);
+            if (read_fully(connection->input(), payload->data(), payload->size()) != payload->size()) {
+                reject(*connection, header.id, "truncated request");
+                break;
+            }
+
+            ++queued;
+            pool.submit([this, connection, header, payload, received] {
+                convert(*connection, header, *payload, received);
+            });
+        }
+        --connections;
+    }
+
+    // Blocks until every accepted request has been answered.
+    void wait() { pool.wait(); }
+
+    std::string status_json() {
+        std::ostringstream out;
+        out << "{\"workers\":" << pool.size() << ",\"connections\":" << connections.load()
+            << ",\"queue_depth\":" << queued.load() << ",\"in_flight\":" << in_flight.load()
+            << ",\"completed\":" << completed.load() << ",\"failed\":" << failed.load()
+            << ",\"rejected\":" << rejected.load() << ",\"latency_ms\":";
+        latency.write_json(out);
+        if (options.cache) {
+            out << ",\"cache\":{\"hits\":" << options.cache->hits() << ",\"misses\":" << options.cache->misses()
+                << ",\"entries\":" << options.cache->entry_count() << ",\"bytes\":" << options.cache->size_bytes() << '}';
+        }
+        out << '}';
+        return out.str();
+    }
+
+private:
+    ServerOptions options;
+    WorkStealingPool pool;
+    ConverterPool converters;
+    std::atomic<uint64_t> queued;    // Accepted, waiting for a worker
+    std::atomic<uint64_t> in_flight; // Being converted
+    std::atomic<uint64_t> completed;
+    std::atomic<uint64_t> failed;
+    std::atomic<uint64_t> rejected;
+    std::atomic<uint64_t> connections;
+    LatencyRecorder latency;
+
+    void send_text(Connection& connection, uint32_t id, uint32_t status, const std::string& text) {
+        ResponseHeader response;
+        response.id = id;
+        response.status = status;
+        response.size = static_cast<uint32_t>(text.size());
+        connection.send(response, reinterpret_cast<const uint8_t*>(text.data()));
+    }
+
+    void reject(Connection& connection, uint32_t id, const char* reason) {
+        ++rejected;
+        VGM_LOG_WARN("rejected request %u: %s", id, reason);
+        send_text(connection, id, STATUS_BAD_REQUEST, reason);
+    }
+
+    void convert(Connection& connection, const RequestHeader& header, const std::vector<uint8_t>& payload,
+                 std::chrono::steady_clock::time_point received) {
+        --queued;
+        ++in_flight;
+
+        ConversionOptions conversion = options.conversion;
+        if (header.flags & FLAG_FORMAT1) conversion.midi.per_channel_tracks = true;
+        if (header.flags & (FLAG_FORMAT1 | FLAG_RUNNING_STATUS)) conversion.midi.running_status = true;
+        if (header.cc11_tolerance != 0) {
+            conversion.midi.expression_thinning.max_value_error = static_cast<int>(std::min<uint32_t>(header.cc11_tolerance, INT_MAX));
+        }
+        if (header.cc11_min_spacing != 0) conversion.midi.expression_thinning.min_spacing = header.cc11_min_spacing;
+        conversion.cache = options.cache;
+
+        PooledConverter* pooled = converters.acquire();
+        ConversionResult result;
+        try {
+            pooled->converter.set_options(conversion);
+            result = pooled->converter.convert(ByteSpan(payload), pooled->midi);
+        } catch (const std::exception& e) {
+            result.success = false;
+            result.error = e.what();
+        }
+
+        // Counters settle before the reply goes out, so a status request sent after
+        // the last response already accounts for it.
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - received;
+        latency.record(elapsed.count());
+        ++(result.success ? completed : failed);
+        --in_flight;
+
+        if (result.success) {
+            ResponseHeader response;
+            response.id = header.id;
+            response.status = STATUS_OK;
+            response.size = static_cast<uint32_t>(pooled->midi.size());
+            connection.send(response, pooled->midi.data());
+        } else {
+            send_text(connection, header.id, STATUS_CONVERSION_FAILED, result.error);
+        }
+        converters.release(pooled);
+    }
+};
+
+int serve_stdin(Server& server) {
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    auto connection = std::make_shared<Connection>(0, 1, false);
+    server.serve(connection);
+    server.wait();
+    return 0;
+}
+
+#ifndef _WIN32
+std::atomic<bool> stop_requested(false);
+
+extern "C" void request_stop(int) {
+    stop_requested.store(true);
+}
+
+struct ReaderThread {
+    std::thread thread;
+    std::weak_ptr<Connection> connection;
+    std::shared_ptr<std::atomic<bool>> done;
+};
+
+int serve_socket(Server& server, const std::string& path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path too long: " << path << std::endl;
+        return 1;
+    }
+    path.copy(address.sun_path, path.size());
+
+    // Replace a stale socket left by a previous run, but never any other file.
+    struct stat info;
+    if (::lstat(path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) ::unlink(path.c_str());
+
+    int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        ::listen(listener, SOMAXCONN) != 0) {
+        std::cerr << "Cannot listen on " << path << ": " << std::strerror(errno) << std::endl;
+        if (listener >= 0) ::close(listener);
+        return 1;
+    }
+    std::signal(SIGINT, request_stop);
+    std::signal(SIGTERM, request_stop);
+    std::cerr << "Listening on " << path << " with " << server.workers() << " worker(s)." << std::endl;
+
+    std::vector<ReaderThread> readers;
+    while (!stop_requested.load()) {
+        pollfd ready = {listener, POLLIN, 0};
+        if (::poll(&ready, 1, 200) <= 0) continue;
+        int fd = ::accept(listener, nullptr, nullptr);
+        if (fd < 0) continue;
+
+        // Join the readers of connections that have ended.
+        readers.erase(std::remove_if(readers.begin(), readers.end(), [](ReaderThread& reader) {
+            if (!reader.done->load()) return false;
+            reader.thread.join();
+            return true;
+        }), readers.end());
+
+        VGM_LOG_INFO("connection accepted (fd %d)", fd);
+        auto connection = std::make_shared<Connection>(fd, fd, true);
+        auto done = std::make_shared<std::atomic<bool>>(false);
+        std::thread thread([&server, connection, done] {
+            server.serve(connection);
+            done->store(true);
+        });
+        readers.push_back({std::move(thread), connection, done});
+    }
+
+    ::close(listener);
+    ::unlink(path.c_str());
+    for (auto& reader : readers) {
+        if (auto connection = reader.connection.lock()) connection->shutdown_input();
+    }
+    for (auto& reader : readers) reader.thread.join();
+    server.wait();
+    return 0;
+}
+#endif
+
+} // namespace
+
+int run_server(const ServerOptions& options) {
+#ifndef _WIN32
+    // A client that disconnects early must not kill the server.
+    std::signal(SIGPIPE, SIG_IGN);
+#endif
+    Server server(options);
+
+    int status;
+    if (options.socket_path.empty()) {
+        status = serve_stdin(server);
+    } else {
+#ifdef _WIN32
+        std::cerr << "Unix domain sockets are not supported on this platform; use stdin framing." << std::endl;
+        status = 1;
+#else
+        status = serve_socket(server, options.socket_path);
+#endif
+    }
+
+    std::cerr << "Server status: " << server.status_json() << std::endl;
+    return status;
+}
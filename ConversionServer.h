@@ -0,0 +1,25 @@
+#ifndef CONVERSION_SERVER_H
+#define CONVERSION_SERVER_H
+
+#include <cstdint>
+#include <string>
+#include "Converter.h"
+
+struct ServerOptions {
+    std::string socket_path;         // Unix domain socket to listen on; empty = stdin/stdout
+    unsigned jobs = 0;               // Worker threads (and warm converters), 0 = hardware concurrency
+    uint64_t max_request_size = 256u * 1024 * 1024; // Larger payloads are rejected
+    ResultCache* cache = nullptr;    // Optional result cache shared by all workers
+    // What every request starts from. The request header can only turn on format 1 or
+    // running status and replace the CC#11 thinning parameters (when non-zero); all
+    // other options hold for every request the server answers.
+    ConversionOptions conversion;
+};
+
+// Serves conversion requests framed as described in ServerProtocol.h until stdin
+// reaches end of file or, in socket mode, until SIGINT/SIGTERM. Requests run on a
+// work-stealing pool; each worker borrows a converter from a pool of instances that
+// are kept warm between requests. Returns the process exit code.
+int run_server(const ServerOptions& options);
+
+#endif // CONVERSION_SERVER_H
@@ -0,0 +1,155 @@
+#include "ConversionStats.h"
+#include <cstdio>
+
+namespace {
+
+// {"0xbc":12,...} for the non-zero entries of a per-opcode or per-port table.
+void write_hex_table(std::ostream& out, const std::array<uint64_t, 256>& table) {
+    out << '{';
+    bool first = true;
+    for (size_t i = 0; i < table.size(); ++i) {
+        if (table[i] == 0) continue;
+        char key[8];
+        std::snprintf(key, sizeof(key), "0x%02x", static_cast<unsigned>(i));
+        out << (first ? "" : ",") << '"' << key << "\":" << table[i];
+        first = false;
+    }
+    out << '}';
+}
+
+uint64_t total(const std::array<uint64_t, 256>& table) {
+    uint64_t sum = 0;
+    for (uint64_t count : table) sum += count;
+    return sum;
+}
+
+double milliseconds(uint64_t ns) {
+    return ns / 1e6;
+}
+
+} // namespace
+
+void ConversionStats::merge(const ConversionStats& other) {
+    conversions += other.conversions;
+    input_bytes += other.input_bytes;
+    vgm_bytes += other.vgm_bytes;
+    for (size_t i = 0; i < commands.size(); ++i) commands[i] += other.commands[i];
+    skipped_bytes += other.skipped_bytes;
+    data_block_bytes += other.data_block_bytes;
+
+    for (size_t i = 0; i < chip_writes.size(); ++i) chip_writes[i] += other.chip_writes[i];
+    for (size_t i = 0; i < port_writes.size(); ++i) port_writes[i] += other.port_writes[i];
+    writes_coalesced += other.writes_coalesced;
+    channel_evaluations += other.channel_evaluations;
+
+    for (size_t i = 0; i < channel_events.size(); ++i) {
+        channel_events[i].note_on += other.channel_events[i].note_on;
+        channel_events[i].note_off += other.channel_events[i].note_off;
+        channel_events[i].control_change += other.channel_events[i].control_change;
+        channel_events[i].program_change += other.channel_events[i].program_change;
+        channel_events[i].pitch_bend += other.channel_events[i].pitch_bend;
+    }
+    events_dropped += other.events_dropped;
+    events_clamped += other.events_clamped;
+    midi_bytes += other.midi_bytes;
+
+    cache_hits += other.cache_hits;
+    cache_misses += other.cache_misses;
+
+    load_ns += other.load_ns;
+    parse_ns += other.parse_ns;
+    encode_ns += other.encode_ns;
+    write_ns += other.write_ns;
+}
+
+void ConversionStats::write_json(std::ostream& out) const {
+    ChannelEventCounts events;
+    for (const auto& channel : channel_events) {
+        events.note_on += channel.note_on;
+        events.note_off += channel.note_off;
+        events.control_change += channel.control_change;
+        events.program_change += channel.program_change;
+        events.pitch_bend += channel.pitch_bend;
+    }
+
+    out << "{\"enabled\":" << (VGM_WS_STATS ? "true" : "false")
+        << ",\"conversions\":" << conversions;
+
+    out << ",\"timing_ms\":{\"load\":" << milliseconds(load_ns)
+        << ",\"parse\":" << milliseconds(parse_ns)
+        << ",\"encode\":" << milliseconds(encode_ns)
+        << ",\"write\":" << milliseconds(write_ns)
+        << ",\"total\":" << milliseconds(load_ns + parse_ns + encode_ns + write_ns) << '}';
+
+    out << ",\"vgm\":{\"input_bytes\":" << input_bytes
+        << ",\"stream_bytes\":" << vgm_bytes
+        << ",\"commands\":" << total(commands)
+        << ",\"skipped_bytes\":" << skipped_bytes
+        << ",\"data_block_bytes\":" << data_block_bytes
+        << ",\"commands_by_opcode\":";
+    write_hex_table(out, commands);
+    out << '}';
+
+    uint64_t register_writes = 0;
+    for (uint64_t count : chip_writes) register_writes += count;
+    out << ",\"chip\":{\"register_writes\":" << register_writes
+        << ",\"writes_coalesced\":" << writes_coalesced
+        << ",\"channel_evaluations\":" << channel_evaluations
+        << ",\"writes_by_chip\":{";
+    for (size_t i = 0; i < chip_writes.size(); ++i) {
+        out << (i ? "," : "") << '"' << chip_name(static_cast<ChipId>(i)) << "\":" << chip_writes[i];
+    }
+    out << "},\"writes_by_port\":";
+    write_hex_table(out, port_writes);
+    out << '}';
+
+    out << ",\"midi\":{\"bytes\":" << midi_bytes
+        << ",\"note_on\":" << events.note_on
+        << ",\"note_off\":" << events.note_off
+        << ",\"control_change\":" << events.control_change
+        << ",\"program_change\":" << events.program_change
+        << ",\"pitch_bend\":" << events.pitch_bend
+        << ",\"events_dropped\":" << events_dropped
+        << ",\"events_clamped\":" << events_clamped
+        << ",\"channels\":[";
+    bool first = true;
+    for (size_t i = 0; i < channel_events.size(); ++i) {
+        const ChannelEventCounts& c = channel_events[i];
+        if (c.note_on + c.note_off + c.control_change + c.program_change + c.pitch_bend == 0) continue;
+        out << (first ? "" : ",") << "{\"channel\":" << i
+            << ",\"note_on\":" << c.note_on
+            << ",\"note_off\":" << c.note_off
+            << ",\"control_change\":" << c.control_change
+            << ",\"program_change\":" << c.program_change
+            << ",\"pitch_bend\":" << c.pitch_bend << '}';
+        first = false;
+    }
+    out << "]}";
+
+    uint64_t lookups = cache_hits + cache_misses;
+    out << ",\"cache\":{\"hits\":" << cache_hits
+        << ",\"misses\":" << cache_misses
+        << ",\"hit_rate\":" << (lookups ? static_cast<double>(cache_hits) / lookups : 0.0) << "}}";
+}
+
+void write_json_string(std::ostream& out, const std::string& text) {
+    out << '"';
+    for (unsigned char c : text) {
+        switch (c) {
+            case '"': out << "\\\""; break;
+            case '\\': out << "\\\\"; break;
+            case '\n': out << "\\n"; break;
+            case '\r': out << "\\r"; break;
+            case '\t': out << "\\t"; break;
+            default:
+                if (c < 0x20) {
+                    char escaped[8];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    out << escaped;
+                } else {
+                    out << c;
+                }
+        }
+    }
+    out << '"';
+}
@@ -0,0 +1,99 @@
+#ifndef CONVERSION_STATS_H
+#define CONVERSION_STATS_H
+
+#include "ChipBackend.h"
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Counters and stage timers of one conversion (or the sum of several, see merge()).
+// VgmReader, the chip model and MidiWriter update them through VGM_STATS() when a
+// ConversionStats is attached with set_stats(); building with -DVGM_WS_STATS=0
+// removes every counter and timer from the hot paths.
+#ifndef VGM_WS_STATS
+#define VGM_WS_STATS 1
+#endif
+
+#if VGM_WS_STATS
+// Runs `statement` if the enclosing object has a ConversionStats attached (`stats`).
+#define VGM_STATS(statement) do { if (stats) { statement; } } while (0)
+#else
+#define VGM_STATS(statement) do { } while (0)
+#endif
+
+struct ChannelEventCounts {
+    uint64_t note_on = 0;
+    uint64_t note_off = 0;
+    uint64_t control_change = 0;
+    uint64_t program_change = 0;
+    uint64_t pitch_bend = 0;
+};
+
+struct ConversionStats {
+    uint64_t conversions = 0;        // Number of conversions summed up in here
+
+    // VgmReader
+    uint64_t input_bytes = 0;        // File size as read (compressed for .vgz)
+    uint64_t vgm_bytes = 0;          // Uncompressed VGM stream size
+    std::array<uint64_t, 256> commands{}; // Commands dispatched, per opcode
+    uint64_t skipped_bytes = 0;      // Commands for chips the converter does not model
+    uint64_t data_block_bytes = 0;   // Data block payloads
+
+    // ChipModel and its backends
+    std::array<uint64_t, VGM_CHIP_COUNT> chip_writes{}; // Register writes, per ChipId
+    std::array<uint64_t, 256> port_writes{}; // WonderSwan register writes, per I/O address
+    uint64_t writes_coalesced = 0;   // Writes to a channel already pending evaluation
+    uint64_t channel_evaluations = 0;
+
+    // MidiWriter
+    std::array<ChannelEventCounts, 16> channel_events{}; // Events written, per MIDI channel
+    uint64_t events_dropped = 0;     // Removed by expression thinning
+    uint64_t events_clamped = 0;     // Arrived late and joined the current tick
+    uint64_t midi_bytes = 0;
+
+    // ResultCache (only counted when a cache is attached)
+    uint64_t cache_hits = 0;         // Served without parsing the input
+    uint64_t cache_misses = 0;
+
+    // Monotonic wall-clock time per stage, in nanoseconds. Parsing includes the chip
+    // model and the streaming MIDI encoder, which run as commands are dispatched.
+    uint64_t load_ns = 0;            // Mapping or reading the input file
+    uint64_t parse_ns = 0;
+    uint64_t encode_ns = 0;          // MidiWriter::finish(): last tick, post-passes, back-patching
+    uint64_t write_ns = 0;
+
+    void merge(const ConversionStats& other);
+    void write_json(std::ostream& out) const;
+};
+
+// Adds the lifetime of the timer to *target, if target is not null.
+class StatsTimer {
+public:
+#if VGM_WS_STATS
+    explicit StatsTimer(uint64_t* target)
+        : target(target), start(target ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point()) {}
+    ~StatsTimer() {
+        if (target) {
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            *target += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+        }
+    }
+#else
+    explicit StatsTimer(uint64_t*) {}
+#endif
+    StatsTimer(const StatsTimer&) = delete;
+    StatsTimer& operator=(const StatsTimer&) = delete;
+
+#if VGM_WS_STATS
+private:
+    uint64_t* target;
+    std::chrono::steady_clock::time_point start;
+#endif
+};
+
+// Writes `text` as a quoted JSON string.
+void write_json_string(std::ostream& out, const std::string& text);
+
+#endif // CONVERSION_STATS_H
@@ -0,0 +1,223 @@
+#include "Converter.h"
+#include "Logger.h"
+#include "MappedFile.h"
+#include "ResultCache.h"
+#include "SeekIndex.h"
+#include "WonderSwanRenderer.h"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+bool read_file(const std::string& filename, std::vector<uint8_t>& data) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) return false;
+    data.clear();
+    const size_t chunk_size = 64 * 1024;
+    while (file) {
+        size_t old_size = data.size();
+        data.resize(old_size + chunk_size);
+        file.read(reinterpret_cast<char*>(data.data() + old_size), chunk_size);
+        data.resize(old_size + static_cast<size_t>(file.gcount()));
+    }
+    return file.eof();
+}
+
+bool write_file(const std::string& filename, const std::vector<uint8_t>& data) {
+    if (filename == "-") {
+        std::cout.write(reinterpret_cast<const char*>(data.data()), data.size());
+        std::cout.flush();
+        return std::cout.good();
+    }
+    std::ofstream file(filename, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    return file.good();
+}
+
+} // namespace
+
+VgmConverter::VgmConverter(const ConversionOptions& options)
+    : current_options(options),
+      midi_writer(options.midi),
+      chip(midi_writer),
+      reader(chip),
+      fresh(true) {}
+
+void VgmConverter::set_options(const ConversionOptions& options) {
+    current_options = options;
+    fresh = false; // The writer picks up the new options when it is reset
+}
+
+ConversionStats* VgmConverter::begin(ConversionResult& result) {
+    if (!fresh) {
+        midi_writer.reset(current_options.midi);
+        chip.reset();
+    }
+    fresh = false;
+    chip.set_loop_options(current_options.loop);
+    chip.set_pitch_bend_range(static_cast<int>(current_options.pitch_bend_range));
+    chip.set_waveform_cache(current_options.waveform_cache ? current_options.waveform_cache : &wave_cache);
+    reader.set_pipelined(current_options.pipelined);
+    reader.set_parse_threads(current_options.parse_threads);
+
+    ConversionStats* stats = current_options.collect_stats ? &result.stats : nullptr;
+    if (stats) stats->conversions = 1;
+    midi_writer.set_stats(stats);
+    chip.set_stats(stats);
+    reader.set_stats(stats);
+    return stats;
+}
+
+void VgmConverter::end() {
+    // The counters belong to the caller's result; nothing may write to them later.
+    midi_writer.set_stats(nullptr);
+    chip.set_stats(nullptr);
+    reader.set_stats(nullptr);
+}
+
+ConversionResult VgmConverter::convert(ByteSpan vgm, std::vector<uint8_t>& midi) {
+    ConversionResult result;
+    ConversionStats* stats = begin(result);
+    VGM_LOG_INFO("converting %zu-byte image", vgm.size());
+
+    ResultCache* cache = current_options.cache;
+    CacheKey key;
+    if (cache) {
+        StatsTimer timer(stats ? &stats->load_ns : nullptr);
+        key = ResultCache::make_key(vgm, current_options);
+        if (cache->lookup(key, midi, result.expression_events_removed)) {
+            VGM_STATS(++stats->cache_hits; stats->input_bytes += vgm.size(); stats->midi_bytes += midi.size());
+            result.success = true;
+            result.cached = true;
+            end();
+            return result;
+        }
+        VGM_STATS(++stats->cache_misses);
+    }
+
+    if (current_options.pipelined && !current_options.windowed()) midi_writer.start_encoder_thread();
+    bool parsed = current_options.windowed()
+        ? reader.parse_window(vgm, current_options.seek_index, current_options.window)
+        : reader.parse(vgm);
+    if (!parsed) {
+        result.error = "failed to parse VGM data";
+        VGM_LOG_ERROR("%s", result.error.c_str());
+    } else {
+        StatsTimer timer(stats ? &stats->encode_ns : nullptr);
+        midi_writer.take_image(midi);
+        result.expression_events_removed = midi_writer.expression_events_removed();
+        result.success = true;
+    }
+    if (cache && result.success) {
+        StatsTimer timer(stats ? &stats->write_ns : nullptr);
+        cache->store(key, midi, result.expression_events_removed);
+    }
+
+    end();
+    return result;
+}
+
+ConversionResult VgmConverter::convert_file(const std::string& input_filename, const std::string& output_filename) {
+    if (current_options.cache || current_options.windowed()) {
+        return convert_file_in_memory(input_filename, output_filename);
+    }
+
+    ConversionResult result;
+    ConversionStats* stats = begin(result);
+    VGM_LOG_INFO("converting %s -> %s", input_filename.c_str(), output_filename.c_str());
+
+    if (current_options.pipelined) midi_writer.start_encoder_thread();
+    if (!reader.load_and_parse(input_filename)) {
+        result.error = "failed to load or parse VGM file";
+        VGM_LOG_ERROR("%s: %s", input_filename.c_str(), result.error.c_str());
+        end();
+        return result;
+    }
+
+    {
+        StatsTimer timer(stats ? &stats->encode_ns : nullptr);
+        midi_writer.finish();
+    }
+    {
+        StatsTimer timer(stats ? &stats->write_ns : nullptr);
+        if (!midi_writer.write_to_file(output_filename)) {
+            result.error = "failed to write MIDI file";
+            VGM_LOG_ERROR("%s: %s", output_filename.c_str(), result.error.c_str());
+            end();
+            return result;
+        }
+    }
+    result.expression_events_removed = midi_writer.expression_events_removed();
+
+    VGM_LOG_INFO("%s: done", input_filename.c_str());
+    result.success = true;
+    end();
+    return result;
+}
+
+// The cache key and the seek index need every input byte up front, so the file is
+// loaded (mapped when possible) and converted in memory instead of streamed through
+// load_and_parse().
+ConversionResult VgmConverter::convert_file_in_memory(const std::string& input_filename, const std::string& output_filename) {
+    auto load_start = std::chrono::steady_clock::now();
+    MappedFile mapped;
+    if (!mapped.open(input_filename) && !read_file(input_filename, input_buffer)) {
+        ConversionResult result;
+        result.error = "failed to load or parse VGM file";
+        VGM_LOG_ERROR("%s: %s", input_filename.c_str(), result.error.c_str());
+        return result;
+    }
+    auto load_time = std::chrono::steady_clock::now() - load_start;
+
+    VGM_LOG_INFO("converting %s -> %s", input_filename.c_str(), output_filename.c_str());
+    ConversionResult result = convert(mapped.is_open() ? mapped.span() : ByteSpan(input_buffer), output_buffer);
+    input_buffer.clear();
+    if (current_options.collect_stats) {
+        result.stats.load_ns += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(load_time).count());
+    }
+    if (!result.success) {
+        VGM_LOG_ERROR("%s: %s", input_filename.c_str(), result.error.c_str());
+        return result;
+    }
+
+    bool written;
+    {
+        StatsTimer timer(current_options.collect_stats ? &result.stats.write_ns : nullptr);
+        written = write_file(output_filename, output_buffer);
+    }
+    if (!written) {
+        result.success = false;
+        result.error = "failed to write MIDI file";
+        VGM_LOG_ERROR("%s: %s", output_filename.c_str(), result.error.c_str());
+    } else {
+        VGM_LOG_INFO("%s: done%s", input_filename.c_str(), result.cached ? " (cached)" : "");
+    }
+    return result;
+}
+
+bool VgmConverter::build_index(ByteSpan vgm, uint32_t interval, SeekIndex& index) {
+    ConversionResult result;
+    begin(result);
+    bool ok = reader.build_index(vgm, interval, index);
+    end();
+    return ok;
+}
+
+bool VgmConverter::render(ByteSpan vgm, WonderSwanRenderer& renderer) {
+    renderer.reset();
+    return reader.parse_into(vgm, renderer);
+}
+
+std::vector<uint8_t> convert(ByteSpan vgm, const ConversionOptions& options) {
+    VgmConverter converter(options);
+    std::vector<uint8_t> midi;
+    if (!converter.convert(vgm, midi).success) midi.clear();
+    return midi;
+}
+
+ConversionResult convert_file(const std::string& input_filename, const std::string& output_filename,
+                              const ConversionOptions& options) {
+    VgmConverter converter(options);
+    return converter.convert_file(input_filename, output_filename);
+}
@@ -0,0 +1,105 @@
+#ifndef CONVERTER_H
+#define CONVERTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "ByteSpan.h"
+#include "MidiWriter.h"
+#include "ChipModel.h"
+#include "VgmReader.h"
+#include "ConversionStats.h"
+#include "WaveformCache.h"
+
+class ResultCache;
+struct SeekIndex;
+class WonderSwanRenderer;
+
+// Bump whenever a change alters the MIDI produced for an unchanged input and option
+// set; results cached by other versions are then ignored.
+const uint32_t CONVERTER_OUTPUT_VERSION = 7;
+
+struct ConversionOptions {
+    MidiWriterOptions midi;
+    bool collect_stats = false; // Fill ConversionResult::stats
+    ResultCache* cache = nullptr; // Optional result cache, may be shared between threads
+    // Optional waveform -> program memo of the wavetable channels, may be shared
+    // between threads; each converter keeps its own otherwise. Does not change the output.
+    WaveformCache* waveform_cache = nullptr;
+    // See ChipModel::set_window().
+    OutputWindow window;
+    const SeekIndex* seek_index = nullptr; // Optional, lets windowed conversions skip ahead
+    LoopOptions loop; // Ignored by windowed conversions
+    // Glide mode: pitch changes of a sounding channel bend the held note within this
+    // many semitones (announced through RPN 0) instead of retriggering it; 0 = off.
+    unsigned pitch_bend_range = 0;
+    // Decode commands, run the chip model and encode MIDI on three threads connected
+    // by lock-free queues. Same output as the serial path; pays off on long streams.
+    bool pipelined = false;
+    // Parse one stream on this many threads (segmented, same output); 1 = sequential.
+    unsigned parse_threads = 1;
+
+    bool windowed() const { return !window.whole_stream(); }
+};
+
+struct ConversionResult {
+    bool success = false;
+    bool cached = false; // Served from the result cache without parsing the input
+    std::string error;
+    size_t expression_events_removed = 0;
+    ConversionStats stats;
+};
+
+// A reusable MidiWriter/VgmChipModel/VgmReader set for embedding the converter.
+// Every buffer (event lists, track data, register file, inflate window) survives
+// between conversions, so a warm converter does no heap allocation in the steady
+// state. Not thread-safe: use one instance per thread.
+class VgmConverter {
+public:
+    explicit VgmConverter(const ConversionOptions& options = ConversionOptions());
+    VgmConverter(const VgmConverter&) = delete;
+    VgmConverter& operator=(const VgmConverter&) = delete;
+
+    // Takes effect with the next conversion.
+    void set_options(const ConversionOptions& options);
+    const ConversionOptions& options() const { return current_options; }
+
+    // Converts a VGM or VGZ image held in memory. On success `midi` receives the SMF
+    // image and its previous buffer is kept for the next conversion, so passing the
+    // same vector every time recycles both allocations.
+    ConversionResult convert(ByteSpan vgm, std::vector<uint8_t>& midi);
+    ConversionResult convert_file(const std::string& input_filename, const std::string& output_filename);
+
+    // Builds a seek index with a checkpoint every `interval` samples (one full pass
+    // over the stream, no MIDI output).
+    bool build_index(ByteSpan vgm, uint32_t interval, SeekIndex& index);
+
+    // Renders the WonderSwan channels of a VGM or VGZ image to PCM (the reference
+    // the MIDI output can be checked against); no MIDI is produced.
+    bool render(ByteSpan vgm, WonderSwanRenderer& renderer);
+
+private:
+    ConversionOptions current_options;
+    MidiWriter midi_writer;
+    VgmChipModel chip;
+    VgmReader reader;
+    bool fresh; // Nothing converted since construction or the last reset
+    WaveformCache wave_cache; // Unless the options name a shared one
+    std::vector<uint8_t> input_buffer;  // Inputs that cannot be mapped, see convert_file_in_memory()
+    std::vector<uint8_t> output_buffer; // MIDI image of convert_file_in_memory()
+
+    ConversionStats* begin(ConversionResult& result);
+    void end();
+    ConversionResult convert_file_in_memory(const std::string& input_filename, const std::string& output_filename);
+};
+
+// One-shot conversion of an in-memory VGM/VGZ image; returns an empty vector on failure.
+std::vector<uint8_t> convert(ByteSpan vgm, const ConversionOptions& options = ConversionOptions());
+
+// Runs one complete conversion with its own MidiWriter/VgmChipModel/VgmReader set,
+// so independent conversions can run concurrently on different threads.
+ConversionResult convert_file(const std::string& input_filename, const std::string& output_filename,
+                              const ConversionOptions& options = ConversionOptions());
+
+#endif // CONVERTER_H
@@ -0,0 +1,165 @@
+#include "DmgChip.h"
+#include <algorithm>
+
+namespace {
+
+// Register offsets from 0xFF10.
+const uint8_t NR12 = 0x02, NR13 = 0x03, NR14 = 0x04;
+const uint8_t NR22 = 0x07, NR23 = 0x08, NR24 = 0x09;
+const uint8_t NR30 = 0x0A, NR32 = 0x0C, NR33 = 0x0D, NR34 = 0x0E;
+const uint8_t NR42 = 0x11, NR43 = 0x12, NR44 = 0x13;
+const uint8_t NR50 = 0x14, NR51 = 0x15, NR52 = 0x16;
+
+struct DmgPitchTables {
+    std::array<PitchEntry, 2048> pulse; // Indexed by the 11-bit frequency value
+    std::array<PitchEntry, 2048> wave;
+    std::array<PitchEntry, 128> noise;  // Indexed by shift << 3 | divisor code of NR43
+};
+
+constexpr DmgPitchTables make_dmg_pitch_tables() {
+    DmgPitchTables tables{};
+    for (int x = 0; x < 2048; ++x) {
+        // 4.194304 MHz / 32 per pulse duty cycle step; the wave channel is one octave lower.
+        tables.pulse[x] = pitch_entry_for(131072.0 / (2048 - x), 0);
+        tables.wave[x] = pitch_entry_for(65536.0 / (2048 - x), 0);
+    }
+    for (int code = 0; code < 128; ++code) {
+        int shift = code >> 3;
+        int divisor = code & 7;
+        double freq = 524288.0 / (divisor == 0 ? 0.5 : divisor) / (2 << shift);
+        // Noise has no pitch as such; the clock rate is moved ten octaves down so that
+        // the usual settings land in the melodic range, brighter noise higher.
+        PitchEntry entry = pitch_entry_for(freq / 1024.0, 0);
+        entry.note = static_cast<int16_t>(std::min(std::max<int>(entry.note, 1), 127));
+        tables.noise[code] = entry;
+    }
+    return tables;
+}
+
+constexpr DmgPitchTables DMG_PITCH = make_dmg_pitch_tables();
+
+// Channel of each register below 0x20 (bit mask), for the evaluation requests.
+constexpr uint8_t channel_of_register(int reg) {
+    return reg <= NR14 ? 0x01 : reg <= NR24 ? (reg >= 0x06 ? 0x02 : 0)
+         : reg <= NR34 ? 0x04 : reg <= NR44 ? (reg >= 0x10 ? 0x08 : 0)
+         : (reg == NR51 || reg == NR52) ? 0x0F : 0;
+}
+
+} // namespace
+
+DmgChip::DmgChip(const MidiMappingTables& mapping) : mapping(mapping), wave_cache(nullptr) {
+    reset();
+}
+
+void DmgChip::reset() {
+    registers.fill(0);
+    // As the boot ROM leaves them: powered, full master volume, every channel panned.
+    registers[NR50] = 0x77;
+    registers[NR51] = 0xF3;
+    registers[NR52] = 0x80;
+    running = 0;
+    triggered = 0;
+    waveform = Waveform{};
+    program = classify_waveform(waveform);
+    wave_changed = true;
+}
+
+void DmgChip::save_registers(uint8_t* out) const {
+    std::copy(registers.begin(), registers.end(), out);
+    out[0x30] = running;
+    out[0x31] = triggered;
+}
+
+void DmgChip::load_registers(const uint8_t* in) {
+    std::copy(in, in + registers.size(), registers.begin());
+    running = in[0x30];
+    triggered = in[0x31];
+    wave_changed = true;
+}
+
+const char* DmgChip::channel_name(int channel) {
+    static const char* const names[CHANNELS] = {"Game Boy Pulse 1", "Game Boy Pulse 2", "Game Boy Wave", "Game Boy Noise"};
+    return names[channel];
+}
+
+uint8_t DmgChip::write_port(uint8_t reg, uint8_t value) {
+    if (reg >= registers.size()) return 0; // Second chip (bit 7) or outside the APU
+    uint8_t previous = registers[reg];
+    registers[reg] = value;
+    if (reg >= 0x20) {                     // Wave RAM
+        if (value == previous) return 0;
+        wave_changed = true;
+        return 0x04;
+    }
+
+    switch (reg) {
+        case NR14: case NR24: case NR34: case NR44:
+            if (value & 0x80) {
+                uint8_t channel = channel_of_register(reg);
+                running |= channel;
+                triggered |= channel;
+            }
+            break;
+        case NR52:
+            if ((value & 0x80) == 0) running = 0;
+            break;
+    }
+    // Switching a DAC off stops its channel, and a trigger with the DAC off does not
+    // start it.
+    if ((registers[NR12] & 0xF8) == 0) running &= ~0x01;
+    if ((registers[NR22] & 0xF8) == 0) running &= ~0x02;
+    if ((registers[NR30] & 0x80) == 0) running &= ~0x04;
+    if ((registers[NR42] & 0xF8) == 0) running &= ~0x08;
+    return channel_of_register(reg);
+}
+
+ChannelOutput DmgChip::evaluate(int channel) {
+    static const uint8_t WAVE_VOLUME[4] = {0, 15, 8, 4}; // NR32 output level: mute, 100%, 50%, 25%
+    ChannelOutput output;
+    int volume = 0;
+    PitchEntry pitch{};
+    switch (channel) {
+        case 0:
+            volume = registers[NR12] >> 4;
+            pitch = DMG_PITCH.pulse[((registers[NR14] & 0x07) << 8) | registers[NR13]];
+            break;
+        case 1:
+            volume = registers[NR22] >> 4;
+            pitch = DMG_PITCH.pulse[((registers[NR24] & 0x07) << 8) | registers[NR23]];
+            break;
+        case 2:
+            volume = WAVE_VOLUME[(registers[NR32] >> 5) & 0x03];
+            pitch = DMG_PITCH.wave[((registers[NR34] & 0x07) << 8) | registers[NR33]];
+            break;
+        case 3:
+            volume = registers[NR42] >> 4;
+            pitch = DMG_PITCH.noise[((registers[NR43] >> 4) << 3) | (registers[NR43] & 0x07)];
+            break;
+    }
+    bool panned = (registers[NR51] & (0x11 << channel)) != 0;
+    bool powered = (registers[NR52] & 0x80) != 0;
+    output.on = powered && panned && (running & (1 << channel)) && volume > 0;
+    output.note = pitch.note + (channel == 3 ? 0 : mapping.transpose);
+    output.cents = pitch.cents;
+    output.velocity = mapping.velocity[volume];
+    output.retrigger = (triggered & (1 << channel)) != 0;
+    triggered &= ~(1 << channel);
+    if (channel == 2) output.program = wave_program();
+    return output;
+}
+
+uint8_t DmgChip::wave_program() {
+    if (!wave_changed) return program;
+    wave_changed = false;
+    // Wave RAM plays the high nibble of each byte first.
+    Waveform wave;
+    for (size_t i = 0; i < wave.size(); ++i) {
+        uint8_t byte = registers[0x20 + i];
+        wave[i] = static_cast<uint8_t>((byte >> 4) | (byte << 4));
+    }
+    if (wave != waveform) {
+        waveform = wave;
+        program = wave_cache ? wave_cache->program_for(wave) : classify_waveform(wave);
+    }
+    return program;
+}
@@ -0,0 +1,59 @@
+#ifndef DMG_CHIP_H
+#define DMG_CHIP_H
+
+#include "ChipBackend.h"
+#include "MidiMapping.h"
+#include "ConversionStats.h"
+#include "WaveformCache.h"
+#include <array>
+#include <cstdint>
+
+// Game Boy DMG APU backend (see ChipBackend.h), driven by 0xB3 writes to the
+// registers 0xFF10-0xFF3F (aa = address - 0xFF10). Pulse 1, pulse 2, wave and noise
+// play on MIDI channels 5-8. A channel sounds from its trigger until its DAC or the
+// APU is switched off; the hardware envelope, sweep and length counter are not run,
+// so a note keeps the velocity of its initial envelope volume. The wave channel's
+// instrument follows the waveform in wave RAM (0xFF30-0xFF3F), see WaveformCache.h.
+class DmgChip {
+public:
+    static constexpr ChipId ID = ChipId::Dmg;
+    static constexpr int CHANNELS = 4;
+    static constexpr std::array<uint8_t, CHANNELS> MIDI_CHANNELS = {4, 5, 6, 7};
+    // 0x00-0x2F: the registers; 0x30: channels running, 0x31: triggered since the
+    // last evaluation.
+    static constexpr size_t REGISTER_BYTES = 0x32;
+    static constexpr bool ALWAYS_ACTIVE = false;
+    // A channel runs because of a past trigger, not because of its register values.
+    static constexpr bool SEGMENTABLE = false;
+    static constexpr bool TIMED = false; // Envelopes, sweep and length counters are not run
+
+    explicit DmgChip(const MidiMappingTables& mapping = DEFAULT_MIDI_MAPPING);
+    void reset();
+    void set_clock(uint32_t) {} // Every DMG runs at 4.194304 MHz
+    void set_stats(ConversionStats*) {} // No per-register counters
+    void set_waveform_cache(WaveformCache* cache) { wave_cache = cache; }
+
+    uint8_t write_port(uint8_t reg, uint8_t value);
+    ChannelOutput evaluate(int channel);
+
+    void save_registers(uint8_t* out) const;
+    void load_registers(const uint8_t* in);
+
+    static const char* channel_name(int channel);
+    static uint8_t default_program(int channel) { return channel == 3 ? 122 : 80; } // Seashore for noise, else Square Wave
+
+private:
+    const MidiMappingTables& mapping;
+    std::array<uint8_t, 0x30> registers;
+    uint8_t running;   // Bit n: channel n was triggered and not switched off since
+    uint8_t triggered; // Bit n: channel n was triggered since it was last evaluated
+    // The wave channel's waveform last classified and its program.
+    Waveform waveform;
+    uint8_t program;
+    bool wave_changed; // Wave RAM may differ from `waveform`
+    WaveformCache* wave_cache;
+
+    uint8_t wave_program();
+};
+
+#endif // DMG_CHIP_H
@@ -0,0 +1,133 @@
+#include "ExpressionThinner.h"
+#include <algorithm>
+#include <cstdlib>
+
+namespace {
+
+const size_t NONE = static_cast<size_t>(-1);
+const uint8_t REMOVED = 0x00; // Event type marking a dropped event
+
+bool is_expression(const MidiEvent& event) {
+    return (event.type & 0xF0) == 0xB0 && event.data1 == 11;
+}
+
+struct ChannelRun {
+    bool active = false;
+    size_t last_kept = NONE; // Last event kept in the output
+    size_t held = NONE;      // Most recent dropped event, still a candidate for a late emit
+    size_t tail = NONE;      // Newest event of the run, undecided until the next one arrives
+};
+
+class Thinner {
+public:
+    Thinner(std::vector<MidiEvent>& events, const ExpressionThinningOptions& options)
+        : events(events), options(options), removed(0), moved(false) {}
+
+    size_t run() {
+        for (size_t i = 0; i < events.size(); ++i) {
+            if (events[i].type == 0xFF) continue; // Meta events belong to no channel
+            ChannelRun& run = runs[events[i].channel & 0x0F];
+            if (is_expression(events[i])) {
+                if (!run.active) {
+                    // The first level of a run is always kept.
+                    run.active = true;
+                    run.last_kept = i;
+                    continue;
+                }
+                if (run.tail != NONE) decide_interior(run, run.tail, events[i].time);
+                run.tail = i;
+            } else if (run.active) {
+                end_run(run);
+            }
+        }
+        for (auto& run : runs) {
+            if (run.active) end_run(run);
+        }
+
+        if (removed > 0) {
+            events.erase(std::remove_if(events.begin(), events.end(),
+                                        [](const MidiEvent& e) { return e.type == REMOVED; }),
+                         events.end());
+        }
+        if (moved) {
+            // Late-emitted levels moved forward in time; restore the time order.
+            std::stable_sort(events.begin(), events.end(),
+                             [](const MidiEvent& a, const MidiEvent& b) { return a.time < b.time; });
+        }
+        return removed;
+    }
+
+private:
+    std::vector<MidiEvent>& events;
+    const ExpressionThinningOptions& options;
+    ChannelRun runs[16];
+    size_t removed;
+    bool moved;
+
+    int error_from_kept(const ChannelRun& run, size_t index) const {
+        return std::abs(static_cast<int>(events[index].data2) - static_cast<int>(events[run.last_kept].data2));
+    }
+
+    void drop(size_t index) {
+        events[index].type = REMOVED;
+        ++removed;
+    }
+
+    // A held level that drifted out of tolerance is emitted at the earliest tick the
+    // spacing allows, provided that is still before `before`.
+    void catch_up(ChannelRun& run, uint32_t before) {
+        if (run.held == NONE) return;
+        size_t held = run.held;
+        run.held = NONE;
+        if (error_from_kept(run, held) <= options.max_value_error) return;
+
+        uint32_t emit_time = std::max(events[held].time, events[run.last_kept].time + options.min_spacing);
+        if (emit_time >= before) return;
+
+        // Revive the dropped event at its new time.
+        events[held].type = 0xB0;
+        --removed;
+        if (emit_time != events[held].time) {
+            events[held].time = emit_time;
+            moved = true;
+        }
+        run.last_kept = held;
+    }
+
+    void decide_interior(ChannelRun& run, size_t index, uint32_t next_time) {
+        if (events[index].time == next_time) {
+            drop(index); // Overridden within the same tick
+            return;
+        }
+
+        catch_up(run, events[index].time);
+        bool spaced = events[index].time - events[run.last_kept].time >= options.min_spacing;
+        if (spaced && error_from_kept(run, index) > options.max_value_error) {
+            run.last_kept = index;
+        } else {
+            drop(index);
+            run.held = index;
+        }
+    }
+
+    void end_run(ChannelRun& run) {
+        if (run.tail != NONE) {
+            size_t index = run.tail;
+            catch_up(run, events[index].time);
+            // The endpoint keeps its exact level and time, unless that level is already in effect.
+            if (events[index].data2 == events[run.last_kept].data2) {
+                drop(index);
+            } else {
+                run.last_kept = index;
+            }
+        }
+        run = ChannelRun();
+    }
+};
+
+} // namespace
+
+size_t thin_expression_events(std::vector<MidiEvent>& events, const ExpressionThinningOptions& options) {
+    if (!options.enabled()) return 0;
+    return Thinner(events, options).run();
+}
@@ -0,0 +1,25 @@
+#ifndef EXPRESSION_THINNER_H
+#define EXPRESSION_THINNER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "MidiEvent.h"
+
+struct ExpressionThinningOptions {
+    int max_value_error = 0;   // Largest tolerated difference from the original CC#11 level
+    uint32_t min_spacing = 0;  // Minimum ticks between two CC#11 events of a channel
+
+    bool enabled() const { return max_value_error > 0 || min_spacing > 0; }
+};
+
+// Thins CC#11 (Expression) envelopes in a time-ordered event list.
+// A run is a sequence of CC#11 events on one channel with no other event of that
+// channel in between; the first and last event of every run are kept exactly.
+// Interior events are dropped while they stay within max_value_error of the last
+// kept level, and kept events are at least min_spacing ticks apart: a level that
+// drifted out of tolerance too soon is emitted late, at the earliest allowed tick.
+// Returns the number of events removed.
+size_t thin_expression_events(std::vector<MidiEvent>& events, const ExpressionThinningOptions& options);
+
+#endif // EXPRESSION_THINNER_H
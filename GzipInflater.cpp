@@ -0,0 +1,396 @@
+#include "GzipInflater.h"
+#include <cstring>
+
+namespace {
+
+const uint16_t LENGTH_BASE[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const uint8_t LENGTH_EXTRA[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const uint16_t DISTANCE_BASE[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+const uint8_t DISTANCE_EXTRA[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+const uint8_t CODE_LENGTH_ORDER[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+const size_t WINDOW_SIZE = 32768;
+const size_t WINDOW_MASK = WINDOW_SIZE - 1;
+
+struct Crc32Table {
+    uint32_t entries[256];
+    Crc32Table() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+            }
+            entries[i] = c;
+        }
+    }
+};
+
+uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t size) {
+    static const Crc32Table table;
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+} // namespace
+
+GzipInflater::GzipInflater(ByteSpan input) : window(WINDOW_SIZE, 0) {
+    reset(input);
+}
+
+void GzipInflater::reset(ByteSpan new_input) {
+    input = new_input;
+    in_pos = 0;
+    bit_buffer = 0;
+    bit_count = 0;
+    state = State::Header;
+    last_block = false;
+    stored_remaining = 0;
+    copy_length = 0;
+    copy_distance = 0;
+    total_out = 0;
+    crc = 0;
+    error = nullptr;
+}
+
+bool GzipInflater::fail(const char* message) {
+    state = State::Error;
+    error = message;
+    return false;
+}
+
+void GzipInflater::refill() {
+    while (bit_count <= 56 && in_pos < input.size()) {
+        bit_buffer |= static_cast<uint64_t>(input[in_pos++]) << bit_count;
+        bit_count += 8;
+    }
+}
+
+bool GzipInflater::need_bits(unsigned count) {
+    if (bit_count < count) refill();
+    if (bit_count < count) return fail("unexpected end of compressed data");
+    return true;
+}
+
+bool GzipInflater::read_bits(unsigned count, uint32_t& value) {
+    if (!need_bits(count)) return false;
+    value = static_cast<uint32_t>(bit_buffer & ((1ull << count) - 1));
+    bit_buffer >>= count;
+    bit_count -= count;
+    return true;
+}
+
+bool GzipInflater::build_huffman(Huffman& codes, const uint8_t* lengths, int count, int& left) {
+    std::memset(codes.counts, 0, sizeof(codes.counts));
+    std::memset(codes.fast, 0, sizeof(codes.fast));
+    for (int i = 0; i < count; ++i) {
+        codes.counts[lengths[i]]++;
+    }
+
+    left = 1;
+    for (int len = 1; len < 16; ++len) {
+        left <<= 1;
+        left -= codes.counts[len];
+        if (left < 0) return fail("over-subscribed Huffman code");
+    }
+
+    uint16_t offsets[16];
+    uint16_t next_code[16];
+    offsets[1] = 0;
+    next_code[1] = 0;
+    for (int len = 1; len < 15; ++len) {
+        offsets[len + 1] = offsets[len] + codes.counts[len];
+        next_code[len + 1] = static_cast<uint16_t>((next_code[len] + codes.counts[len]) << 1);
+    }
+
+    for (int symbol = 0; symbol < count; ++symbol) {
+        int len = lengths[symbol];
+        if (len == 0) continue;
+        codes.symbols[offsets[len]++] = static_cast<uint16_t>(symbol);
+
+        uint32_t code = next_code[len]++;
+        if (len <= FAST_BITS) {
+            // Codes are stored most significant bit first, the bit buffer is LSB first.
+            uint32_t reversed = 0;
+            for (int b = 0; b < len; ++b) {
+                reversed |= ((code >> b) & 1u) << (len - 1 - b);
+            }
+            for (uint32_t i = reversed; i < (1u << FAST_BITS); i += (1u << len)) {
+                codes.fast[i] = static_cast<uint16_t>((len << 9) | symbol);
+            }
+        }
+    }
+    return true;
+}
+
+bool GzipInflater::decode_symbol(const Huffman& codes, int& symbol) {
+    if (bit_count < FAST_BITS) refill();
+    if (bit_count >= FAST_BITS) {
+        uint16_t entry = codes.fast[bit_buffer & ((1u << FAST_BITS) - 1)];
+        if (entry != 0) {
+            unsigned len = entry >> 9;
+            bit_buffer >>= len;
+            bit_count -= len;
+            symbol = entry & 0x1FF;
+            return true;
+        }
+    }
+
+    // Canonical decode one bit at a time for long codes and the tail of the stream.
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for (int len = 1; len < 16; ++len) {
+        uint32_t bit;
+        if (!read_bits(1, bit)) return false;
+        code |= static_cast<int>(bit);
+        int count = codes.counts[len];
+        if (code - count < first) {
+            symbol = codes.symbols[index + (code - first)];
+            return true;
+        }
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+    return fail("invalid Huffman code");
+}
+
+bool GzipInflater::read_gzip_header() {
+    // ID1 ID2 CM FLG MTIME(4) XFL OS
+    if (!input.has(0, 10) || !is_gzip(input)) return fail("not a gzip stream");
+    if (input[2] != 8) return fail("unsupported gzip compression method");
+
+    uint8_t flags = input[3];
+    size_t pos = 10;
+    if (flags & 0x04) { // FEXTRA
+        uint16_t extra_length;
+        if (!input.read_le16(pos, extra_length)) return fail("truncated gzip header");
+        pos += 2 + extra_length;
+    }
+    for (uint8_t flag : {uint8_t(0x08), uint8_t(0x10)}) { // FNAME, FCOMMENT
+        if (!(flags & flag)) continue;
+        while (pos < input.size() && input[pos] != 0) ++pos;
+        ++pos;
+    }
+    if (flags & 0x02) pos += 2; // FHCRC
+    if (pos > input.size()) return fail("truncated gzip header");
+
+    in_pos = pos;
+    state = State::BlockHeader;
+    return true;
+}
+
+bool GzipInflater::read_block_header() {
+    if (last_block) {
+        state = State::Trailer;
+        return true;
+    }
+
+    uint32_t final_flag, type;
+    if (!read_bits(1, final_flag) || !read_bits(2, type)) return false;
+    last_block = final_flag != 0;
+
+    if (type == 0) {
+        // Stored block: skip to the byte boundary, then LEN and NLEN.
+        bit_buffer >>= (bit_count & 7);
+        bit_count -= (bit_count & 7);
+        uint32_t length, inverse;
+        if (!read_bits(16, length) || !read_bits(16, inverse)) return false;
+        if (length != (~inverse & 0xFFFF)) return fail("stored block length mismatch");
+        stored_remaining = length;
+        state = State::Stored;
+    } else if (type == 1) {
+        uint8_t lengths[288 + 30];
+        int i = 0;
+        for (; i < 144; ++i) lengths[i] = 8;
+        for (; i < 256; ++i) lengths[i] = 9;
+        for (; i < 280; ++i) lengths[i] = 7;
+        for (; i < 288; ++i) lengths[i] = 8;
+        for (; i < 288 + 30; ++i) lengths[i] = 5;
+        // The fixed distance code is incomplete by design (30 of 32 codes).
+        int left;
+        if (!build_huffman(literal_codes, lengths, 288, left) ||
+            !build_huffman(distance_codes, lengths + 288, 30, left)) return false;
+        state = State::Huffman;
+    } else if (type == 2) {
+        if (!read_dynamic_tables()) return false;
+        state = State::Huffman;
+    } else {
+        return fail("invalid block type");
+    }
+    return true;
+}
+
+bool GzipInflater::read_dynamic_tables() {
+    uint32_t hlit, hdist, hclen;
+    if (!read_bits(5, hlit) || !read_bits(5, hdist) || !read_bits(4, hclen)) return false;
+    hlit += 257;
+    hdist += 1;
+    hclen += 4;
+    if (hlit > 286 || hdist > 30) return fail("bad dynamic block counts");
+
+    uint8_t lengths[288 + 30] = {0};
+    for (uint32_t i = 0; i < hclen; ++i) {
+        uint32_t len;
+        if (!read_bits(3, len)) return false;
+        lengths[CODE_LENGTH_ORDER[i]] = static_cast<uint8_t>(len);
+    }
+
+    Huffman length_codes;
+    int left;
+    if (!build_huffman(length_codes, lengths, 19, left)) return false;
+    if (left != 0) return fail("incomplete code length code");
+
+    std::memset(lengths, 0, sizeof(lengths));
+    uint32_t index = 0;
+    while (index < hlit + hdist) {
+        int symbol;
+        if (!decode_symbol(length_codes, symbol)) return false;
+        if (symbol < 16) {
+            lengths[index++] = static_cast<uint8_t>(symbol);
+            continue;
+        }
+
+        uint8_t repeat_value = 0;
+        uint32_t repeat;
+        if (symbol == 16) {
+            if (index == 0) return fail("repeat with no previous length");
+            repeat_value = lengths[index - 1];
+            if (!read_bits(2, repeat)) return false;
+            repeat += 3;
+        } else if (symbol == 17) {
+            if (!read_bits(3, repeat)) return false;
+            repeat += 3;
+        } else {
+            if (!read_bits(7, repeat)) return false;
+            repeat += 11;
+        }
+        if (index + repeat > hlit + hdist) return fail("too many code lengths");
+        while (repeat--) lengths[index++] = repeat_value;
+    }
+
+    if (lengths[256] == 0) return fail("missing end-of-block code");
+
+    // Incomplete codes are only legal when a single one-bit code is in use.
+    if (!build_huffman(literal_codes, lengths, static_cast<int>(hlit), left)) return false;
+    if (left > 0 && static_cast<int>(hlit) - literal_codes.counts[0] != literal_codes.counts[1]) {
+        return fail("incomplete literal/length code");
+    }
+    if (!build_huffman(distance_codes, lengths + hlit, static_cast<int>(hdist), left)) return false;
+    if (left > 0 && static_cast<int>(hdist) - distance_codes.counts[0] != distance_codes.counts[1]) {
+        return fail("incomplete distance code");
+    }
+    return true;
+}
+
+bool GzipInflater::read_trailer() {
+    bit_buffer >>= (bit_count & 7);
+    bit_count -= (bit_count & 7);
+
+    uint32_t expected_crc = 0, expected_size = 0;
+    for (int i = 0; i < 4; ++i) {
+        uint32_t byte;
+        if (!read_bits(8, byte)) return false;
+        expected_crc |= byte << (8 * i);
+    }
+    for (int i = 0; i < 4; ++i) {
+        uint32_t byte;
+        if (!read_bits(8, byte)) return false;
+        expected_size |= byte << (8 * i);
+    }
+
+    if (expected_crc != crc) return fail("gzip CRC mismatch");
+    if (expected_size != static_cast<uint32_t>(total_out)) return fail("gzip size mismatch");
+    state = State::Done;
+    return true;
+}
+
+void GzipInflater::emit(uint8_t* out, size_t& produced, uint8_t value) {
+    out[produced++] = value;
+    window[total_out & WINDOW_MASK] = value;
+    ++total_out;
+}
+
+size_t GzipInflater::read(uint8_t* out, size_t capacity) {
+    size_t produced = 0;
+    size_t hashed = 0;
+
+    while (produced < capacity) {
+        if (state == State::Header) {
+            if (!read_gzip_header()) break;
+        } else if (state == State::BlockHeader) {
+            if (!read_block_header()) break;
+        } else if (state == State::Stored) {
+            if (stored_remaining == 0) {
+                state = State::BlockHeader;
+                continue;
+            }
+            uint32_t byte;
+            if (!read_bits(8, byte)) break;
+            emit(out, produced, static_cast<uint8_t>(byte));
+            --stored_remaining;
+        } else if (state == State::Huffman) {
+            if (copy_length > 0) {
+                // Finish a back-reference that may have been cut by the end of the last read.
+                while (copy_length > 0 && produced < capacity) {
+                    emit(out, produced, window[(total_out - copy_distance) & WINDOW_MASK]);
+                    --copy_length;
+                }
+                continue;
+            }
+
+            int symbol;
+            if (!decode_symbol(literal_codes, symbol)) break;
+            if (symbol < 256) {
+                emit(out, produced, static_cast<uint8_t>(symbol));
+            } else if (symbol == 256) {
+                state = State::BlockHeader;
+            } else {
+                symbol -= 257;
+                if (symbol >= 29) {
+                    fail("invalid length symbol");
+                    break;
+                }
+                uint32_t extra;
+                if (!read_bits(LENGTH_EXTRA[symbol], extra)) break;
+                copy_length = LENGTH_BASE[symbol] + extra;
+
+                int distance_symbol;
+                if (!decode_symbol(distance_codes, distance_symbol)) break;
+                if (distance_symbol >= 30) {
+                    fail("invalid distance symbol");
+                    break;
+                }
+                if (!read_bits(DISTANCE_EXTRA[distance_symbol], extra)) break;
+                copy_distance = DISTANCE_BASE[distance_symbol] + extra;
+                if (copy_distance > total_out) {
+                    fail("distance too far back");
+                    break;
+                }
+            }
+        } else if (state == State::Trailer) {
+            crc = crc32_update(crc, out + hashed, produced - hashed);
+            hashed = produced;
+            read_trailer();
+            break;
+        } else {
+            break;
+        }
+    }
+
+    crc = crc32_update(crc, out + hashed, produced - hashed);
+    return produced;
+}
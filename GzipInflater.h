@@ -0,0 +1,75 @@
+#ifndef GZIP_INFLATER_H
+#define GZIP_INFLATER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "ByteSpan.h"
+
+// Streaming gzip (RFC 1952) / DEFLATE (RFC 1951) decoder.
+// The compressed input is a complete span (typically a file mapping); decompressed
+// data is produced incrementally through read(), so memory use is bounded by the
+// 32 KiB history window plus whatever chunk the caller reads into.
+class GzipInflater {
+public:
+    explicit GzipInflater(ByteSpan input = ByteSpan());
+    // Starts over on a new stream, keeping the allocated history window.
+    void reset(ByteSpan input);
+
+    static bool is_gzip(ByteSpan data) {
+        return data.size() >= 2 && data[0] == 0x1F && data[1] == 0x8B;
+    }
+
+    // Decompresses up to `capacity` bytes into `out` and returns the number written.
+    // Returns 0 once the stream has ended or an error occurred (see failed()).
+    size_t read(uint8_t* out, size_t capacity);
+
+    bool done() const { return state == State::Done; }
+    bool failed() const { return state == State::Error; }
+    const char* error_message() const { return error; }
+
+private:
+    enum class State { Header, BlockHeader, Stored, Huffman, Trailer, Done, Error };
+
+    static const int FAST_BITS = 9;
+
+    struct Huffman {
+        uint16_t counts[16];            // Number of codes of each length
+        uint16_t symbols[288];          // Symbols ordered by code
+        uint16_t fast[1 << FAST_BITS];  // (length << 9) | symbol for short codes, 0 otherwise
+    };
+
+    ByteSpan input;
+    size_t in_pos;
+    uint64_t bit_buffer;
+    unsigned bit_count;
+
+    State state;
+    bool last_block;
+    uint32_t stored_remaining;
+    uint32_t copy_length;
+    uint32_t copy_distance;
+
+    std::vector<uint8_t> window;
+    uint64_t total_out;
+    uint32_t crc;
+
+    Huffman literal_codes;
+    Huffman distance_codes;
+    const char* error;
+
+    bool fail(const char* message);
+    void refill();
+    bool need_bits(unsigned count);
+    bool read_bits(unsigned count, uint32_t& value);
+    bool decode_symbol(const Huffman& codes, int& symbol);
+    bool build_huffman(Huffman& codes, const uint8_t* lengths, int count, int& left);
+
+    bool read_gzip_header();
+    bool read_block_header();
+    bool read_dynamic_tables();
+    bool read_trailer();
+    void emit(uint8_t* out, size_t& produced, uint8_t value);
+};
+
+#endif // GZIP_INFLATER_H
@@ -0,0 +1,175 @@
+#include "Logger.h"
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+const size_t SLOT_COUNT = 4096; // Power of two
+const size_t MESSAGE_SIZE = 240;
+
+const char* const LEVEL_NAMES[] = {"trace", "debug", "info", "warn", "error", "off"};
+
+// One message. `sequence` implements the bounded multi-producer queue of D. Vyukov:
+// a slot is free for the producer claiming position p when sequence == p, and holds
+// a message for the consumer at position p when sequence == p + 1.
+struct Slot {
+    std::atomic<size_t> sequence;
+    LogLevel level;
+    uint64_t time_ns;
+    char text[MESSAGE_SIZE];
+};
+
+class AsyncLog {
+public:
+    AsyncLog() : slots(new Slot[SLOT_COUNT]), head(0), tail(0), dropped(0), level(static_cast<int>(LogLevel::Off)),
+                 file(nullptr), owns_file(false), running(false) {
+        for (size_t i = 0; i < SLOT_COUNT; ++i) slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    ~AsyncLog() { stop(); }
+
+    bool start(const std::string& path, LogLevel new_level) {
+        std::lock_guard<std::mutex> lock(control);
+        stop_locked();
+        if (path == "-") {
+            file = stderr;
+            owns_file = false;
+        } else {
+            file = std::fopen(path.c_str(), "w");
+            if (!file) return false;
+            owns_file = true;
+        }
+        origin = std::chrono::steady_clock::now();
+        running.store(true);
+        writer = std::thread(&AsyncLog::drain_loop, this);
+        level.store(static_cast<int>(new_level), std::memory_order_relaxed);
+        return true;
+    }
+
+    void stop() {
+        std::lock_guard<std::mutex> lock(control);
+        stop_locked();
+    }
+
+    bool enabled(LogLevel message_level) const {
+        return static_cast<int>(message_level) >= level.load(std::memory_order_relaxed);
+    }
+
+    void push(LogLevel message_level, const char* format, va_list args) {
+        size_t pos = head.load(std::memory_order_relaxed);
+        Slot* slot;
+        for (;;) {
+            slot = &slots[pos & (SLOT_COUNT - 1)];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            if (sequence == pos) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (sequence < pos) {
+                dropped.fetch_add(1, std::memory_order_relaxed); // Ring full: never block the producer
+                return;
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+
+        slot->level = message_level;
+        slot->time_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - origin).count());
+        std::vsnprintf(slot->text, MESSAGE_SIZE, format, args);
+        slot->sequence.store(pos + 1, std::memory_order_release);
+    }
+
+private:
+    std::unique_ptr<Slot[]> slots;
+    std::atomic<size_t> head; // Next position to claim (producers)
+    size_t tail;              // Next position to write out (writer thread only)
+    std::atomic<uint64_t> dropped;
+    std::atomic<int> level;   // LogLevel::Off while no log is open
+
+    std::mutex control; // Serializes start()/stop()
+    std::FILE* file;
+    bool owns_file;
+    std::thread writer;
+    std::atomic<bool> running;
+    std::chrono::steady_clock::time_point origin;
+
+    void stop_locked() {
+        if (!writer.joinable()) return;
+        level.store(static_cast<int>(LogLevel::Off), std::memory_order_relaxed);
+        running.store(false);
+        writer.join();
+        if (owns_file) std::fclose(file);
+        file = nullptr;
+    }
+
+    bool write_next() {
+        Slot& slot = slots[tail & (SLOT_COUNT - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != tail + 1) return false;
+        std::fprintf(file, "[%12.6f] %-5s %s\n", slot.time_ns / 1e9, LEVEL_NAMES[static_cast<int>(slot.level)], slot.text);
+        slot.sequence.store(tail + SLOT_COUNT, std::memory_order_release);
+        ++tail;
+        return true;
+    }
+
+    void drain_loop() {
+        uint64_t reported_drops = 0;
+        for (;;) {
+            bool stopping = !running.load();
+            bool wrote = false;
+            while (write_next()) wrote = true;
+
+            uint64_t drops = dropped.load(std::memory_order_relaxed);
+            if (drops != reported_drops) {
+                std::fprintf(file, "(%llu messages dropped, log buffer full)\n",
+                             static_cast<unsigned long long>(drops - reported_drops));
+                reported_drops = drops;
+            }
+            if (!wrote) {
+                std::fflush(file);
+                // Messages queued before stop() was called have been written out.
+                if (stopping) return;
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    }
+};
+
+AsyncLog& instance() {
+    static AsyncLog log;
+    return log;
+}
+
+} // namespace
+
+bool Logger::start(const std::string& path, LogLevel level) {
+    return instance().start(path, level);
+}
+
+void Logger::stop() {
+    instance().stop();
+}
+
+bool Logger::enabled(LogLevel level) {
+    return instance().enabled(level);
+}
+
+void Logger::write(LogLevel level, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    instance().push(level, format, args);
+    va_end(args);
+}
+
+bool Logger::parse_level(const std::string& name, LogLevel& level) {
+    for (int i = 0; i <= static_cast<int>(LogLevel::Off); ++i) {
+        if (name == LEVEL_NAMES[i]) {
+            level = static_cast<LogLevel>(i);
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,78 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <cstddef>
+#include <string>
+
+// Levelled, asynchronous debug log.
+//
+// Calls below VGM_WS_LOG_LEVEL are removed by the preprocessor; the rest cost one
+// relaxed atomic load unless a log was started with Logger::start(). Messages are
+// formatted straight into a slot of a lock-free ring buffer and written to the file
+// by a background thread, so the conversion never waits for disk I/O. When the ring
+// is full, messages are dropped (and counted) rather than blocking the producer.
+// No file is opened unless start() is called.
+
+#define VGM_WS_LOG_TRACE 0
+#define VGM_WS_LOG_DEBUG 1
+#define VGM_WS_LOG_INFO  2
+#define VGM_WS_LOG_WARN  3
+#define VGM_WS_LOG_ERROR 4
+#define VGM_WS_LOG_OFF   5
+
+// Lowest level compiled in, e.g. -DVGM_WS_LOG_LEVEL=0 for per-command tracing.
+#ifndef VGM_WS_LOG_LEVEL
+#define VGM_WS_LOG_LEVEL VGM_WS_LOG_DEBUG
+#endif
+
+enum class LogLevel { Trace, Debug, Info, Warn, Error, Off };
+
+class Logger {
+public:
+    // Starts logging messages of `level` and above to `path` ("-" = standard error).
+    static bool start(const std::string& path, LogLevel level);
+    // Writes out every queued message and stops the background thread. Also runs at exit.
+    static void stop();
+
+    static bool enabled(LogLevel level);
+    // printf-style; messages longer than a ring slot are truncated.
+    static void write(LogLevel level, const char* format, ...)
+#if defined(__GNUC__)
+        __attribute__((format(printf, 2, 3)))
+#endif
+        ;
+
+    // "trace", "debug", "info", "warn", "error" or "off".
+    static bool parse_level(const std::string& name, LogLevel& level);
+};
+
+#define VGM_LOG_AT(level, ...) \
+    do { if (Logger::enabled(level)) Logger::write(level, __VA_ARGS__); } while (0)
+
+#if VGM_WS_LOG_LEVEL <= VGM_WS_LOG_TRACE
+#define VGM_LOG_TRACE(...) VGM_LOG_AT(LogLevel::Trace, __VA_ARGS__)
+#else
+#define VGM_LOG_TRACE(...) do { } while (0)
+#endif
+#if VGM_WS_LOG_LEVEL <= VGM_WS_LOG_DEBUG
+#define VGM_LOG_DEBUG(...) VGM_LOG_AT(LogLevel::Debug, __VA_ARGS__)
+#else
+#define VGM_LOG_DEBUG(...) do { } while (0)
+#endif
+#if VGM_WS_LOG_LEVEL <= VGM_WS_LOG_INFO
+#define VGM_LOG_INFO(...) VGM_LOG_AT(LogLevel::Info, __VA_ARGS__)
+#else
+#define VGM_LOG_INFO(...) do { } while (0)
+#endif
+#if VGM_WS_LOG_LEVEL <= VGM_WS_LOG_WARN
+#define VGM_LOG_WARN(...) VGM_LOG_AT(LogLevel::Warn, __VA_ARGS__)
+#else
+#define VGM_LOG_WARN(...) do { } while (0)
+#endif
+#if VGM_WS_LOG_LEVEL <= VGM_WS_LOG_ERROR
+#define VGM_LOG_ERROR(...) VGM_LOG_AT(LogLevel::Error, __VA_ARGS__)
+#else
+#define VGM_LOG_ERROR(...) do { } while (0)
+#endif
+
+#endif // LOGGER_H
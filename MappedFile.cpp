@@ -0,0 +1,103 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile() : data(nullptr), size(0), file_handle(nullptr), mapping_handle(nullptr) {}
+
+bool MappedFile::open(const std::string& filename) {
+    close();
+
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER file_size;
+    if (GetFileType(file) != FILE_TYPE_DISK || !GetFileSizeEx(file, &file_size) ||
+        file_size.QuadPart == 0 || static_cast<unsigned long long>(file_size.QuadPart) > SIZE_MAX) {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr) {
+        CloseHandle(file);
+        return false;
+    }
+
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (view == nullptr) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    file_handle = file;
+    mapping_handle = mapping;
+    data = static_cast<const uint8_t*>(view);
+    size = static_cast<size_t>(file_size.QuadPart);
+    return true;
+}
+
+void MappedFile::close() {
+    if (data) UnmapViewOfFile(data);
+    if (mapping_handle) CloseHandle(static_cast<HANDLE>(mapping_handle));
+    if (file_handle) CloseHandle(static_cast<HANDLE>(file_handle));
+    data = nullptr;
+    size = 0;
+    mapping_handle = nullptr;
+    file_handle = nullptr;
+}
+
+#else
+
+MappedFile::MappedFile() : data(nullptr), size(0) {}
+
+bool MappedFile::open(const std::string& filename) {
+    close();
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+        ::close(fd);
+        return false;
+    }
+
+    void* view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps its own reference to the file, the descriptor is no longer needed.
+    ::close(fd);
+    if (view == MAP_FAILED) return false;
+
+#ifdef MADV_SEQUENTIAL
+    madvise(view, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+#endif
+
+    data = static_cast<const uint8_t*>(view);
+    size = static_cast<size_t>(st.st_size);
+    return true;
+}
+
+void MappedFile::close() {
+    if (data) munmap(const_cast<uint8_t*>(data), size);
+    data = nullptr;
+    size = 0;
+}
+
+#endif
+
+MappedFile::~MappedFile() {
+    close();
+}
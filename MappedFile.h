@@ -0,0 +1,33 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include "ByteSpan.h"
+
+// Read-only memory mapping of a whole file (mmap on POSIX, MapViewOfFile on Windows).
+// open() fails for inputs that cannot be mapped (pipes, empty files, special files);
+// callers are expected to fall back to reading the file into a buffer.
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& filename);
+    void close();
+    bool is_open() const { return data != nullptr; }
+    ByteSpan span() const { return ByteSpan(data, size); }
+
+private:
+    const uint8_t* data;
+    size_t size;
+#ifdef _WIN32
+    void* file_handle;
+    void* mapping_handle;
+#endif
+};
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,15 @@
+#ifndef MIDI_EVENT_H
+#define MIDI_EVENT_H
+
+#include <cstdint>
+
+// A channel message at an absolute tick, as produced by the chip model.
+struct MidiEvent {
+    uint32_t time;
+    uint8_t type;    // Status nibble: 0x80, 0x90, 0xB0, 0xC0, 0xE0, or 0xFF for a meta event
+    uint8_t channel;
+    uint8_t data1;   // Note, Program, Controller, or bend LSB
+    uint8_t data2;   // Velocity, Value, or bend MSB
+};
+
+#endif // MIDI_EVENT_H
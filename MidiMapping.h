@@ -0,0 +1,108 @@
+#ifndef MIDI_MAPPING_H
+#define MIDI_MAPPING_H
+
+#include <array>
+#include <cstdint>
+
+// Compile-time tables that map WonderSwan register values to MIDI values.
+// Periods (11 bits) and volumes (4 bits) have tiny domains, so every mapping
+// profile is evaluated once by the compiler and the hot path only does lookups.
+
+struct PitchEntry {
+    int16_t note;  // Nearest MIDI note (may fall outside 0-127 for extreme periods)
+    int8_t cents;  // Remainder from `note` to the exact pitch, -50..50
+};
+
+struct MidiMappingTables {
+    std::array<PitchEntry, 2048> pitch;  // Indexed by WonderSwan channel period
+    std::array<uint8_t, 16> velocity;    // Indexed by 4-bit channel volume
+    int transpose;                       // Semitones, for the pitch tables of other chips
+};
+
+namespace midi_mapping_detail {
+
+constexpr double LN2 = 0.69314718055994530942;
+
+// Natural logarithm: reduce to m * 2^e with m in [1, 2), then the atanh series.
+constexpr double ln(double x) {
+    int exponent = 0;
+    while (x >= 2.0) { x /= 2.0; ++exponent; }
+    while (x < 1.0) { x *= 2.0; --exponent; }
+    double t = (x - 1.0) / (x + 1.0);
+    double t2 = t * t;
+    double term = t;
+    double sum = 0.0;
+    for (int n = 1; n < 60; n += 2) {
+        sum += term / n;
+        term *= t2;
+    }
+    return 2.0 * sum + exponent * LN2;
+}
+
+// e^y: split into 2^k * e^r with |r| <= ln2/2, then the Taylor series.
+constexpr double exp(double y) {
+    int k = static_cast<int>(y / LN2 + (y < 0 ? -0.5 : 0.5));
+    double r = y - k * LN2;
+    double term = 1.0;
+    double sum = 1.0;
+    for (int n = 1; n < 30; ++n) {
+        term *= r / n;
+        sum += term;
+    }
+    for (; k > 0; --k) sum *= 2.0;
+    for (; k < 0; ++k) sum /= 2.0;
+    return sum;
+}
+
+constexpr double pow(double base, double exponent) {
+    return base <= 0.0 ? 0.0 : exp(exponent * ln(base));
+}
+
+// std::round semantics: halfway cases away from zero.
+constexpr int round_to_int(double x) {
+    return x < 0 ? -static_cast<int>(-x + 0.5) : static_cast<int>(x + 0.5);
+}
+
+} // namespace midi_mapping_detail
+
+// Nearest MIDI note of a tone of `freq` Hz, shifted by `transpose` semitones.
+constexpr PitchEntry pitch_entry_for(double freq, int transpose) {
+    namespace d = midi_mapping_detail;
+    double exact = 69.0 + 12.0 * (d::ln(freq / 440.0) / d::LN2);
+    int note = d::round_to_int(exact);
+    PitchEntry entry{};
+    entry.note = static_cast<int16_t>(note + transpose);
+    entry.cents = static_cast<int8_t>(d::round_to_int((exact - note) * 100.0));
+    return entry;
+}
+
+// curve_exponent shapes the 4-bit volume -> velocity curve (1.0 is linear),
+// transpose shifts every note by whole semitones.
+constexpr MidiMappingTables make_midi_mapping_tables(double curve_exponent, int transpose) {
+    namespace d = midi_mapping_detail;
+    MidiMappingTables tables{};
+
+    for (int period = 0; period < 2048; ++period) {
+        // WonderSwan clock 3.072 MHz, divided by the 32-sample wavetable length.
+        double freq = (3072000.0 / (2048.0 - period)) / 32.0;
+        tables.pitch[period] = pitch_entry_for(freq, transpose);
+    }
+
+    for (int volume = 0; volume < 16; ++volume) {
+        int velocity = static_cast<int>(d::pow(volume / 15.0, curve_exponent) * 127.0);
+        tables.velocity[volume] = static_cast<uint8_t>(velocity > 127 ? 127 : velocity);
+    }
+    tables.transpose = transpose;
+    return tables;
+}
+
+// One table set per profile. Template arguments are integers because C++17 does not
+// allow floating point template parameters: the curve exponent is given in 1/1000.
+template <int CurveExponentPermille, int Transpose>
+inline constexpr MidiMappingTables MIDI_MAPPING_TABLES =
+    make_midi_mapping_tables(CurveExponentPermille / 1000.0, Transpose);
+
+// A power of ~0.3 provides a more aggressive boost to lower volumes.
+inline constexpr const MidiMappingTables& DEFAULT_MIDI_MAPPING = MIDI_MAPPING_TABLES<300, 0>;
+
+#endif // MIDI_MAPPING_H
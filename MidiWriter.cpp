@@ -1,104 +1,394 @@
 #include "MidiWriter.h"
+#include "Logger.h"
+#include <cmath>
 #include <fstream>
-#include <algorithm>
-#include <vector>
 #include <iostream>
+#include <string>
 
-// --- Portable Endian Swap Functions ---
-uint32_t swap_endian_32(uint32_t val) {
-    return ((val << 24) & 0xff000000) |
-           ((val <<  8) & 0x00ff0000) |
-           ((val >>  8) & 0x0000ff00) |
-           ((val >> 24) & 0x000000ff);
+namespace {
+
+// MThd chunk (14 bytes), filled in by finish().
+const size_t FILE_HEADER_SIZE = 14;
+// MTrk id and length, filled in by finish().
+const size_t TRACK_HEADER_SIZE = 8;
+
+void put_be32(std::vector<uint8_t>& buffer, size_t pos, uint32_t value) {
+    buffer[pos] = static_cast<uint8_t>(value >> 24);
+    buffer[pos + 1] = static_cast<uint8_t>(value >> 16);
+    buffer[pos + 2] = static_cast<uint8_t>(value >> 8);
+    buffer[pos + 3] = static_cast<uint8_t>(value);
 }
 
-uint16_t swap_endian_16(uint16_t val) {
-    return (val << 8) | (val >> 8);
+void put_be16(std::vector<uint8_t>& buffer, size_t pos, uint16_t value) {
+    buffer[pos] = static_cast<uint8_t>(value >> 8);
+    buffer[pos + 1] = static_cast<uint8_t>(value);
 }
 
-MidiWriter::MidiWriter(int ppqn) : ppqn(ppqn) {}
+// Order of events sharing a tick: meta events, control changes and pitch bends,
+// program changes, notes.
+int event_rank(uint8_t type) {
+    switch (type & 0xF0) {
+        case 0xF0: return -1;
+        case 0xB0: case 0xE0: return 0;
+        case 0xC0: return 1;
+        default: return 2;
+    }
+}
+
+const uint32_t DEFAULT_TEMPO = 500000; // 120 BPM
+
+} // namespace
+
+uint32_t auto_tempo(uint16_t ppqn) {
+    // Ticks per second are ppqn * 10^6 / tempo; they must be a multiple of 300 and
+    // divide ppqn * 10^6 for the tempo to be whole microseconds. Only rates between
+    // 7.5 and 1920 BPM are considered.
+    const uint64_t quarter = uint64_t(ppqn) * 1000000;
+    const uint64_t default_rate = 2 * uint64_t(ppqn);
+    uint32_t best = 0;
+    double best_distance = 0.0;
+    for (uint64_t rate = 300; rate <= 16 * default_rate; rate += 300) {
+        if (rate * 16 < default_rate || quarter % rate != 0 || quarter / rate > 0xFFFFFF) continue;
+        uint32_t tempo = static_cast<uint32_t>(quarter / rate);
+        double distance = std::fabs(std::log(double(tempo) / DEFAULT_TEMPO));
+        if (best == 0 || distance < best_distance) {
+            best = tempo;
+            best_distance = distance;
+        }
+    }
+    return best;
+}
+
+MidiWriter::MidiWriter(const MidiWriterOptions& options)
+    : resolved_tempo(DEFAULT_TEMPO),
+      collecting(false),
+      track_names(CHANNEL_COUNT),
+      capturing(false),
+      stats(nullptr),
+      event_block(nullptr) {
+    marker_texts.reserve(MAX_MARKERS);
+    reset(options);
+}
+
+MidiWriter::~MidiWriter() {
+    stop_encoder_thread();
+}
+
+void MidiWriter::reset(const MidiWriterOptions& new_options) {
+    stop_encoder_thread();
+    options = new_options;
+    events.clear();
+    collecting = false;
+    pending.clear();
+    pending_time = 0;
+    tracks.resize(options.per_channel_tracks ? 1 + CHANNEL_COUNT : 1);
+    for (size_t i = 0; i < tracks.size(); ++i) {
+        Track& track = tracks[i];
+        track.data.assign((i == 0 ? FILE_HEADER_SIZE : 0) + TRACK_HEADER_SIZE, 0);
+        track.last_time = 0;
+        track.running_status = 0;
+        track.started = false;
+    }
+    tracks[0].started = true;
+    for (auto& name : track_names) name.clear();
+    marker_texts.clear();
+    captured.clear();
+    capturing = false;
+    file_image.clear();
+    finished = false;
+    thinned_events = 0;
+
+    if (options.ppqn == 0 || options.ppqn > 0x7FFF) options.ppqn = 480; // Bit 15 would mean SMPTE time
+    resolved_tempo = options.tempo != 0 ? options.tempo : auto_tempo(options.ppqn);
+    if (resolved_tempo == 0 || resolved_tempo > 0xFFFFFF) {
+        VGM_LOG_WARN("no exact tempo for %u PPQN (requested %u us), using %u us", unsigned(options.ppqn),
+                     unsigned(options.tempo), unsigned(DEFAULT_TEMPO));
+        resolved_tempo = DEFAULT_TEMPO;
+    }
+    if (options.per_channel_tracks) {
+        static const char conductor_name[] = "Conductor";
+        write_meta_event(tracks[0], 0x03, reinterpret_cast<const uint8_t*>(conductor_name), sizeof(conductor_name) - 1);
+    }
+    // The tempo every tick time is based on, on the conductor track in format 1.
+    const uint8_t tempo[3] = {static_cast<uint8_t>(resolved_tempo >> 16), static_cast<uint8_t>(resolved_tempo >> 8),
+                              static_cast<uint8_t>(resolved_tempo)};
+    write_meta_event(tracks[0], 0x51, tempo, sizeof(tempo));
+}
 
 void MidiWriter::add_note_on(uint8_t channel, uint8_t note, uint8_t velocity, uint32_t time) {
-    events.push_back({time, 0x90, channel, note, velocity});
+    add_event({time, 0x90, channel, note, velocity});
 }
 
 void MidiWriter::add_note_off(uint8_t channel, uint8_t note, uint32_t time) {
-    events.push_back({time, 0x80, channel, note, 0});
+    add_event({time, 0x80, channel, note, 0});
 }
 
 void MidiWriter::add_program_change(uint8_t channel, uint8_t program, uint32_t time) {
-    events.push_back({time, 0xC0, channel, program, 0}); // data2 is unused
+    add_event({time, 0xC0, channel, program, 0}); // data2 is unused
 }
 
 void MidiWriter::add_control_change(uint8_t channel, uint8_t controller, uint8_t value, uint32_t time) {
-    events.push_back({time, 0xB0, channel, controller, value});
+    add_event({time, 0xB0, channel, controller, value});
 }
 
-bool MidiWriter::write_to_file(const std::string& filename) {
-    std::ofstream file(filename, std::ios::binary);
-    if (!file) {
-        std::cerr << "Error: Could not open file for writing: " << filename << std::endl;
-        return false;
+void MidiWriter::add_pitch_bend(uint8_t channel, uint16_t value, uint32_t time) {
+    add_event({time, 0xE0, channel, static_cast<uint8_t>(value & 0x7F), static_cast<uint8_t>((value >> 7) & 0x7F)});
+}
+
+void MidiWriter::add_marker(const std::string& text, uint32_t time) {
+    if (marker_texts.size() >= MAX_MARKERS) return;
+    // The text is stored before the event that refers to it can reach the encoder.
+    uint8_t index = static_cast<uint8_t>(marker_texts.size());
+    marker_texts.push_back(text);
+    add_event({time, 0xFF, 0, 0x06, index});
+}
+
+void MidiWriter::set_track_name(uint8_t channel, const std::string& name) {
+    if (channel < CHANNEL_COUNT) track_names[channel] = name;
+}
+
+void MidiWriter::begin_capture() {
+    captured.clear();
+    capturing = true;
+}
+
+void MidiWriter::replay_capture(uint32_t shift) {
+    capturing = false;
+    for (MidiEvent event : captured) {
+        event.time += shift;
+        add_event(event);
     }
+}
 
-    // --- 1. Prepare Track Data ---
-    std::vector<uint8_t> track_data;
+void MidiWriter::start_encoder_thread() {
+    if (options.expression_thinning.enabled() || encoder.joinable() || finished) return;
+    if (!event_queue) event_queue.reset(new EventQueue());
+    event_queue->reset();
+    event_block = &event_queue->back();
+    event_block->count = 0;
+    encoder = std::thread([this] {
+        while (EventBlock* block = event_queue->front()) {
+            for (uint32_t i = 0; i < block->count; ++i) {
+                stream_event(block->events[i]);
+            }
+            event_queue->pop();
+        }
+    });
+}
 
-    // Sort events by time, then by type (Control/Program change before Note On/Off)
-    std::sort(events.begin(), events.end(), [](const MidiEvent& a, const MidiEvent& b) {
-        if (a.time != b.time) {
-            return a.time < b.time;
+void MidiWriter::stop_encoder_thread() {
+    if (!encoder.joinable()) return;
+    if (event_block->count > 0) event_queue->push();
+    event_queue->close();
+    encoder.join();
+    event_block = nullptr;
+}
+
+void MidiWriter::append_collected(const MidiWriter& segment, std::array<int, 16>& programs) {
+    for (const auto& event : segment.events) {
+        if (event.type == 0xFF) {
+            add_marker(segment.marker_texts[event.data2], event.time);
+        } else if (event.type == 0xC0) {
+            if (programs[event.channel] == event.data1) continue;
+            programs[event.channel] = event.data1;
+            add_event(event);
+        } else {
+            add_event(event);
         }
-        // Prioritize non-note events
-        uint8_t a_type = a.type & 0xF0;
-        uint8_t b_type = b.type & 0xF0;
-        if (a_type != b_type) {
-             if (a_type == 0x90 || a_type == 0x80) return false;
-             if (b_type == 0x90 || b_type == 0x80) return true;
+    }
+}
+
+void MidiWriter::add_event(const MidiEvent& event) {
+    if (capturing) captured.push_back(event);
+    if (collecting || options.expression_thinning.enabled()) {
+        events.push_back(event);
+    } else if (event_block) {
+        event_block->events[event_block->count++] = event;
+        if (event_block->count == event_block->events.size()) {
+            event_queue->push();
+            event_block = &event_queue->back();
+            event_block->count = 0;
         }
-        return a_type < b_type;
-    });
+    } else {
+        stream_event(event);
+    }
+}
 
-    uint32_t last_time = 0;
-    for (const auto& event : events) {
-        uint32_t delta_time = event.time - last_time;
-        write_variable_length(track_data, delta_time);
-        
-        uint8_t status_byte = event.type | event.channel;
-        track_data.push_back(status_byte);
-        track_data.push_back(event.data1);
-
-        // Program Change messages only have one data byte
-        if ((event.type & 0xF0) != 0xC0) {
-            track_data.push_back(event.data2);
+void MidiWriter::stream_event(const MidiEvent& event) {
+    if (!pending.empty() && event.time != pending_time) {
+        if (event.time > pending_time) {
+            flush_pending();
+        } else {
+            // The stream cannot go back in time; a late event joins the current tick.
+            MidiEvent late = event;
+            late.time = pending_time;
+            VGM_STATS(++stats->events_clamped);
+            pending.push_back(late);
+            return;
         }
-        
-        last_time = event.time;
     }
+    pending_time = event.time;
+    pending.push_back(event);
+}
 
+void MidiWriter::flush_pending() {
+    // Stable insertion sort by rank: a tick holds only a handful of events and
+    // keeps the producer's order within a rank (e.g. legato note-off before note-on).
+    for (size_t i = 1; i < pending.size(); ++i) {
+        MidiEvent event = pending[i];
+        int rank = event_rank(event.type);
+        size_t j = i;
+        while (j > 0 && event_rank(pending[j - 1].type) > rank) {
+            pending[j] = pending[j - 1];
+            --j;
+        }
+        pending[j] = event;
+    }
+
+    for (const auto& event : pending) {
+        encode_event(event.type == 0xFF ? tracks[0] : track_for(event.channel), event);
+    }
+    pending.clear();
+}
+
+MidiWriter::Track& MidiWriter::track_for(uint8_t channel) {
+    if (!options.per_channel_tracks) return tracks[0];
+
+    Track& track = tracks[1 + (channel & 0x0F)];
+    if (!track.started) {
+        track.started = true;
+        std::string name = track_names[channel & 0x0F];
+        if (name.empty()) name = "Channel " + std::to_string((channel & 0x0F) + 1);
+        write_meta_event(track, 0x03, reinterpret_cast<const uint8_t*>(name.data()), name.size());
+    }
+    return track;
+}
+
+void MidiWriter::encode_event(Track& track, const MidiEvent& event) {
+    if (event.type == 0xFF) {
+        const std::string& text = marker_texts[event.data2];
+        write_meta_event(track, event.data1, reinterpret_cast<const uint8_t*>(text.data()), text.size(),
+                         event.time - track.last_time);
+        track.last_time = event.time;
+        return;
+    }
+#if VGM_WS_STATS
+    if (stats) {
+        ChannelEventCounts& counts = stats->channel_events[event.channel & 0x0F];
+        switch (event.type) {
+            case 0x80: ++counts.note_off; break;
+            case 0x90: ++counts.note_on; break;
+            case 0xB0: ++counts.control_change; break;
+            case 0xC0: ++counts.program_change; break;
+            case 0xE0: ++counts.pitch_bend; break;
+        }
+    }
+#endif
+    write_variable_length(track.data, event.time - track.last_time);
+
+    uint8_t type = event.type;
+    uint8_t data2 = event.data2;
+    if (options.running_status && type == 0x80) {
+        type = 0x90; // Note-on with velocity 0 is a note-off
+        data2 = 0;
+    }
+
+    uint8_t status_byte = type | event.channel;
+    if (!options.running_status || status_byte != track.running_status) {
+        track.data.push_back(status_byte);
+        track.running_status = status_byte;
+    }
+    track.data.push_back(event.data1);
+
+    // Program Change messages only have one data byte
+    if ((type & 0xF0) != 0xC0) {
+        track.data.push_back(data2);
+    }
+
+    track.last_time = event.time;
+}
+
+void MidiWriter::write_meta_event(Track& track, uint8_t type, const uint8_t* data, size_t size, uint32_t delta) {
+    write_variable_length(track.data, delta);
+    track.data.push_back(0xFF);
+    track.data.push_back(type);
+    write_variable_length(track.data, static_cast<uint32_t>(size));
+    track.data.insert(track.data.end(), data, data + size);
+    track.running_status = 0; // Meta events cancel running status
+}
+
+void MidiWriter::end_track(Track& track) {
     // End of track event
-    write_variable_length(track_data, 0);
-    track_data.push_back(0xFF);
-    track_data.push_back(0x2F);
-    track_data.push_back(0x00);
-
-    // --- 2. Write MIDI Header ---
-    file.write("MThd", 4);
-    uint32_t header_size = swap_endian_32(6);
-    file.write(reinterpret_cast<const char*>(&header_size), 4);
-    uint16_t format = swap_endian_16(0); // Single track format
-    file.write(reinterpret_cast<const char*>(&format), 2);
-    uint16_t num_tracks = swap_endian_16(1);
-    file.write(reinterpret_cast<const char*>(&num_tracks), 2);
-    uint16_t division = swap_endian_16(this->ppqn);
-    file.write(reinterpret_cast<const char*>(&division), 2);
-
-    // --- 3. Write Track Chunk ---
-    file.write("MTrk", 4);
-    uint32_t track_size = swap_endian_32(track_data.size());
-    file.write(reinterpret_cast<const char*>(&track_size), 4);
-    file.write(reinterpret_cast<const char*>(track_data.data()), track_data.size());
-    
+    write_meta_event(track, 0x2F, nullptr, 0);
+}
+
+const std::vector<uint8_t>& MidiWriter::finish() {
+    if (finished) return file_image;
+    stop_encoder_thread();
+    finished = true;
+
+    if (options.expression_thinning.enabled()) {
+        thinned_events = thin_expression_events(events, options.expression_thinning);
+        VGM_STATS(stats->events_dropped += thinned_events);
+        for (const auto& event : events) {
+            stream_event(event);
+        }
+        events.clear();
+    }
+    flush_pending();
+
+    uint16_t track_count = 0;
+    for (size_t i = 0; i < tracks.size(); ++i) {
+        Track& track = tracks[i];
+        if (!track.started) continue;
+        end_track(track);
+
+        // Back-patch the chunk length now that it is known.
+        size_t chunk = (i == 0) ? FILE_HEADER_SIZE : 0;
+        track.data[chunk] = 'M'; track.data[chunk + 1] = 'T'; track.data[chunk + 2] = 'r'; track.data[chunk + 3] = 'k';
+        put_be32(track.data, chunk + 4, static_cast<uint32_t>(track.data.size() - chunk - TRACK_HEADER_SIZE));
+        ++track_count;
+    }
+
+    // The header lives at the front of the first track's buffer, so format 0 needs no copy.
+    file_image.swap(tracks[0].data);
+    file_image[0] = 'M'; file_image[1] = 'T'; file_image[2] = 'h'; file_image[3] = 'd';
+    put_be32(file_image, 4, 6);
+    put_be16(file_image, 8, options.per_channel_tracks ? 1 : 0);
+    put_be16(file_image, 10, track_count);
+    put_be16(file_image, 12, options.ppqn);
+
+    for (size_t i = 1; i < tracks.size(); ++i) {
+        if (!tracks[i].started) continue;
+        file_image.insert(file_image.end(), tracks[i].data.begin(), tracks[i].data.end());
+        tracks[i].data.clear();
+    }
+
+    VGM_STATS(stats->midi_bytes += file_image.size());
+    return file_image;
+}
+
+void MidiWriter::take_image(std::vector<uint8_t>& out) {
+    finish();
+    out.swap(file_image);
+    file_image.clear();
+}
+
+bool MidiWriter::write_to_file(const std::string& filename) {
+    const std::vector<uint8_t>& image = finish();
+
+    if (filename == "-") {
+        std::cout.write(reinterpret_cast<const char*>(image.data()), image.size());
+        std::cout.flush();
+        return std::cout.good();
+    }
+
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        std::cerr << "Error: Could not open file for writing: " << filename << std::endl;
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(image.data()), image.size());
     return file.good();
 }
 
@@ -1,30 +1,151 @@
 #ifndef MIDI_WRITER_H
 #define MIDI_WRITER_H
 
+#include <array>
+#include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 #include <cstdint> // For uint8_t, uint32_t
+#include "MidiEvent.h"
+#include "ExpressionThinner.h"
+#include "ConversionStats.h"
+#include "SpscQueue.h"
 
+struct MidiWriterOptions {
+    // SMF format 1 with a conductor track plus one named track per MIDI channel,
+    // instead of format 0 with a single track.
+    bool per_channel_tracks = false;
+    // Omit repeated status bytes; note-offs become note-on with velocity 0 so they
+    // share the status of the surrounding note-ons.
+    bool running_status = false;
+    // Optional CC#11 envelope thinning. It needs the whole event list, so when it is
+    // enabled events are buffered and encoded by finish() instead of streamed.
+    ExpressionThinningOptions expression_thinning;
+    // Ticks per quarter note (1-32767) and tempo in microseconds per quarter note,
+    // announced by a tempo meta event at tick 0. 0 = auto_tempo(ppqn).
+    uint16_t ppqn = 480;
+    uint32_t tempo = 500000;
+};
+
+// Tempo closest to 120 BPM at which one tick is a whole number of 1/300 seconds, so
+// that the 735- and 882-sample waits of 60 Hz and 50 Hz drivers become whole tick
+// counts; 0 if `ppqn` has no such tempo (it must be a multiple of 3). 480 PPQN
+// gives 400000 us (150 BPM): 20 and 24 ticks per wait.
+uint32_t auto_tempo(uint16_t ppqn);
+
+// Streaming Standard MIDI File encoder.
+// Events are expected in non-decreasing time order (which is how the chip model
+// produces them). They are encoded into their track as soon as their tick is
+// complete; only the events of the current tick are held back, so that control and
+// program changes can be moved ahead of the notes sharing their timestamp.
+// Every track keeps its own time base and running status, so tracks are encoded
+// independently of each other.
 class MidiWriter {
 public:
-    MidiWriter(int ppqn = 480);
+    explicit MidiWriter(const MidiWriterOptions& options = MidiWriterOptions());
+    ~MidiWriter();
+    MidiWriter(const MidiWriter&) = delete;
+    MidiWriter& operator=(const MidiWriter&) = delete;
     void add_note_on(uint8_t channel, uint8_t note, uint8_t velocity, uint32_t time);
     void add_note_off(uint8_t channel, uint8_t note, uint32_t time);
     void add_program_change(uint8_t channel, uint8_t program, uint32_t time);
     void add_control_change(uint8_t channel, uint8_t controller, uint8_t value, uint32_t time);
+    // `value` is 14 bits, 8192 = no bend.
+    void add_pitch_bend(uint8_t channel, uint16_t value, uint32_t time);
+    // Marker meta event (FF 06) on the first track: the only track in format 0, the
+    // conductor track in format 1.
+    void add_marker(const std::string& text, uint32_t time);
+    // Name of the channel's track in per-channel mode; must be set before its first event.
+    void set_track_name(uint8_t channel, const std::string& name);
+
+    // Records every event added from now on, until end_capture(), so that the span can
+    // be appended again by replay_capture() with its times shifted by `shift` ticks.
+    void begin_capture();
+    void end_capture() { capturing = false; }
+    void replay_capture(uint32_t shift);
+
+    // Keeps the events added from now on in memory instead of encoding them, for
+    // append_collected() into another writer (segments of the parallel parser).
+    void collect_events() { collecting = true; }
+    // Adds the events `segment` collected, in order, as if they were added here.
+    // `programs` is the program in effect on every channel (-1 = none): a program
+    // change that repeats it is dropped, and the ones appended update it.
+    void append_collected(const MidiWriter& segment, std::array<int, 16>& programs);
+
+    // Encodes the events added from now until finish() on a separate thread, which
+    // receives them in blocks through a lock-free queue (pipelined conversion). No
+    // effect when expression thinning buffers the events anyway.
+    void start_encoder_thread();
+
+    // Flushes the last tick, appends End of Track and back-patches the header and
+    // chunk lengths. Returns the complete file image; no events may be added afterwards.
+    const std::vector<uint8_t>& finish();
+    // finish() and write the image; "-" writes to standard output (e.g. a pipe).
     bool write_to_file(const std::string& filename);
+    // finish() and swap the image into `out`. The writer keeps out's old buffer, so a
+    // caller that always passes the same vector recycles both allocations.
+    void take_image(std::vector<uint8_t>& out);
+    // Starts a new file, keeping every buffer's capacity for the next conversion.
+    void reset(const MidiWriterOptions& options);
+    void reset() { reset(options); }
+    const MidiWriterOptions& settings() const { return options; }
+    // Time base of the file, with an auto tempo resolved.
+    uint16_t ticks_per_quarter() const { return options.ppqn; }
+    uint32_t tempo() const { return resolved_tempo; }
+    // Number of CC#11 events removed by expression thinning (valid after finish()).
+    size_t expression_events_removed() const { return thinned_events; }
+    // Counts written, dropped and clamped events into `stats` (may be null).
+    void set_stats(ConversionStats* stats) { this->stats = stats; }
 
 private:
-    struct MidiEvent {
-        uint32_t time;
-        uint8_t type;
-        uint8_t channel;
-        uint8_t data1; // Note, Program, or Controller
-        uint8_t data2; // Velocity or Value
+    struct Track {
+        std::vector<uint8_t> data;  // Chunk header placeholder followed by the events
+        uint32_t last_time = 0;     // Time of the last encoded event
+        uint8_t running_status = 0; // 0 = none in effect
+        bool started = false;
     };
 
-    int ppqn;
-    std::vector<MidiEvent> events;
+    static const int CHANNEL_COUNT = 16;
+    static const size_t MAX_MARKERS = 256; // Marker texts are indexed by a data byte
+
+    struct EventBlock {
+        uint32_t count = 0;
+        std::array<MidiEvent, 1024> events;
+    };
+    using EventQueue = SpscBlockQueue<EventBlock, 8>;
+
+    MidiWriterOptions options;
+    uint32_t resolved_tempo;
+    std::vector<MidiEvent> events;  // Whole event list, only used when post-processing or collecting
+    bool collecting;
+    std::vector<MidiEvent> pending; // Events of the tick currently being collected
+    uint32_t pending_time;
+    // Format 0: tracks[0] only. Format 1: tracks[0] is the conductor track and
+    // tracks[1 + channel] belongs to a MIDI channel. tracks[0] starts with room for MThd.
+    std::vector<Track> tracks;
+    std::vector<std::string> track_names;
+    // Indexed by data2 of 0xFF (meta) events. Capacity is reserved up front, so the
+    // encoder thread can read earlier texts while new ones are appended.
+    std::vector<std::string> marker_texts;
+    std::vector<MidiEvent> captured;
+    bool capturing;
+    std::vector<uint8_t> file_image;
+    bool finished;
+    size_t thinned_events;
+    ConversionStats* stats;
+    std::unique_ptr<EventQueue> event_queue; // Allocated by the first start_encoder_thread()
+    EventBlock* event_block;                 // Being filled while the encoder thread runs
+    std::thread encoder;
+
+    void stop_encoder_thread();
+    void add_event(const MidiEvent& event);
+    void stream_event(const MidiEvent& event);
+    void flush_pending();
+    Track& track_for(uint8_t channel);
+    void encode_event(Track& track, const MidiEvent& event);
+    void write_meta_event(Track& track, uint8_t type, const uint8_t* data, size_t size, uint32_t delta = 0);
+    void end_track(Track& track);
     void write_variable_length(std::vector<uint8_t>& buffer, uint32_t value);
 };
 
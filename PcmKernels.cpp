@@ -0,0 +1,232 @@
+#include "PcmKernels.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+#if VGM_PCM_SIMD && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define VGM_PCM_X86 1
+#include <immintrin.h>
+#else
+#define VGM_PCM_X86 0
+#endif
+
+namespace {
+
+const float PHASE_TO_STEP = 1.0f / 134217728.0f; // 2^-27: phase bits below the step index
+
+inline float level_at(const WavetableSteps& wave, uint32_t phase) {
+    uint32_t index = phase >> 27;
+    float fraction = static_cast<float>(static_cast<int32_t>(phase & 0x07FFFFFF)) * PHASE_TO_STEP;
+    return wave.prefix[index] + fraction * wave.step[index];
+}
+
+inline int16_t to_pcm16(float value) {
+    long sample = std::lrint(value); // Round half to even, like cvtps2dq
+    return static_cast<int16_t>(std::min<long>(std::max<long>(sample, -32768), 32767));
+}
+
+// The running sum of a mean-free waveform is periodic, so the integral over an
+// interval is the difference of its values at the two ends, however many periods
+// the interval spans.
+void render_wavetable_scalar(const WavetableSteps& wave, uint32_t& phase, uint64_t increment, float* out,
+                             size_t count) {
+    uint32_t step = static_cast<uint32_t>(increment);
+    float scale = 134217728.0f / static_cast<float>(increment); // 1 / steps per sample
+    uint32_t p = phase;
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t q = p + step;
+        out[i] = (level_at(wave, q) - level_at(wave, p)) * scale;
+        p = q;
+    }
+    phase = p;
+}
+
+void mix_to_pcm16_scalar(const float* const* inputs, const float* gains_left, const float* gains_right, int channels,
+                         size_t count, int16_t* out) {
+    for (size_t i = 0; i < count; ++i) {
+        float left = 0.0f, right = 0.0f;
+        for (int c = 0; c < channels; ++c) {
+            left = left + inputs[c][i] * gains_left[c];
+            right = right + inputs[c][i] * gains_right[c];
+        }
+        out[2 * i] = to_pcm16(left);
+        out[2 * i + 1] = to_pcm16(right);
+    }
+}
+
+#if VGM_PCM_X86
+
+// SSE2 has no gather: the four step indices go through memory.
+inline __m128 level_sse2(const WavetableSteps& wave, __m128i phase) {
+    alignas(16) int32_t index[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(index), _mm_srli_epi32(phase, 27));
+    __m128 prefix = _mm_setr_ps(wave.prefix[index[0]], wave.prefix[index[1]], wave.prefix[index[2]], wave.prefix[index[3]]);
+    __m128 step = _mm_setr_ps(wave.step[index[0]], wave.step[index[1]], wave.step[index[2]], wave.step[index[3]]);
+    __m128 fraction = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(phase, _mm_set1_epi32(0x07FFFFFF))),
+                                 _mm_set1_ps(PHASE_TO_STEP));
+    return _mm_add_ps(prefix, _mm_mul_ps(fraction, step));
+}
+
+void render_wavetable_sse2(const WavetableSteps& wave, uint32_t& phase, uint64_t increment, float* out, size_t count) {
+    uint32_t step = static_cast<uint32_t>(increment);
+    float scale = 134217728.0f / static_cast<float>(increment);
+    size_t vector_count = count & ~size_t(3);
+    __m128i p = _mm_setr_epi32(static_cast<int32_t>(phase), static_cast<int32_t>(phase + step),
+                               static_cast<int32_t>(phase + 2 * step), static_cast<int32_t>(phase + 3 * step));
+    __m128i steps = _mm_set1_epi32(static_cast<int32_t>(step));
+    __m128i advance = _mm_set1_epi32(static_cast<int32_t>(4 * step));
+    __m128 scales = _mm_set1_ps(scale);
+    for (size_t i = 0; i < vector_count; i += 4) {
+        __m128 start = level_sse2(wave, p);
+        __m128 end = level_sse2(wave, _mm_add_epi32(p, steps));
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_sub_ps(end, start), scales));
+        p = _mm_add_epi32(p, advance);
+    }
+    phase += static_cast<uint32_t>(vector_count) * step;
+    render_wavetable_scalar(wave, phase, increment, out + vector_count, count - vector_count);
+}
+
+// Converts four left and four right samples and stores them interleaved.
+inline void store_pcm16_sse2(__m128 left, __m128 right, int16_t* out) {
+    __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(left), _mm_cvtps_epi32(right)); // L0-L3 R0-R3
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi16(packed, _mm_srli_si128(packed, 8)));
+}
+
+void mix_to_pcm16_sse2(const float* const* inputs, const float* gains_left, const float* gains_right, int channels,
+                       size_t count, int16_t* out) {
+    size_t vector_count = count & ~size_t(3);
+    for (size_t i = 0; i < vector_count; i += 4) {
+        __m128 left = _mm_setzero_ps(), right = _mm_setzero_ps();
+        for (int c = 0; c < channels; ++c) {
+            __m128 input = _mm_loadu_ps(inputs[c] + i);
+            left = _mm_add_ps(left, _mm_mul_ps(input, _mm_set1_ps(gains_left[c])));
+            right = _mm_add_ps(right, _mm_mul_ps(input, _mm_set1_ps(gains_right[c])));
+        }
+        store_pcm16_sse2(left, right, out + 2 * i);
+    }
+    const float* rest[8];
+    for (int c = 0; c < channels; ++c) rest[c] = inputs[c] + vector_count;
+    mix_to_pcm16_scalar(rest, gains_left, gains_right, channels, count - vector_count, out + 2 * vector_count);
+}
+
+__attribute__((target("avx2"))) inline __m256 level_avx2(const WavetableSteps& wave, __m256i phase) {
+    __m256i index = _mm256_srli_epi32(phase, 27);
+    __m256 prefix = _mm256_i32gather_ps(wave.prefix, index, 4);
+    __m256 step = _mm256_i32gather_ps(wave.step, index, 4);
+    __m256 fraction = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(phase, _mm256_set1_epi32(0x07FFFFFF))),
+                                    _mm256_set1_ps(PHASE_TO_STEP));
+    return _mm256_add_ps(prefix, _mm256_mul_ps(fraction, step));
+}
+
+__attribute__((target("avx2"))) void render_wavetable_avx2(const WavetableSteps& wave, uint32_t& phase,
+                                                           uint64_t increment, float* out, size_t count) {
+    uint32_t step = static_cast<uint32_t>(increment);
+    float scale = 134217728.0f / static_cast<float>(increment);
+    size_t vector_count = count & ~size_t(7);
+    __m256i p = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int32_t>(phase)),
+                                 _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+                                                    _mm256_set1_epi32(static_cast<int32_t>(step))));
+    __m256i steps = _mm256_set1_epi32(static_cast<int32_t>(step));
+    __m256i advance = _mm256_set1_epi32(static_cast<int32_t>(8 * step));
+    __m256 scales = _mm256_set1_ps(scale);
+    for (size_t i = 0; i < vector_count; i += 8) {
+        __m256 start = level_avx2(wave, p);
+        __m256 end = level_avx2(wave, _mm256_add_epi32(p, steps));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_sub_ps(end, start), scales));
+        p = _mm256_add_epi32(p, advance);
+    }
+    phase += static_cast<uint32_t>(vector_count) * step;
+    render_wavetable_scalar(wave, phase, increment, out + vector_count, count - vector_count);
+}
+
+__attribute__((target("avx2"))) void mix_to_pcm16_avx2(const float* const* inputs, const float* gains_left,
+                                                       const float* gains_right, int channels, size_t count,
+                                                       int16_t* out) {
+    size_t vector_count = count & ~size_t(7);
+    for (size_t i = 0; i < vector_count; i += 8) {
+        __m256 left = _mm256_setzero_ps(), right = _mm256_setzero_ps();
+        for (int c = 0; c < channels; ++c) {
+            __m256 input = _mm256_loadu_ps(inputs[c] + i);
+            left = _mm256_add_ps(left, _mm256_mul_ps(input, _mm256_set1_ps(gains_left[c])));
+            right = _mm256_add_ps(right, _mm256_mul_ps(input, _mm256_set1_ps(gains_right[c])));
+        }
+        store_pcm16_sse2(_mm256_castps256_ps128(left), _mm256_castps256_ps128(right), out + 2 * i);
+        store_pcm16_sse2(_mm256_extractf128_ps(left, 1), _mm256_extractf128_ps(right, 1), out + 2 * i + 8);
+    }
+    const float* rest[8];
+    for (int c = 0; c < channels; ++c) rest[c] = inputs[c] + vector_count;
+    mix_to_pcm16_scalar(rest, gains_left, gains_right, channels, count - vector_count, out + 2 * vector_count);
+}
+
+#endif // VGM_PCM_X86
+
+bool supported(PcmKernel kernel) {
+#if VGM_PCM_X86
+    if (kernel == PcmKernel::Avx2) return __builtin_cpu_supports("avx2");
+    return true; // SSE2 is part of x86-64, and assumed on 32-bit x86
+#else
+    return kernel == PcmKernel::Scalar;
+#endif
+}
+
+std::atomic<PcmKernel>& selected_kernel() {
+    static std::atomic<PcmKernel> kernel(best_pcm_kernel());
+    return kernel;
+}
+
+} // namespace
+
+void WavetableSteps::assign(const uint8_t* samples) {
+    int total = 0;
+    for (int i = 0; i < 32; ++i) total += samples[i];
+    float mean = total / 32.0f;
+    float sum = 0.0f;
+    for (int i = 0; i < 32; ++i) {
+        step[i] = samples[i] - mean;
+        prefix[i] = sum;
+        sum += step[i];
+    }
+}
+
+PcmKernel best_pcm_kernel() {
+    return supported(PcmKernel::Avx2) ? PcmKernel::Avx2 : supported(PcmKernel::Sse2) ? PcmKernel::Sse2 : PcmKernel::Scalar;
+}
+
+PcmKernel set_pcm_kernel(PcmKernel kernel) {
+    if (!supported(kernel)) kernel = best_pcm_kernel();
+    selected_kernel().store(kernel, std::memory_order_relaxed);
+    return kernel;
+}
+
+PcmKernel current_pcm_kernel() {
+    return selected_kernel().load(std::memory_order_relaxed);
+}
+
+const char* pcm_kernel_name(PcmKernel kernel) {
+    switch (kernel) {
+        case PcmKernel::Sse2: return "sse2";
+        case PcmKernel::Avx2: return "avx2";
+        default: return "scalar";
+    }
+}
+
+void render_wavetable(const WavetableSteps& wave, uint32_t& phase, uint64_t increment, float* out, size_t count) {
+    switch (current_pcm_kernel()) {
+#if VGM_PCM_X86
+        case PcmKernel::Avx2: return render_wavetable_avx2(wave, phase, increment, out, count);
+        case PcmKernel::Sse2: return render_wavetable_sse2(wave, phase, increment, out, count);
+#endif
+        default: return render_wavetable_scalar(wave, phase, increment, out, count);
+    }
+}
+
+void mix_to_pcm16(const float* const* inputs, const float* gains_left, const float* gains_right, int channels,
+                  size_t count, int16_t* out) {
+    switch (current_pcm_kernel()) {
+#if VGM_PCM_X86
+        case PcmKernel::Avx2: return mix_to_pcm16_avx2(inputs, gains_left, gains_right, channels, count, out);
+        case PcmKernel::Sse2: return mix_to_pcm16_sse2(inputs, gains_left, gains_right, channels, count, out);
+#endif
+        default: return mix_to_pcm16_scalar(inputs, gains_left, gains_right, channels, count, out);
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef PCM_KERNELS_H
+#define PCM_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Inner loops of WonderSwanRenderer, in a scalar version and, on x86, SSE2 and AVX2
+// versions picked at run time. All versions compute every sample with the same
+// float operations in the same order, so they produce identical output; building
+// with -DVGM_PCM_SIMD=0 keeps only the scalar one.
+#ifndef VGM_PCM_SIMD
+#define VGM_PCM_SIMD 1
+#endif
+
+enum class PcmKernel : uint8_t { Scalar, Sse2, Avx2 };
+
+// Most capable kernel set this CPU supports.
+PcmKernel best_pcm_kernel();
+// Selects the kernels for the whole process (falls back to the best supported one
+// if `kernel` is not); returns the selected set.
+PcmKernel set_pcm_kernel(PcmKernel kernel);
+PcmKernel current_pcm_kernel();
+const char* pcm_kernel_name(PcmKernel kernel);
+
+// A 32-step wavetable prepared for resampling: the steps with their mean removed
+// and their running sum, prefix[i] = step[0] + ... + step[i - 1], which is periodic
+// because the steps sum to zero.
+struct WavetableSteps {
+    alignas(32) float step[32];
+    alignas(32) float prefix[32];
+
+    // Fills both arrays from a waveform's 32 4-bit samples.
+    void assign(const uint8_t* samples);
+};
+
+// Resamples a wavetable played at `increment` steps per output sample (32.27 fixed
+// point: bits 27-31 select the step, a period is 2^32) into `count` samples. Each
+// output sample is the mean of the waveform over the interval it covers, which is
+// exact for the step-shaped hardware output and keeps high notes from aliasing.
+// `phase` is advanced past the rendered samples.
+void render_wavetable(const WavetableSteps& wave, uint32_t& phase, uint64_t increment, float* out, size_t count);
+
+// Mixes `channels` mono buffers of `count` samples with per-channel left/right gains
+// into interleaved 16-bit stereo, saturating, appended at `out`.
+void mix_to_pcm16(const float* const* inputs, const float* gains_left, const float* gains_right, int channels,
+                  size_t count, int16_t* out);
+
+#endif // PCM_KERNELS_H
@@ -0,0 +1,294 @@
+#include "ResultCache.h"
+#include "Logger.h"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <system_error>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const uint64_t PRIME1 = 11400714785092282877ULL;
+const uint64_t PRIME2 = 14029467366897019727ULL;
+const uint64_t PRIME3 = 1609587929392839161ULL;
+const uint64_t PRIME4 = 9650029242287828579ULL;
+const uint64_t PRIME5 = 2870177450012600261ULL;
+
+// Entry file: "VWMC" version:u32 input_size:u64 input_hash:u64 options_hash:u64
+// expression_events_removed:u64 midi_size:u64, then the MIDI file.
+const size_t ENTRY_HEADER_SIZE = 48;
+const uint32_t ENTRY_FORMAT = 1;
+const char* const ENTRY_EXTENSION = ".vwc";
+
+inline uint64_t rotl(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+// Little-endian loads assembled byte by byte, like ByteSpan; compilers turn them
+// into single loads on little-endian hosts.
+inline uint64_t load_le64(const uint8_t* p) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; --i) value = (value << 8) | p[i];
+    return value;
+}
+
+inline uint32_t load_le32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+inline void store_le64(uint8_t* out, uint64_t value) {
+    for (int i = 0; i < 8; ++i) out[i] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+inline uint64_t round_step(uint64_t acc, uint64_t input) {
+    acc += input * PRIME2;
+    return rotl(acc, 31) * PRIME1;
+}
+
+inline uint64_t merge_round(uint64_t acc, uint64_t value) {
+    acc ^= round_step(0, value);
+    return acc * PRIME1 + PRIME4;
+}
+
+uint64_t file_age(const fs::directory_entry& entry) {
+    std::error_code ec;
+    auto time = entry.last_write_time(ec);
+    return ec ? 0 : static_cast<uint64_t>(time.time_since_epoch().count());
+}
+
+} // namespace
+
+uint64_t hash_bytes(ByteSpan data, uint64_t seed) {
+    const uint8_t* p = data.data();
+    size_t remaining = data.size();
+    uint64_t hash;
+
+    if (remaining >= 32) {
+        uint64_t v1 = seed + PRIME1 + PRIME2;
+        uint64_t v2 = seed + PRIME2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME1;
+        do {
+            v1 = round_step(v1, load_le64(p));
+            v2 = round_step(v2, load_le64(p + 8));
+            v3 = round_step(v3, load_le64(p + 16));
+            v4 = round_step(v4, load_le64(p + 24));
+            p += 32;
+            remaining -= 32;
+        } while (remaining >= 32);
+        hash = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        hash = merge_round(hash, v1);
+        hash = merge_round(hash, v2);
+        hash = merge_round(hash, v3);
+        hash = merge_round(hash, v4);
+    } else {
+        hash = seed + PRIME5;
+    }
+
+    hash += data.size();
+    for (; remaining >= 8; p += 8, remaining -= 8) {
+        hash ^= round_step(0, load_le64(p));
+        hash = rotl(hash, 27) * PRIME1 + PRIME4;
+    }
+    if (remaining >= 4) {
+        hash ^= load_le32(p) * PRIME1;
+        hash = rotl(hash, 23) * PRIME2 + PRIME3;
+        p += 4;
+        remaining -= 4;
+    }
+    for (; remaining > 0; ++p, --remaining) {
+        hash ^= *p * PRIME5;
+        hash = rotl(hash, 11) * PRIME1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+std::string CacheKey::file_name() const {
+    char name[40];
+    std::snprintf(name, sizeof(name), "%016llx%016llx", static_cast<unsigned long long>(input_hash),
+                  static_cast<unsigned long long>(options_hash ^ (input_size * PRIME3)));
+    return std::string(name) + ENTRY_EXTENSION;
+}
+
+ResultCache::ResultCache(const std::string& directory, uint64_t max_bytes)
+    : root(directory), max_bytes(max_bytes), hit_count(0), miss_count(0), temp_counter(0),
+      temp_token(std::random_device()()), total_bytes(0), clock(0) {}
+
+bool ResultCache::open() {
+    std::error_code ec;
+    fs::create_directories(root, ec);
+    if (!fs::is_directory(root, ec)) {
+        VGM_LOG_ERROR("cache directory %s is not usable", root.c_str());
+        return false;
+    }
+
+    // Index existing entries oldest first, so eviction continues where earlier runs left off.
+    std::vector<std::pair<uint64_t, fs::directory_entry>> found;
+    for (fs::directory_iterator it(root, ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->is_regular_file(ec) && it->path().extension() == ENTRY_EXTENSION) {
+            found.emplace_back(file_age(*it), *it);
+        }
+    }
+    std::sort(found.begin(), found.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& item : found) {
+        touch_locked(item.second.path().filename().string(), item.second.file_size(ec));
+    }
+    evict_locked();
+    VGM_LOG_INFO("cache %s: %zu entries, %llu bytes", root.c_str(), entries.size(),
+                 static_cast<unsigned long long>(total_bytes));
+    return true;
+}
+
+CacheKey ResultCache::make_key(ByteSpan input, const ConversionOptions& options) {
+    // Every option that changes the MIDI output must be listed here.
+    uint8_t fields[56] = {};
+    fields[0] = static_cast<uint8_t>(ENTRY_FORMAT);
+    fields[1] = static_cast<uint8_t>(CONVERTER_OUTPUT_VERSION);
+    fields[2] = options.midi.per_channel_tracks ? 1 : 0;
+    fields[3] = options.midi.running_status ? 1 : 0;
+    store_le64(fields + 8, static_cast<uint64_t>(options.midi.expression_thinning.max_value_error));
+    store_le64(fields + 16, options.midi.expression_thinning.min_spacing);
+    fields[7] = options.window.bounded ? 1 : 0;
+    store_le64(fields + 24, options.window.start);
+    store_le64(fields + 48, options.window.bounded ? options.window.end : 0);
+    fields[4] = options.loop.markers ? 1 : 0;
+    fields[5] = options.loop.stop_at_loop_end ? 1 : 0;
+    fields[6] = static_cast<uint8_t>(options.pitch_bend_range);
+    store_le64(fields + 32, options.loop.extra_loops);
+    store_le64(fields + 40, (static_cast<uint64_t>(options.midi.ppqn) << 32) | options.midi.tempo);
+
+    CacheKey key;
+    key.input_hash = hash_bytes(input);
+    key.input_size = input.size();
+    key.options_hash = hash_bytes(ByteSpan(fields, sizeof(fields)), CONVERTER_OUTPUT_VERSION);
+    return key;
+}
+
+bool ResultCache::lookup(const CacheKey& key, std::vector<uint8_t>& midi, size_t& expression_events_removed) {
+    std::string name = key.file_name();
+    fs::path path = fs::path(root) / name;
+
+    std::ifstream file(path, std::ios::binary);
+    uint8_t header[ENTRY_HEADER_SIZE];
+    bool valid = file && file.read(reinterpret_cast<char*>(header), sizeof(header)) &&
+                 header[0] == 'V' && header[1] == 'W' && header[2] == 'M' && header[3] == 'C' &&
+                 load_le32(header + 4) == ENTRY_FORMAT && load_le64(header + 8) == key.input_size &&
+                 load_le64(header + 16) == key.input_hash && load_le64(header + 24) == key.options_hash &&
+                 load_le64(header + 40) <= max_bytes;
+    if (valid) {
+        uint64_t size = load_le64(header + 40);
+        midi.resize(static_cast<size_t>(size));
+        valid = static_cast<bool>(file.read(reinterpret_cast<char*>(midi.data()), static_cast<std::streamsize>(size)));
+        expression_events_removed = static_cast<size_t>(load_le64(header + 32));
+    }
+    if (!valid) {
+        ++miss_count;
+        return false;
+    }
+    file.close();
+
+    // Persist the recency for later runs; a failure only makes eviction less precise.
+    std::error_code ec;
+    fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        touch_locked(name, ENTRY_HEADER_SIZE + midi.size());
+    }
+    ++hit_count;
+    VGM_LOG_DEBUG("cache hit %s", name.c_str());
+    return true;
+}
+
+void ResultCache::store(const CacheKey& key, const std::vector<uint8_t>& midi, size_t expression_events_removed) {
+    uint64_t size = ENTRY_HEADER_SIZE + midi.size();
+    if (size > max_bytes) return;
+
+    uint8_t header[ENTRY_HEADER_SIZE] = {'V', 'W', 'M', 'C'};
+    header[4] = static_cast<uint8_t>(ENTRY_FORMAT);
+    store_le64(header + 8, key.input_size);
+    store_le64(header + 16, key.input_hash);
+    store_le64(header + 24, key.options_hash);
+    store_le64(header + 32, expression_events_removed);
+    store_le64(header + 40, midi.size());
+
+    std::string name = key.file_name();
+    fs::path path = fs::path(root) / name;
+    fs::path temp = path;
+    temp += ".tmp" + std::to_string(temp_token) + "_" + std::to_string(++temp_counter);
+    {
+        std::ofstream file(temp, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(midi.data()), static_cast<std::streamsize>(midi.size()));
+        if (!file) {
+            file.close();
+            std::error_code ec;
+            fs::remove(temp, ec);
+            VGM_LOG_WARN("cannot write cache entry %s", name.c_str());
+            return;
+        }
+    }
+    std::error_code ec;
+    fs::rename(temp, path, ec);
+    if (ec) {
+        fs::remove(temp, ec);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    touch_locked(name, size);
+    evict_locked();
+}
+
+uint64_t ResultCache::size_bytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return total_bytes;
+}
+
+size_t ResultCache::entry_count() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+}
+
+void ResultCache::touch_locked(const std::string& name, uint64_t size) {
+    auto it = entries.find(name);
+    if (it == entries.end()) {
+        it = entries.emplace(name, Entry()).first;
+    } else {
+        by_age.erase(it->second.last_use);
+        total_bytes -= it->second.size;
+    }
+    it->second.size = size;
+    it->second.last_use = ++clock;
+    by_age.emplace(it->second.last_use, name);
+    total_bytes += size;
+}
+
+void ResultCache::forget_locked(const std::string& name) {
+    auto it = entries.find(name);
+    if (it == entries.end()) return;
+    by_age.erase(it->second.last_use);
+    total_bytes -= it->second.size;
+    entries.erase(it);
+}
+
+void ResultCache::evict_locked() {
+    while (total_bytes > max_bytes && !by_age.empty()) {
+        std::string name = by_age.begin()->second;
+        std::error_code ec;
+        fs::remove(fs::path(root) / name, ec);
+        forget_locked(name);
+        VGM_LOG_DEBUG("cache evicted %s", name.c_str());
+    }
+}
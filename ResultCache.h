@@ -0,0 +1,79 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ByteSpan.h"
+#include "Converter.h"
+
+// 64-bit XXH64 of `data`. Fast enough (several GB/s) to hash every input up front.
+uint64_t hash_bytes(ByteSpan data, uint64_t seed = 0);
+
+// Identifies one conversion: the input bytes, the options that shape the MIDI
+// output and CONVERTER_OUTPUT_VERSION.
+struct CacheKey {
+    uint64_t input_hash = 0;
+    uint64_t input_size = 0;
+    uint64_t options_hash = 0; // Includes the converter version
+
+    std::string file_name() const; // 32 hex digits plus ".vwc"
+};
+
+// On-disk, content-addressed store of finished MIDI files, one file per entry.
+// Entries are written to a temporary file and renamed into place, so concurrent
+// workers (and processes sharing the directory) never see a partial entry; a hit
+// refreshes the entry's modification time, which orders least-recently-used
+// eviction once the directory grows past max_bytes. Thread-safe.
+class ResultCache {
+public:
+    ResultCache(const std::string& directory, uint64_t max_bytes);
+    ResultCache(const ResultCache&) = delete;
+    ResultCache& operator=(const ResultCache&) = delete;
+
+    // Creates the directory if needed and indexes the entries already in it.
+    bool open();
+
+    static CacheKey make_key(ByteSpan input, const ConversionOptions& options);
+
+    // Copies a stored result into `midi` (reusing its capacity). Entries whose header
+    // does not match the key exactly are treated as misses.
+    bool lookup(const CacheKey& key, std::vector<uint8_t>& midi, size_t& expression_events_removed);
+    void store(const CacheKey& key, const std::vector<uint8_t>& midi, size_t expression_events_removed);
+
+    const std::string& directory() const { return root; }
+    uint64_t hits() const { return hit_count.load(); }
+    uint64_t misses() const { return miss_count.load(); }
+    uint64_t size_bytes() const;
+    size_t entry_count() const;
+
+private:
+    struct Entry {
+        uint64_t size = 0;     // On disk, header included
+        uint64_t last_use = 0; // Position in `by_age`
+    };
+
+    std::string root;
+    uint64_t max_bytes;
+    std::atomic<uint64_t> hit_count;
+    std::atomic<uint64_t> miss_count;
+    std::atomic<uint64_t> temp_counter;
+    uint32_t temp_token; // Keeps temporary names of processes sharing the directory apart
+
+    mutable std::mutex mutex; // Guards everything below
+    std::unordered_map<std::string, Entry> entries;
+    std::map<uint64_t, std::string> by_age; // Oldest first
+    uint64_t total_bytes;
+    uint64_t clock;
+
+    void touch_locked(const std::string& name, uint64_t size);
+    void forget_locked(const std::string& name);
+    void evict_locked();
+};
+
+#endif // RESULT_CACHE_H
@@ -0,0 +1,120 @@
+#include "SeekIndex.h"
+#include "ResultCache.h"
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
+namespace {
+
+// File: "VWSI" format:u32 input_size:u64 input_hash:u64 interval:u32 total_samples:u64
+// count:u32 register_bytes:u32 pitch_bend_range:u32, then per checkpoint: offset:u64
+// time:u64 dirty:u16 registers[register_bytes] last_note[16]:u8 last_velocity[16]:u8
+// note_velocity[16]:u8 expression[16]:u8 program[16]:u8 (0xFF stands for -1)
+// pitch_bend[16]:u16.
+const uint32_t INDEX_FORMAT = 6;
+const size_t INDEX_HEADER_SIZE = 48;
+const size_t TRACKING_SIZE = 7 * ChannelTrackingState::CHANNEL_COUNT;
+
+size_t checkpoint_size(size_t register_bytes) {
+    return 8 + 8 + 2 + register_bytes + TRACKING_SIZE;
+}
+
+void put_le(std::vector<uint8_t>& out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i) out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+uint64_t get_le(const uint8_t* in, int bytes) {
+    uint64_t value = 0;
+    for (int i = bytes - 1; i >= 0; --i) value = (value << 8) | in[i];
+    return value;
+}
+
+} // namespace
+
+bool SeekIndex::matches(ByteSpan input) const {
+    return input.size() == input_size && hash_bytes(input) == input_hash;
+}
+
+const SeekCheckpoint* SeekIndex::find(uint64_t sample) const {
+    auto it = std::upper_bound(checkpoints.begin(), checkpoints.end(), sample,
+                               [](uint64_t value, const SeekCheckpoint& checkpoint) { return value < checkpoint.chip.time; });
+    return it == checkpoints.begin() ? nullptr : &*(it - 1);
+}
+
+bool SeekIndex::save(const std::string& filename) const {
+    size_t register_bytes = checkpoints.empty() ? 0 : checkpoints[0].chip.registers.size();
+    std::vector<uint8_t> data;
+    data.reserve(INDEX_HEADER_SIZE + checkpoints.size() * checkpoint_size(register_bytes));
+    data.insert(data.end(), {'V', 'W', 'S', 'I'});
+    put_le(data, INDEX_FORMAT, 4);
+    put_le(data, input_size, 8);
+    put_le(data, input_hash, 8);
+    put_le(data, interval, 4);
+    put_le(data, total_samples, 8);
+    put_le(data, checkpoints.size(), 4);
+    put_le(data, register_bytes, 4);
+    put_le(data, pitch_bend_range, 4);
+    for (const auto& checkpoint : checkpoints) {
+        const ChipModelState& chip = checkpoint.chip;
+        put_le(data, checkpoint.offset, 8);
+        put_le(data, chip.time, 8);
+        put_le(data, chip.dirty_channels, 2);
+        data.insert(data.end(), chip.registers.begin(), chip.registers.end());
+        const ChannelTrackingState& channels = chip.channels;
+        for (const auto* values : {&channels.last_note, &channels.last_velocity, &channels.note_velocity, &channels.expression,
+                                   &channels.program}) {
+            for (int value : *values) data.push_back(static_cast<uint8_t>(value < 0 ? 0xFF : value));
+        }
+        for (int value : channels.pitch_bend) put_le(data, static_cast<uint16_t>(value), 2);
+    }
+
+    std::ofstream file(filename, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    return file.good();
+}
+
+bool SeekIndex::load(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) return false;
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    if (data.size() < INDEX_HEADER_SIZE || data[0] != 'V' || data[1] != 'W' || data[2] != 'S' || data[3] != 'I' ||
+        get_le(&data[4], 4) != INDEX_FORMAT) {
+        return false;
+    }
+    uint64_t count = get_le(&data[36], 4);
+    size_t register_bytes = static_cast<size_t>(get_le(&data[40], 4));
+    size_t size = checkpoint_size(register_bytes);
+    if (data.size() != INDEX_HEADER_SIZE + count * size) return false;
+
+    input_size = get_le(&data[8], 8);
+    input_hash = get_le(&data[16], 8);
+    interval = static_cast<uint32_t>(get_le(&data[24], 4));
+    total_samples = get_le(&data[28], 8);
+    pitch_bend_range = static_cast<uint32_t>(get_le(&data[44], 4));
+    checkpoints.assign(static_cast<size_t>(count), SeekCheckpoint());
+    const uint8_t* p = data.data() + INDEX_HEADER_SIZE;
+    for (auto& checkpoint : checkpoints) {
+        ChipModelState& chip = checkpoint.chip;
+        checkpoint.offset = get_le(p, 8);
+        chip.time = get_le(p + 8, 8);
+        chip.dirty_channels = static_cast<uint16_t>(get_le(p + 16, 2));
+        chip.registers.assign(p + 18, p + 18 + register_bytes);
+        chip.pitch_bend_range = static_cast<uint8_t>(pitch_bend_range);
+        const uint8_t* values = p + 18 + register_bytes;
+        ChannelTrackingState& channels = chip.channels;
+        for (auto* field : {&channels.last_note, &channels.last_velocity, &channels.note_velocity, &channels.expression,
+                            &channels.program}) {
+            for (int& value : *field) {
+                value = *values == 0xFF ? -1 : *values;
+                ++values;
+            }
+        }
+        for (int& value : channels.pitch_bend) {
+            value = static_cast<int>(get_le(values, 2));
+            values += 2;
+        }
+        p += size;
+    }
+    return true;
+}
@@ -0,0 +1,37 @@
+#ifndef SEEK_INDEX_H
+#define SEEK_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "ByteSpan.h"
+#include "ChipModel.h"
+
+// A restart point: the chip model state just before the command at `offset` runs.
+struct SeekCheckpoint {
+    uint64_t offset = 0; // Into the uncompressed VGM image
+    ChipModelState chip;
+};
+
+// Checkpoints at least `interval` samples apart, built by one pass over a VGM image
+// (VgmConverter::build_index) so that windowed conversions can start from the
+// nearest checkpoint instead of replaying the stream from its first command.
+// Tied to the exact input bytes through their size and hash.
+struct SeekIndex {
+    uint64_t input_size = 0;
+    uint64_t input_hash = 0;     // hash_bytes() of the input as stored (compressed for .vgz)
+    uint32_t interval = 0;       // Samples between checkpoints
+    uint64_t total_samples = 0;  // Length of the stream
+    uint32_t pitch_bend_range = 0; // Glide setting the checkpoints were tracked with
+    std::vector<SeekCheckpoint> checkpoints; // Ascending by chip.time
+
+    bool matches(ByteSpan input) const;
+    // Latest checkpoint at or before `sample`, or null if there is none.
+    const SeekCheckpoint* find(uint64_t sample) const;
+
+    bool save(const std::string& filename) const;
+    bool load(const std::string& filename);
+};
+
+#endif // SEEK_INDEX_H
@@ -0,0 +1,105 @@
+#ifndef SERVER_PROTOCOL_H
+#define SERVER_PROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include "ByteSpan.h"
+
+// Framing of the conversion server (converter --server), used on stdin/stdout and
+// on Unix domain sockets alike. All integers are little-endian.
+//
+//   Request:  "VWRQ" id:u32 type:u16 flags:u16 cc11_tolerance:u32 cc11_min_spacing:u32 size:u32
+//             followed by `size` bytes of VGM or VGZ data (none for a status request)
+//   Response: "VWRS" id:u32 status:u32 size:u32
+//             followed by `size` bytes: the MIDI file, an error message or the status JSON
+//
+// A connection may pipeline any number of requests. Conversions run concurrently,
+// so responses can arrive out of order; `id` is echoed to match them up.
+//
+// The header has no room for further options: the time base, glide, loop and window
+// options are given on the server's command line and apply to every request
+// (ServerOptions::conversion). The flags and CC#11 fields add to those defaults.
+
+const size_t REQUEST_HEADER_SIZE = 24;
+const size_t RESPONSE_HEADER_SIZE = 16;
+
+enum RequestType : uint16_t {
+    REQUEST_CONVERT = 0,
+    REQUEST_STATUS = 1, // Queue depth, counters and latency percentiles as JSON
+};
+
+enum RequestFlags : uint16_t {
+    FLAG_FORMAT1 = 0x0001,        // Same as --format1
+    FLAG_RUNNING_STATUS = 0x0002, // Same as --running-status
+};
+
+enum ResponseStatus : uint32_t {
+    STATUS_OK = 0,
+    STATUS_CONVERSION_FAILED = 1,
+    STATUS_BAD_REQUEST = 2, // The connection is closed after this response
+};
+
+struct RequestHeader {
+    uint32_t id = 0;
+    uint16_t type = REQUEST_CONVERT;
+    uint16_t flags = 0;
+    uint32_t cc11_tolerance = 0;
+    uint32_t cc11_min_spacing = 0;
+    uint32_t size = 0;
+};
+
+struct ResponseHeader {
+    uint32_t id = 0;
+    uint32_t status = STATUS_OK;
+    uint32_t size = 0;
+};
+
+namespace server_protocol_detail {
+
+inline void put_le16(uint8_t* out, uint16_t value) {
+    out[0] = static_cast<uint8_t>(value);
+    out[1] = static_cast<uint8_t>(value >> 8);
+}
+
+inline void put_le32(uint8_t* out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) out[i] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+inline bool has_magic(ByteSpan data, const char* magic) {
+    return data.size() >= 4 && data[0] == magic[0] && data[1] == magic[1] && data[2] == magic[2] && data[3] == magic[3];
+}
+
+} // namespace server_protocol_detail
+
+inline void encode_request_header(uint8_t* out, const RequestHeader& header) {
+    namespace d = server_protocol_detail;
+    out[0] = 'V'; out[1] = 'W'; out[2] = 'R'; out[3] = 'Q';
+    d::put_le32(out + 4, header.id);
+    d::put_le16(out + 8, header.type);
+    d::put_le16(out + 10, header.flags);
+    d::put_le32(out + 12, header.cc11_tolerance);
+    d::put_le32(out + 16, header.cc11_min_spacing);
+    d::put_le32(out + 20, header.size);
+}
+
+inline bool decode_request_header(ByteSpan data, RequestHeader& header) {
+    return server_protocol_detail::has_magic(data, "VWRQ") &&
+           data.read_le32(4, header.id) && data.read_le16(8, header.type) && data.read_le16(10, header.flags) &&
+           data.read_le32(12, header.cc11_tolerance) && data.read_le32(16, header.cc11_min_spacing) &&
+           data.read_le32(20, header.size);
+}
+
+inline void encode_response_header(uint8_t* out, const ResponseHeader& header) {
+    namespace d = server_protocol_detail;
+    out[0] = 'V'; out[1] = 'W'; out[2] = 'R'; out[3] = 'S';
+    d::put_le32(out + 4, header.id);
+    d::put_le32(out + 8, header.status);
+    d::put_le32(out + 12, header.size);
+}
+
+inline bool decode_response_header(ByteSpan data, ResponseHeader& header) {
+    return server_protocol_detail::has_magic(data, "VWRS") &&
+           data.read_le32(4, header.id) && data.read_le32(8, header.status) && data.read_le32(12, header.size);
+}
+
+#endif // SERVER_PROTOCOL_H
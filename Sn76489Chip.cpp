@@ -0,0 +1,87 @@
+#include "Sn76489Chip.h"
+#include <algorithm>
+
+namespace {
+
+const uint32_t DEFAULT_CLOCK = 3579545; // NTSC colour burst, as on the SMS, Game Gear and most arcade boards
+
+} // namespace
+
+Sn76489Chip::Sn76489Chip(const MidiMappingTables& mapping) : mapping(mapping), clock(0) {
+    set_clock(DEFAULT_CLOCK);
+    reset();
+}
+
+void Sn76489Chip::reset() {
+    registers.fill(0);
+    for (int i = 1; i < 8; i += 2) registers[i] = 0x0F; // Silent
+    latched = 0;
+    noise_restarted = false;
+}
+
+void Sn76489Chip::set_clock(uint32_t hz) {
+    hz &= 0x3FFFFFFF; // Bits 30/31 flag a second chip and the T6W28 variant
+    if (hz == 0 || hz == clock) return;
+    clock = hz;
+    // The table is rebuilt only when the clock changes, at the start of a stream.
+    pitch[0] = PitchEntry{};
+    for (int period = 1; period < 1024; ++period) {
+        pitch[period] = pitch_entry_for(clock / (32.0 * period), mapping.transpose);
+    }
+}
+
+void Sn76489Chip::save_registers(uint8_t* out) const {
+    for (int i = 0; i < 8; ++i) {
+        out[2 * i] = static_cast<uint8_t>(registers[i]);
+        out[2 * i + 1] = static_cast<uint8_t>(registers[i] >> 8);
+    }
+    out[16] = latched;
+    out[17] = noise_restarted ? 1 : 0;
+}
+
+void Sn76489Chip::load_registers(const uint8_t* in) {
+    for (int i = 0; i < 8; ++i) registers[i] = static_cast<uint16_t>(in[2 * i] | (in[2 * i + 1] << 8));
+    latched = in[16] & 0x07;
+    noise_restarted = in[17] != 0;
+}
+
+const char* Sn76489Chip::channel_name(int channel) {
+    static const char* const names[CHANNELS] = {"SN76489 Tone 1", "SN76489 Tone 2", "SN76489 Tone 3", "SN76489 Noise"};
+    return names[channel];
+}
+
+uint8_t Sn76489Chip::write_port(uint8_t, uint8_t value) {
+    // 1rrr dddd latches register r and sets its low four bits; 0-dddddd sets the high
+    // six bits of a latched tone period, or the whole value of any other register.
+    if (value & 0x80) latched = (value >> 4) & 0x07;
+    uint16_t& reg = registers[latched];
+    bool tone = (latched & 1) == 0 && latched < 6;
+    if (tone && !(value & 0x80)) reg = static_cast<uint16_t>((reg & 0x0F) | ((value & 0x3F) << 4));
+    else if (tone) reg = static_cast<uint16_t>((reg & 0x3F0) | (value & 0x0F));
+    else reg = value & 0x0F;
+
+    if (latched == 6) noise_restarted = true; // Any noise control write resets the shift register
+    uint8_t channel = static_cast<uint8_t>(1 << (latched >> 1));
+    // The noise channel can run at tone 3's rate.
+    return latched == 4 ? static_cast<uint8_t>(channel | 0x08) : channel;
+}
+
+ChannelOutput Sn76489Chip::evaluate(int channel) {
+    ChannelOutput output;
+    int attenuation = registers[2 * channel + 1] & 0x0F;
+    if (channel < 3) {
+        const PitchEntry& entry = pitch[registers[2 * channel] & 0x3FF];
+        output.note = entry.note;
+        output.cents = entry.cents;
+    } else {
+        int rate = registers[6] & 0x03;
+        int period = rate == 3 ? registers[4] & 0x3FF : 16 << rate;
+        output.note = std::min<int>(pitch[period].note, 127);
+        output.cents = pitch[period].cents;
+        output.retrigger = noise_restarted;
+        noise_restarted = false;
+    }
+    output.on = attenuation < 15;
+    output.velocity = mapping.velocity[15 - attenuation];
+    return output;
+}
@@ -0,0 +1,55 @@
+#ifndef SN76489_CHIP_H
+#define SN76489_CHIP_H
+
+#include "ChipBackend.h"
+#include "MidiMapping.h"
+#include "ConversionStats.h"
+#include <array>
+#include <cstdint>
+
+class WaveformCache;
+
+// SN76489 PSG backend (see ChipBackend.h), driven by 0x50 writes: three square wave
+// tone channels and a noise channel on MIDI channels 11-14. The pitch table is
+// built for the clock declared in the header (usually 3.579545 MHz).
+class Sn76489Chip {
+public:
+    static constexpr ChipId ID = ChipId::Sn76489;
+    static constexpr int CHANNELS = 4;
+    static constexpr std::array<uint8_t, CHANNELS> MIDI_CHANNELS = {10, 11, 12, 13};
+    // Registers 0-7 as 16-bit little-endian values, the latched register and whether
+    // the noise generator was restarted since the last evaluation.
+    static constexpr size_t REGISTER_BYTES = 18;
+    static constexpr bool ALWAYS_ACTIVE = false;
+    // Data bytes go to the register latched by an earlier write.
+    static constexpr bool SEGMENTABLE = false;
+    static constexpr bool TIMED = false;
+
+    explicit Sn76489Chip(const MidiMappingTables& mapping = DEFAULT_MIDI_MAPPING);
+    void reset();
+    void set_clock(uint32_t hz);
+    void set_stats(ConversionStats*) {} // No per-register counters
+    void set_waveform_cache(WaveformCache*) {} // Fixed square waves
+
+    // `reg` is unused: the chip has a single write port.
+    uint8_t write_port(uint8_t reg, uint8_t value);
+    ChannelOutput evaluate(int channel);
+
+    void save_registers(uint8_t* out) const;
+    void load_registers(const uint8_t* in);
+
+    static const char* channel_name(int channel);
+    static uint8_t default_program(int channel) { return channel == 3 ? 122 : 80; } // Seashore for noise, else Square Wave
+
+private:
+    const MidiMappingTables& mapping;
+    uint32_t clock;
+    std::array<PitchEntry, 1024> pitch; // Indexed by the 10-bit tone period
+    // Even registers: tone period of channel n/2 (noise control for 6); odd registers:
+    // attenuation of channel n/2, 15 = off.
+    std::array<uint16_t, 8> registers;
+    uint8_t latched;
+    bool noise_restarted;
+};
+
+#endif // SN76489_CHIP_H
@@ -0,0 +1,75 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+
+// Bounded lock-free queue between exactly one producer and one consumer thread.
+// It carries whole blocks (batches of commands or events) that live in the queue
+// and are filled and read in place, so nothing is copied or allocated per block.
+//
+//   producer: Block& b = queue.back(); fill b; queue.push(); ... queue.close();
+//   consumer: while (Block* b = queue.front()) { read *b; queue.pop(); }
+//
+// A side that finds the queue full (or empty) spins briefly, then yields, then
+// sleeps, so a stalled stage does not burn a core.
+template <typename Block, size_t Capacity>
+class SpscBlockQueue {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+    SpscBlockQueue() : head(0), tail(0), closed(false) {}
+    SpscBlockQueue(const SpscBlockQueue&) = delete;
+    SpscBlockQueue& operator=(const SpscBlockQueue&) = delete;
+
+    // Empties the queue for another run; neither side may be using it.
+    void reset() {
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+        closed.store(false, std::memory_order_relaxed);
+    }
+
+    // Producer: the next free block, waiting while the queue is full.
+    Block& back() {
+        size_t position = tail.load(std::memory_order_relaxed);
+        wait_while([&] { return position - head.load(std::memory_order_acquire) == Capacity; });
+        return slots[position & (Capacity - 1)];
+    }
+    // Producer: hands the block returned by back() to the consumer.
+    void push() { tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+    // Producer: no more blocks will follow.
+    void close() { closed.store(true, std::memory_order_release); }
+
+    // Consumer: the oldest block, waiting while the queue is empty; null once the
+    // producer has closed the queue and every block has been consumed.
+    Block* front() {
+        size_t position = head.load(std::memory_order_relaxed);
+        wait_while([&] {
+            return tail.load(std::memory_order_acquire) == position && !closed.load(std::memory_order_acquire);
+        });
+        if (tail.load(std::memory_order_acquire) == position) return nullptr;
+        return &slots[position & (Capacity - 1)];
+    }
+    // Consumer: returns the block from front() to the producer.
+    void pop() { head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+private:
+    std::array<Block, Capacity> slots;
+    alignas(64) std::atomic<size_t> head; // Next block to consume
+    alignas(64) std::atomic<size_t> tail; // Next block to fill
+    alignas(64) std::atomic<bool> closed;
+
+    template <typename Condition>
+    static void wait_while(Condition condition) {
+        for (unsigned attempt = 0; condition(); ++attempt) {
+            if (attempt < 64) continue;
+            if (attempt < 256) std::this_thread::yield();
+            else std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+};
+
+#endif // SPSC_QUEUE_H
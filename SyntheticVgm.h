@@ -0,0 +1,150 @@
+#ifndef SYNTHETIC_VGM_H
+#define SYNTHETIC_VGM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+// Deterministic VGM stream generator for the benchmark tools.
+// The same options always produce the same bytes: the stream is driven by a fixed
+// std::mt19937 seed, whose output sequence is specified by the standard.
+
+struct SyntheticVgmOptions {
+    size_t command_count = 1000000;
+    uint32_t seed = 12345;
+    bool foreign_chips = true; // SN76489, YM2612 (incl. 0x8n DAC waits), AY8910, DAC streams...
+    bool data_blocks = true;   // 0x67 blocks with a 64-byte payload
+};
+
+// One step of what the stream asks of the WonderSwan model, in stream order, so the chip
+// can be driven without the parser. `samples` > 0 is a wait, otherwise a port write, or
+// a RAM write if `memory` is set.
+struct SyntheticChipOp {
+    uint16_t samples;
+    uint16_t address; // Port, or RAM offset
+    uint8_t value;
+    bool memory;
+};
+
+struct SyntheticVgm {
+    std::vector<uint8_t> data;
+    std::vector<SyntheticChipOp> chip_ops;
+    size_t commands = 0;        // Including the final 0x66
+    size_t register_writes = 0; // 0xBC WonderSwan port writes
+    size_t memory_writes = 0;   // 0xC6 WonderSwan RAM writes
+    size_t waits = 0;           // 0x61, 0x62, 0x63, 0x7n and 0x8n
+    size_t data_blocks = 0;
+    size_t skipped = 0;         // Commands for chips the converter does not model
+    uint64_t samples = 0;       // Total stream length in 44.1 kHz samples
+};
+
+namespace synthetic_vgm_detail {
+
+inline void put_le32(std::vector<uint8_t>& out, size_t pos, uint32_t value) {
+    for (int i = 0; i < 4; ++i) out[pos + i] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+} // namespace synthetic_vgm_detail
+
+// Register writes follow the shape of real drivers (period low/high pairs in the
+// audible range, volume envelopes, channel switches), so that the chip model and the
+// MIDI encoder get a realistic share of note and controller events.
+inline SyntheticVgm make_synthetic_vgm(const SyntheticVgmOptions& options) {
+    SyntheticVgm vgm;
+    std::vector<uint8_t>& out = vgm.data;
+    out.assign(0x100, 0);
+    out[0] = 'V'; out[1] = 'g'; out[2] = 'm'; out[3] = ' ';
+    synthetic_vgm_detail::put_le32(out, 0x08, 0x171);
+    synthetic_vgm_detail::put_le32(out, 0x34, 0x100 - 0x34);
+
+    std::mt19937 rng(options.seed);
+    auto byte = [&]() { return static_cast<uint8_t>(rng() & 0xFF); };
+    auto write = [&](uint8_t port, uint8_t value) {
+        out.insert(out.end(), {0xBC, port, value});
+        vgm.chip_ops.push_back({0, port, value, false});
+        ++vgm.register_writes;
+    };
+    auto write_memory = [&](uint16_t offset, uint8_t value) {
+        out.insert(out.end(), {0xC6, static_cast<uint8_t>(offset >> 8), static_cast<uint8_t>(offset & 0xFF), value});
+        vgm.chip_ops.push_back({0, offset, value, true});
+        ++vgm.memory_writes;
+    };
+    auto wait = [&](uint16_t samples) {
+        if (samples > 0) vgm.chip_ops.push_back({samples, 0, 0, false});
+        vgm.samples += samples;
+        ++vgm.waits;
+    };
+
+    while (vgm.commands + 1 < options.command_count) {
+        unsigned pick = rng() % 100;
+        if (!options.foreign_chips && pick >= 36 && pick < 62) pick = 0;
+        if (!options.foreign_chips && pick >= 92 && pick < 98) pick = 62;
+        if (!options.data_blocks && pick >= 98) pick = 62;
+
+        if (pick < 36) {        // WonderSwan register write
+            uint8_t channel = static_cast<uint8_t>(rng() & 3);
+            unsigned kind = rng() % 20;
+            if (kind < 8 && vgm.commands + 2 < options.command_count) {
+                // New pitch: period low then high byte (two commands)
+                write(static_cast<uint8_t>(channel * 2), byte());
+                write(static_cast<uint8_t>(channel * 2 + 1), static_cast<uint8_t>(4 + rng() % 4));
+                ++vgm.commands;
+            } else if (kind < 17) {
+                write(static_cast<uint8_t>(0x08 + channel), byte());
+            } else {            // Channel switch, mostly all on
+                write(0x10, static_cast<uint8_t>((rng() % 4 == 0) ? (rng() & 0x0F) : 0x0F));
+            }
+        } else if (pick < 46) { // YM2612 port 0/1
+            out.insert(out.end(), {static_cast<uint8_t>(0x52 + (rng() & 1)), byte(), byte()});
+            ++vgm.skipped;
+        } else if (pick < 51) { // SN76489
+            out.insert(out.end(), {0x50, byte()});
+            ++vgm.skipped;
+        } else if (pick < 55) { // AY8910
+            out.insert(out.end(), {0xA0, byte(), byte()});
+            ++vgm.skipped;
+        } else if (pick < 58) { // WonderSwan memory write
+            uint16_t offset = byte();
+            offset = static_cast<uint16_t>((offset << 8) | byte());
+            write_memory(offset, byte());
+        } else if (pick < 60) { // DAC stream control
+            out.insert(out.end(), {0x93, 0x00, byte(), byte(), 0x00, 0x00, 0x01, byte(), byte(), 0x00, 0x00});
+            ++vgm.skipped;
+        } else if (pick < 62) { // PCM seek
+            out.insert(out.end(), {0xE0, byte(), byte(), 0x00, 0x00});
+            ++vgm.skipped;
+        } else if (pick < 82) { // Short waits
+            uint8_t n = static_cast<uint8_t>(rng() & 0x0F);
+            out.push_back(static_cast<uint8_t>(0x70 | n));
+            wait(static_cast<uint16_t>(n + 1));
+        } else if (pick < 88) {
+            uint16_t samples = static_cast<uint16_t>(1 + rng() % 2000);
+            out.insert(out.end(), {0x61, static_cast<uint8_t>(samples & 0xFF), static_cast<uint8_t>(samples >> 8)});
+            wait(samples);
+        } else if (pick < 91) {
+            out.push_back(0x62);
+            wait(735);
+        } else if (pick < 92) {
+            out.push_back(0x63);
+            wait(882);
+        } else if (pick < 98) { // YM2612 DAC write + wait
+            uint8_t n = static_cast<uint8_t>(rng() & 0x0F);
+            out.push_back(static_cast<uint8_t>(0x80 | n));
+            wait(n);
+        } else {                // Small data block
+            out.insert(out.end(), {0x67, 0x66, 0x00, 0x40, 0x00, 0x00, 0x00});
+            for (int k = 0; k < 0x40; ++k) out.push_back(byte());
+            ++vgm.data_blocks;
+        }
+        ++vgm.commands;
+    }
+
+    out.push_back(0x66);
+    ++vgm.commands;
+    synthetic_vgm_detail::put_le32(out, 0x04, static_cast<uint32_t>(out.size() - 4));
+    synthetic_vgm_detail::put_le32(out, 0x18, static_cast<uint32_t>(vgm.samples));
+    return vgm;
+}
+
+#endif // SYNTHETIC_VGM_H
@@ -0,0 +1,71 @@
+#ifndef VGM_COMMAND_TABLE_H
+#define VGM_COMMAND_TABLE_H
+
+#include <array>
+#include <cstdint>
+
+// How VgmReader reacts to an opcode once its bytes are available.
+enum class VgmHandler : uint8_t {
+    Skip,             // Fixed-length command for a chip we do not model
+    WaitWord,         // 0x61 nn nn: wait n samples
+    Wait735,          // 0x62: wait 1/60 second
+    Wait882,          // 0x63: wait 1/50 second
+    WaitShort,        // 0x7n: wait n+1 samples
+    WaitNibble,       // 0x8n: YM2612 DAC write from the data bank, then wait n samples
+    EndOfData,        // 0x66
+    DataBlock,        // 0x67 0x66 tt ss ss ss ss: variable length payload
+    WonderSwanPort,   // 0xBC aa dd
+    WonderSwanMemory, // 0xC6 mm ll dd: internal RAM write
+    DmgPort,          // 0xB3 aa dd
+    Sn76489Write,     // 0x50 dd
+};
+
+struct VgmOpcode {
+    uint8_t length;     // Total command length in bytes, including the opcode
+    VgmHandler handler;
+};
+
+// Command lengths as specified by VGM 1.71, including the reserved ranges whose
+// operand counts are fixed by the specification so that future chips stay skippable.
+constexpr std::array<VgmOpcode, 256> make_vgm_opcode_table() {
+    std::array<VgmOpcode, 256> table{};
+    for (int op = 0; op < 256; ++op) {
+        uint8_t length = 1;
+        if (op >= 0x30 && op <= 0x3F) length = 2;      // Reserved, one operand (0x30: second SN76489)
+        else if (op >= 0x40 && op <= 0x4E) length = 3; // Mikey / reserved, two operands
+        else if (op == 0x4F || op == 0x50) length = 2; // Game Gear stereo, SN76489
+        else if (op >= 0x51 && op <= 0x5F) length = 3; // YM2413 ... YMF278B, register/value
+        else if (op == 0x61) length = 3;
+        else if (op == 0x67) length = 7;               // Header only, payload size follows
+        else if (op == 0x68) length = 12;              // PCM RAM write
+        else if (op == 0x90 || op == 0x91 || op == 0x95) length = 5; // DAC stream setup/data/fast start
+        else if (op == 0x92) length = 6;               // DAC stream frequency
+        else if (op == 0x93) length = 11;              // DAC stream start
+        else if (op == 0x94) length = 2;               // DAC stream stop
+        else if (op >= 0xA0 && op <= 0xBF) length = 3; // AY8910 ... WonderSwan, two operands
+        else if (op >= 0xC0 && op <= 0xDF) length = 4; // Memory writes, three operands
+        else if (op >= 0xE0) length = 5;               // PCM seek, C352 and reserved, four operands
+        table[op] = {length, VgmHandler::Skip};
+    }
+
+    table[0x61].handler = VgmHandler::WaitWord;
+    table[0x62].handler = VgmHandler::Wait735;
+    table[0x63].handler = VgmHandler::Wait882;
+    table[0x66].handler = VgmHandler::EndOfData;
+    table[0x67].handler = VgmHandler::DataBlock;
+    for (int op = 0x70; op <= 0x7F; ++op) table[op].handler = VgmHandler::WaitShort;
+    for (int op = 0x80; op <= 0x8F; ++op) table[op].handler = VgmHandler::WaitNibble;
+    table[0x50].handler = VgmHandler::Sn76489Write;
+    table[0xB3].handler = VgmHandler::DmgPort;
+    table[0xBC].handler = VgmHandler::WonderSwanPort;
+    table[0xC6].handler = VgmHandler::WonderSwanMemory;
+    return table;
+}
+
+inline constexpr std::array<VgmOpcode, 256> VGM_OPCODES = make_vgm_opcode_table();
+
+static_assert(VGM_OPCODES[0x61].length == 3 && VGM_OPCODES[0x93].length == 11 &&
+              VGM_OPCODES[0xC6].length == 4 && VGM_OPCODES[0xE0].length == 5,
+              "VGM opcode table does not match the specification");
+
+#endif // VGM_COMMAND_TABLE_H
@@ -1,103 +1,759 @@
 #include "VgmReader.h"
+#include "MappedFile.h"
+#include "ResultCache.h"
+#include "SeekIndex.h"
+#include "VgmCommandTable.h"
+#include "WonderSwanRenderer.h"
+#include "Logger.h"
+#include <algorithm>
+#include <bitset>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <iomanip>
+#include <thread>
 
-VgmReader::VgmReader(WonderSwanChip& chip) : chip(chip) {}
+namespace {
 
-bool VgmReader::load_and_parse(const std::string& filename) {
-    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+// Starts the chip's loop at the first wait at or after the loop offset, and ends
+// the stream once the chip has stopped at the loop end. `base` is the absolute
+// offset of the chunk being parsed.
+template <typename Target>
+struct LoopHook {
+    Target& target;
+    size_t loop_offset;
+    uint32_t loop_samples;
+    size_t base;
+
+    bool operator()(size_t offset, uint32_t) {
+        if (loop_offset != 0 && base + offset >= loop_offset) {
+            target.mark_loop_start(loop_samples);
+            loop_offset = 0;
+        }
+        return !target.window_closed();
+    }
+};
+
+// Command target of the decoding thread in pipelined mode: batches the commands
+// into queue blocks for the chip thread, which reports through `stopped` once the
+// chip needs no more input.
+class CommandBatcher {
+public:
+    CommandBatcher(VgmCommandQueue& queue, const std::atomic<bool>& stopped)
+        : queue(queue), stopped(stopped), block(&queue.back()) {
+        block->count = 0;
+    }
+
+    template <ChipId Id>
+    void write(uint8_t port, uint8_t value) {
+        constexpr VgmCommand::Type type = Id == ChipId::WonderSwan ? VgmCommand::WonderSwanPort
+                                        : Id == ChipId::Dmg        ? VgmCommand::DmgPort
+                                                                   : VgmCommand::Sn76489Write;
+        add({type, port, value});
+    }
+    template <ChipId Id>
+    void write_memory(uint16_t offset, uint8_t value) {
+        static_assert(Id == ChipId::WonderSwan, "no memory writes for this chip");
+        add({VgmCommand::WonderSwanMemory, value, offset});
+    }
+    void advance_time(uint16_t samples) { add({VgmCommand::Wait, 0, samples}); }
+    // The chip thread takes the clocks from the reader, which the queue hands over
+    // along with this command.
+    void set_clocks(const VgmChipClocks&) { add({VgmCommand::Clocks, 0, 0}); }
+    // The chip thread takes the loop length from the header fields.
+    void mark_loop_start(uint32_t) { add({VgmCommand::LoopStart, 0, 0}); }
+    bool window_closed() const { return stopped.load(std::memory_order_relaxed); }
+
+    void close() {
+        if (block->count > 0) queue.push();
+        queue.close();
+    }
+
+private:
+    VgmCommandQueue& queue;
+    const std::atomic<bool>& stopped;
+    VgmCommandBlock* block;
+
+    void add(const VgmCommand& command) {
+        block->commands[block->count++] = command;
+        if (block->count == block->commands.size()) {
+            queue.push();
+            block = &queue.back();
+            block->count = 0;
+        }
+    }
+};
+
+// Segments of the parallel parser are at least this large, so that the work of
+// each one outweighs starting its thread and chip.
+const size_t MIN_SEGMENT_BYTES = 32 * 1024;
+
+struct Segment {
+    size_t begin = 0;       // First command; follows a wait of at least one sample
+    size_t end = 0;         // One past the last command
+    size_t loop_offset = 0; // The loop starts at this segment's first wait from here, 0 = not here
+};
+
+// First pass of the parallel parser over a segment (command target of
+// parse_commands): its length in samples, the last value it writes to every
+// register of the model's register file, and where the loop starts if it starts in
+// this segment.
+template <typename Model>
+struct SegmentScan {
+    uint64_t samples = 0;
+    std::vector<uint8_t> registers = std::vector<uint8_t>(Model::REGISTER_BYTES);
+    std::bitset<Model::REGISTER_BYTES> written;
+    int64_t loop_time = -1; // Samples into the segment
+    bool history = false;   // A write made the state depend on time, see ChipBackend.h
+
+    template <ChipId Id>
+    void write(uint8_t port, uint8_t value) {
+        if (Model::template starts_history<Id>(port, value)) history = true;
+        int index = Model::template register_index<Id>(port);
+        if (index < 0) return;
+        registers[index] = value;
+        written.set(index);
+    }
+    template <ChipId Id>
+    void write_memory(uint16_t offset, uint8_t value) {
+        int index = Model::template memory_index<Id>(offset);
+        if (index < 0) return;
+        registers[index] = value;
+        written.set(index);
+    }
+    void advance_time(uint16_t samples) { this->samples += samples; }
+    void set_clocks(const VgmChipClocks&) {}
+    void mark_loop_start(uint32_t) {
+        if (loop_time < 0) loop_time = samples;
+    }
+    bool window_closed() const { return false; }
+};
+
+// Pre-scan of the parallel parser: walks the command boundaries (lengths only, like
+// parse_commands without dispatching) and cuts the stream into about `count`
+// segments. Cuts are made right after a wait of at least one sample, where the chip
+// has just evaluated every pending write, so a segment's starting state follows from
+// the register file alone.
+void split_segments(ByteSpan data, size_t begin, size_t loop_offset, size_t count, std::vector<Segment>& segments) {
+    segments.assign(1, Segment());
+    segments[0].begin = begin;
+    size_t step = begin < data.size() ? std::max((data.size() - begin) / count, MIN_SEGMENT_BYTES) : MIN_SEGMENT_BYTES;
+    size_t next_cut = begin + step;
+    bool loop_pending = loop_offset != 0;
+
+    size_t pos = begin;
+    while (pos < data.size()) {
+        uint8_t command_byte = data[pos];
+        const VgmOpcode& opcode = VGM_OPCODES[command_byte];
+        if (!data.has(pos, opcode.length)) break;
+
+        uint32_t samples = 0;
+        bool wait = true;
+        switch (opcode.handler) {
+            case VgmHandler::WaitWord: samples = data[pos + 1] | (data[pos + 2] << 8); break;
+            case VgmHandler::Wait735: samples = 735; break;
+            case VgmHandler::Wait882: samples = 882; break;
+            case VgmHandler::WaitShort: samples = (command_byte & 0x0F) + 1; break;
+            case VgmHandler::WaitNibble:
+                samples = command_byte & 0x0F;
+                wait = samples != 0;
+                break;
+            case VgmHandler::EndOfData:
+                segments.back().end = pos + 1;
+                return;
+            case VgmHandler::DataBlock: {
+                uint32_t block_size = 0;
+                data.read_le32(pos + 3, block_size);
+                size_t block_end = opcode.length + static_cast<size_t>(block_size);
+                pos = block_end > data.size() - pos ? data.size() : pos + block_end;
+                continue;
+            }
+            default:
+                wait = false;
+                break;
+        }
+        if (wait && loop_pending && pos >= loop_offset) {
+            segments.back().loop_offset = loop_offset;
+            loop_pending = false;
+        }
+        pos += opcode.length;
+        if (samples > 0 && pos >= next_cut && pos < data.size()) {
+            segments.back().end = pos;
+            segments.emplace_back();
+            segments.back().begin = pos;
+            next_cut = pos + step;
+        }
+    }
+    segments.back().end = data.size();
+}
+
+// Runs fn(0) on the calling thread and fn(1) ... fn(count - 1) on their own threads.
+template <typename Fn>
+void run_segments(size_t count, Fn&& fn) {
+    std::vector<std::thread> threads;
+    threads.reserve(count - 1);
+    for (size_t i = 1; i < count; ++i) threads.emplace_back(fn, i);
+    fn(0);
+    for (auto& thread : threads) thread.join();
+}
+
+} // namespace
+
+template <typename Model>
+BasicVgmReader<Model>::BasicVgmReader(Model& chip)
+    : chip(chip), skip_remaining(0), loop_offset(0), loop_samples(0), clocks{}, finished(false), pipelined(false),
+      parse_threads(1), stats(nullptr) {}
+
+template <typename Model>
+bool BasicVgmReader<Model>::load_and_parse(const std::string& filename) {
+    MappedFile mapped;
+    bool is_mapped;
+    {
+        StatsTimer timer(stats ? &stats->load_ns : nullptr);
+        is_mapped = mapped.open(filename);
+        if (!is_mapped && !read_into_buffer(filename)) {
+            return false;
+        }
+    }
+    if (is_mapped) {
+        return parse(mapped.span());
+    }
+
+    bool ok = parse(ByteSpan(file_data));
+    file_data.clear();
+    file_data.shrink_to_fit();
+    return ok;
+}
+
+template <typename Model>
+bool BasicVgmReader<Model>::read_into_buffer(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
     if (!file) {
         std::cerr << "Cannot open file: " << filename << std::endl;
         return false;
     }
 
-    std::streamsize size = file.tellg();
-    file.seekg(0, std::ios::beg);
+    // Read in chunks so that pipes and other non-seekable inputs work too.
+    file_data.clear();
+    const size_t chunk_size = 64 * 1024;
+    while (file) {
+        size_t old_size = file_data.size();
+        file_data.resize(old_size + chunk_size);
+        file.read(reinterpret_cast<char*>(file_data.data() + old_size), chunk_size);
+        file_data.resize(old_size + static_cast<size_t>(file.gcount()));
+    }
 
-    file_data.resize(size);
-    if (!file.read(reinterpret_cast<char*>(file_data.data()), size)) {
+    if (file.bad()) {
         std::cerr << "Error reading file: " << filename << std::endl;
         return false;
     }
 
-    return parse();
+    return true;
+}
+
+template <typename Model>
+bool BasicVgmReader<Model>::parse(ByteSpan data) {
+    const LoopOptions& loops = chip.loop_settings();
+    if (parse_threads > 1 && !loops.stop_at_loop_end && loops.extra_loops == 0) return parse_parallel(data);
+    if (pipelined) return parse_pipelined(data);
+    StatsTimer timer(stats ? &stats->parse_ns : nullptr);
+    VGM_STATS(stats->input_bytes += data.size());
+    if (!parse_stream(data, chip)) {
+        return false;
+    }
+    chip.flush();
+    chip.finish_loops();
+    return true;
+}
+
+template <typename Model>
+template <typename Target>
+bool BasicVgmReader<Model>::parse_into(ByteSpan data, Target& target) {
+    StatsTimer timer(stats ? &stats->parse_ns : nullptr);
+    VGM_STATS(stats->input_bytes += data.size());
+    return parse_stream(data, target);
+}
+
+template <typename Model>
+bool BasicVgmReader<Model>::parse_pipelined(ByteSpan data) {
+    StatsTimer timer(stats ? &stats->parse_ns : nullptr);
+    VGM_STATS(stats->input_bytes += data.size());
+    if (!command_queue) command_queue.reset(new VgmCommandQueue());
+    command_queue->reset();
+    std::atomic<bool> stopped(false);
+    std::thread chip_thread([&] { run_chip(*command_queue, stopped); });
+
+    CommandBatcher batcher(*command_queue, stopped);
+    bool ok = parse_stream(data, batcher);
+    batcher.close();
+    chip_thread.join();
+    return ok;
+}
+
+// Chip stage of parse_pipelined(): applies the decoded commands exactly as
+// parse_commands() would have applied them to the chip directly.
+template <typename Model>
+void BasicVgmReader<Model>::run_chip(VgmCommandQueue& queue, std::atomic<bool>& stopped) {
+    bool done = false;
+    while (VgmCommandBlock* block = queue.front()) {
+        for (uint32_t i = 0; i < block->count && !done; ++i) {
+            const VgmCommand& command = block->commands[i];
+            switch (command.type) {
+                case VgmCommand::WonderSwanPort:
+                    chip.template write<ChipId::WonderSwan>(command.port, static_cast<uint8_t>(command.value));
+                    break;
+                case VgmCommand::WonderSwanMemory:
+                    chip.template write_memory<ChipId::WonderSwan>(command.value, command.port);
+                    break;
+                case VgmCommand::DmgPort:
+                    chip.template write<ChipId::Dmg>(command.port, static_cast<uint8_t>(command.value));
+                    break;
+                case VgmCommand::Sn76489Write:
+                    chip.template write<ChipId::Sn76489>(command.port, static_cast<uint8_t>(command.value));
+                    break;
+                case VgmCommand::Clocks:
+                    // Written by parse_header() on the decoding thread before this
+                    // command was queued.
+                    chip.set_clocks(clocks);
+                    break;
+                case VgmCommand::Wait:
+                    if (chip.window_closed()) {
+                        // The serial reader ends the stream at this wait.
+                        done = true;
+                        stopped.store(true, std::memory_order_relaxed);
+                    } else {
+                        chip.advance_time(command.value);
+                    }
+                    break;
+                case VgmCommand::LoopStart:
+                    chip.mark_loop_start(loop_samples);
+                    break;
+            }
+        }
+        queue.pop();
+    }
+    chip.flush();
+    chip.finish_loops();
+}
+
+// Parallel segmented parsing:
+//  1. split_segments() finds command boundaries and cuts the stream into segments.
+//  2. Each segment is scanned on its own thread for its length and register writes.
+//  3. A sequential pass reconciles the register file and start time of every segment
+//     boundary (and where the loop starts and ends).
+//  4. Each segment is parsed again on its own thread into a chip resumed from its
+//     boundary state; segment 0 runs on the real chip, the others collect their MIDI
+//     events in a private writer.
+//  5. The collected events are appended to the real writer in stream order, so the
+//     writer sees exactly the event sequence of a sequential parse.
+template <typename Model>
+bool BasicVgmReader<Model>::parse_parallel(ByteSpan data) {
+    StatsTimer timer(stats ? &stats->parse_ns : nullptr);
+    VGM_STATS(stats->input_bytes += data.size());
+    ByteSpan image;
+    size_t vgm_data_offset;
+    if (!uncompressed_image(data, image, vgm_data_offset)) {
+        return false;
+    }
+    auto parse_sequentially = [&] {
+        skip_remaining = vgm_data_offset;
+        finished = false;
+        LoopHook<Model> hook{chip, loop_offset, loop_samples, 0};
+        parse_commands(image, true, chip, hook);
+        chip.flush();
+        chip.finish_loops();
+        image_buffer.clear();
+        return true;
+    };
+    if (!chip.segmentable()) {
+        // A chip whose state is more than its last register values, or notes held
+        // across pitch changes in glide mode, cannot be resumed at a segment boundary.
+        VGM_LOG_DEBUG("parallel parse: channel state depends on more than the registers, parsing sequentially");
+        return parse_sequentially();
+    }
+
+    std::vector<Segment> segments;
+    split_segments(image, vgm_data_offset, loop_offset, parse_threads, segments);
+    size_t count = segments.size();
+    VGM_LOG_DEBUG("parallel parse: %zu segment(s) for %u thread(s)", count, parse_threads);
+
+    std::vector<SegmentScan<Model>> scans(count);
+    if (count > 1) {
+        run_segments(count, [&](size_t i) {
+            // The last segment's registers are not needed, but a sweep in it still
+            // makes the whole stream sequential.
+            BasicVgmReader scanner(chip);
+            scanner.skip_remaining = segments[i].begin;
+            LoopHook<SegmentScan<Model>> hook{scans[i], segments[i].loop_offset, loop_samples, 0};
+            scanner.parse_commands(image.subspan(0, segments[i].end), true, scans[i], hook);
+        });
+    }
+    if (std::any_of(scans.begin(), scans.end(), [](const SegmentScan<Model>& scan) { return scan.history; })) {
+        VGM_LOG_DEBUG("parallel parse: the stream uses a frequency sweep, parsing sequentially");
+        return parse_sequentially();
+    }
+
+    std::vector<uint64_t> start_times(count);
+    std::vector<std::vector<uint8_t>> start_registers(count);
+    ChipModelState state = chip.save_state();
+    uint64_t time = state.time;
+    std::vector<uint8_t> registers = state.registers;
+    size_t loop_segment = count;
+    uint64_t loop_start = 0;
+    for (size_t i = 0; i < count; ++i) {
+        start_times[i] = time;
+        start_registers[i] = registers;
+        if (segments[i].loop_offset != 0) {
+            loop_segment = i;
+            loop_start = time + static_cast<uint64_t>(std::max<int64_t>(scans[i].loop_time, 0));
+        }
+        time += scans[i].samples;
+        for (size_t r = 0; r < registers.size(); ++r) {
+            if (scans[i].written[r]) registers[r] = scans[i].registers[r];
+        }
+    }
+    uint64_t loop_end = loop_start + loop_samples;
+
+    std::vector<std::unique_ptr<MidiWriter>> writers(count);
+    std::vector<std::unique_ptr<Model>> chips(count);
+    std::vector<ConversionStats> segment_stats(count);
+    run_segments(count, [&](size_t i) {
+        Model* segment_chip = &chip;
+        BasicVgmReader* reader = this;
+        std::unique_ptr<BasicVgmReader> segment_reader;
+        if (i > 0) {
+            writers[i].reset(new MidiWriter(chip.output().settings())); // Same time base
+            chips[i].reset(new Model(*writers[i], chip.midi_mapping()));
+            chips[i]->set_clocks(clocks);
+            chips[i]->set_waveform_cache(chip.waveform_cache());
+            writers[i]->collect_events(); // After the chip's default program changes
+            segment_chip = chips[i].get();
+            segment_chip->set_loop_options(chip.loop_settings());
+            segment_chip->resume_from_registers(start_times[i], start_registers[i]);
+            if (i > loop_segment) segment_chip->resume_loop(loop_start, loop_end);
+            segment_reader.reset(new BasicVgmReader(*segment_chip));
+            reader = segment_reader.get();
+            if (stats) {
+                segment_chip->set_stats(&segment_stats[i]);
+                reader->set_stats(&segment_stats[i]);
+            }
+        }
+        reader->skip_remaining = segments[i].begin;
+        reader->finished = false;
+        LoopHook<Model> hook{*segment_chip, segments[i].loop_offset, loop_samples, 0};
+        reader->parse_commands(image.subspan(0, segments[i].end), true, *segment_chip, hook);
+        if (i + 1 == count) {
+            segment_chip->flush();
+            segment_chip->finish_loops();
+        }
+    });
+
+    // A segment does not know the programs of the notes before it and states them
+    // again; append_collected() drops those that are already in effect.
+    std::array<int, ChannelTrackingState::CHANNEL_COUNT> programs = chip.tracking().program;
+    for (size_t i = 1; i < count; ++i) {
+        chip.output().append_collected(*writers[i], programs);
+        VGM_STATS(stats->merge(segment_stats[i]));
+    }
+    if (count > 1) chip.restore_state(chips[count - 1]->save_state());
+    image_buffer.clear();
+    return true;
+}
+
+template <typename Model>
+template <typename Target>
+bool BasicVgmReader<Model>::parse_stream(ByteSpan data, Target& target) {
+    if (GzipInflater::is_gzip(data)) {
+        VGM_LOG_DEBUG("gzip-compressed input, %zu bytes", data.size());
+        return parse_gzip(data, target);
+    }
+
+    size_t vgm_data_offset;
+    if (!parse_header(data, vgm_data_offset)) {
+        return false;
+    }
+
+    VGM_STATS(stats->vgm_bytes += data.size());
+    target.set_clocks(clocks);
+    skip_remaining = vgm_data_offset;
+    finished = false;
+    LoopHook<Target> hook{target, loop_offset, loop_samples, 0};
+    parse_commands(data, true, target, hook);
+    return true;
+}
+
+template <typename Model>
+bool BasicVgmReader<Model>::uncompressed_image(ByteSpan data, ByteSpan& image, size_t& vgm_data_offset) {
+    image = data;
+    if (GzipInflater::is_gzip(data)) {
+        const size_t chunk_size = 64 * 1024;
+        inflater.reset(data);
+        image_buffer.clear();
+        for (;;) {
+            size_t filled = image_buffer.size();
+            image_buffer.resize(filled + chunk_size);
+            size_t produced = inflater.read(image_buffer.data() + filled, chunk_size);
+            image_buffer.resize(filled + produced);
+            if (produced == 0) break;
+        }
+        if (inflater.failed()) {
+            VGM_LOG_ERROR("inflate failed: %s", inflater.error_message());
+            std::cerr << "Invalid VGZ file: " << inflater.error_message() << "." << std::endl;
+            return false;
+        }
+        image = ByteSpan(image_buffer);
+    }
+    VGM_STATS(stats->vgm_bytes += image.size());
+    if (!parse_header(image, vgm_data_offset)) {
+        return false;
+    }
+    chip.set_clocks(clocks);
+    return true;
+}
+
+template <typename Model>
+bool BasicVgmReader<Model>::parse_window(ByteSpan data, const SeekIndex* index, const OutputWindow& window) {
+    StatsTimer timer(stats ? &stats->parse_ns : nullptr);
+    VGM_STATS(stats->input_bytes += data.size());
+    ByteSpan image;
+    size_t vgm_data_offset;
+    if (!uncompressed_image(data, image, vgm_data_offset)) {
+        return false;
+    }
+
+    skip_remaining = vgm_data_offset;
+    const SeekCheckpoint* checkpoint = (index && index->matches(data)) ? index->find(window.start) : nullptr;
+    if (checkpoint && checkpoint->offset >= vgm_data_offset && checkpoint->offset < image.size() &&
+        chip.restore_state(checkpoint->chip)) {
+        VGM_LOG_INFO("resuming at sample %llu (offset 0x%llx) for window start %llu",
+                     static_cast<unsigned long long>(checkpoint->chip.time),
+                     static_cast<unsigned long long>(checkpoint->offset), static_cast<unsigned long long>(window.start));
+        skip_remaining = static_cast<size_t>(checkpoint->offset);
+    } else if (index) {
+        VGM_LOG_WARN("seek index does not match the input, replaying from the start");
+    }
+
+    chip.set_window(window);
+    finished = false;
+    parse_commands(image, true, chip, [this](size_t, uint32_t) { return !chip.window_closed(); });
+    chip.flush();
+    image_buffer.clear();
+    return true;
+}
+
+template <typename Model>
+bool BasicVgmReader<Model>::build_index(ByteSpan data, uint32_t interval, SeekIndex& index) {
+    StatsTimer timer(stats ? &stats->parse_ns : nullptr);
+    ByteSpan image;
+    size_t vgm_data_offset;
+    if (!uncompressed_image(data, image, vgm_data_offset)) {
+        return false;
+    }
+
+    index.input_size = data.size();
+    index.input_hash = hash_bytes(data);
+    index.interval = interval > 0 ? interval : 1;
+    index.pitch_bend_range = chip.save_state().pitch_bend_range;
+    index.checkpoints.clear();
+
+    chip.track_only();
+    uint64_t next_checkpoint = 0;
+    skip_remaining = vgm_data_offset;
+    finished = false;
+    parse_commands(image, true, chip, [&](size_t offset, uint32_t) {
+        uint64_t now = chip.time();
+        if (now >= next_checkpoint) {
+            index.checkpoints.push_back({offset, chip.save_state()});
+            next_checkpoint = (now / index.interval + 1) * index.interval;
+        }
+        return true;
+    });
+    chip.flush();
+    index.total_samples = chip.time();
+    image_buffer.clear();
+    VGM_LOG_INFO("indexed %llu samples, %zu checkpoints", static_cast<unsigned long long>(index.total_samples),
+                 index.checkpoints.size());
+    return true;
 }
 
-bool VgmReader::parse() {
-    if (file_data.size() < 0x40) {
+template <typename Model>
+bool BasicVgmReader<Model>::parse_header(ByteSpan data, size_t& vgm_data_offset) {
+    if (data.size() < 0x40) {
         std::cerr << "Invalid VGM file: header too small." << std::endl;
         return false;
     }
 
-    if (file_data[0] != 'V' || file_data[1] != 'g' || file_data[2] != 'm' || file_data[3] != ' ') {
+    if (data[0] != 'V' || data[1] != 'g' || data[2] != 'm' || data[3] != ' ') {
         std::cerr << "Invalid VGM file: magic number mismatch." << std::endl;
         return false;
     }
 
-    uint32_t data_offset = *reinterpret_cast<uint32_t*>(&file_data[0x34]);
-    uint32_t vgm_data_offset = (data_offset == 0) ? 0x40 : (0x34 + data_offset);
+    uint32_t data_offset = 0;
+    data.read_le32(0x34, data_offset);
+    vgm_data_offset = (data_offset == 0) ? 0x40 : (0x34 + static_cast<size_t>(data_offset));
 
-    uint32_t current_pos = vgm_data_offset;
+    uint32_t relative_loop_offset = 0;
+    loop_samples = 0;
+    data.read_le32(0x1C, relative_loop_offset);
+    data.read_le32(0x20, loop_samples);
+    loop_offset = (relative_loop_offset == 0 || loop_samples == 0) ? 0 : 0x1C + static_cast<size_t>(relative_loop_offset);
+    if (loop_offset != 0) {
+        VGM_LOG_DEBUG("loop at 0x%zx, %u samples", loop_offset, loop_samples);
+    }
 
-    while (current_pos < file_data.size()) {
-        uint8_t command_byte = file_data[current_pos];
+    uint32_t version = 0;
+    data.read_le32(0x08, version);
 
-        switch (command_byte) {
-            case 0x61: { // Wait nnnn samples
-                if (current_pos + 2 >= file_data.size()) return true;
-                uint16_t wait = *reinterpret_cast<uint16_t*>(&file_data[current_pos + 1]);
-                chip.advance_time(wait);
-                current_pos += 3;
-                break;
+    // Chip clocks, where the header is long enough to hold them (SN76489 since 1.00,
+    // Game Boy DMG since 1.61, WonderSwan since 1.71).
+    const size_t clock_fields[VGM_CHIP_COUNT] = {0xC0, 0x80, 0x0C};
+    for (size_t i = 0; i < VGM_CHIP_COUNT; ++i) {
+        clocks[i] = 0;
+        if (clock_fields[i] + 4 <= vgm_data_offset) data.read_le32(clock_fields[i], clocks[i]);
+    }
+    VGM_LOG_DEBUG("VGM version %x.%02x, command data at 0x%zx", version >> 8, version & 0xFF, vgm_data_offset);
+    return true;
+}
+
+template <typename Model>
+template <typename Target>
+bool BasicVgmReader<Model>::parse_gzip(ByteSpan compressed, Target& target) {
+    // Commands are parsed as each decompressed chunk arrives; only the tail of a
+    // command cut by the chunk boundary is carried over into the next chunk.
+    const size_t chunk_size = 64 * 1024;
+    inflater.reset(compressed);
+    stream_buffer.resize(chunk_size);
+    size_t filled = 0;
+    bool header_parsed = false;
+    finished = false;
+    LoopHook<Target> hook{target, 0, 0, 0};
+
+    while (!finished) {
+        size_t produced = inflater.read(stream_buffer.data() + filled, stream_buffer.size() - filled);
+        if (inflater.failed()) {
+            VGM_LOG_ERROR("inflate failed: %s", inflater.error_message());
+            std::cerr << "Invalid VGZ file: " << inflater.error_message() << "." << std::endl;
+            return false;
+        }
+        filled += produced;
+        VGM_STATS(stats->vgm_bytes += produced);
+        bool end_of_input = (produced == 0);
+
+        if (!header_parsed) {
+            if (filled < 0x40 && !end_of_input) continue;
+            size_t vgm_data_offset;
+            if (!parse_header(ByteSpan(stream_buffer.data(), filled), vgm_data_offset)) {
+                return false;
             }
-            case 0x62: // Wait 1/60 second
-                chip.advance_time(735); // 44100 / 60
-                current_pos += 1;
+            target.set_clocks(clocks);
+            skip_remaining = vgm_data_offset;
+            hook.loop_offset = loop_offset;
+            hook.loop_samples = loop_samples;
+            header_parsed = true;
+        }
+
+        size_t used = parse_commands(ByteSpan(stream_buffer.data(), filled), end_of_input, target, hook);
+        std::memmove(stream_buffer.data(), stream_buffer.data() + used, filled - used);
+        filled -= used;
+        hook.base += used;
+
+        if (end_of_input) break;
+    }
+    return true;
+}
+
+template <typename Model>
+template <typename Target, typename WaitHook>
+size_t BasicVgmReader<Model>::parse_commands(ByteSpan data, bool end_of_input, Target& target, WaitHook&& before_wait) {
+    size_t current_pos = 0;
+    if (skip_remaining > 0) {
+        size_t skipped = skip_remaining < data.size() ? skip_remaining : data.size();
+        current_pos += skipped;
+        skip_remaining -= skipped;
+    }
+
+    // A command cut off by the end of the chunk is left for the next call; at the
+    // end of the input it simply terminates the stream.
+    auto incomplete = [&]() {
+        if (end_of_input) finished = true;
+        return current_pos;
+    };
+    auto wait = [&](uint16_t samples) {
+        if (before_wait(current_pos, samples)) target.advance_time(samples);
+        else finished = true;
+    };
+
+    while (!finished && current_pos < data.size()) {
+        uint8_t command_byte = data[current_pos];
+        const VgmOpcode& opcode = VGM_OPCODES[command_byte];
+        if (!data.has(current_pos, opcode.length)) return incomplete();
+        VGM_STATS(++stats->commands[command_byte]);
+        VGM_LOG_TRACE("command 0x%02X", command_byte);
+
+        switch (opcode.handler) {
+            case VgmHandler::WaitWord: // Wait nnnn samples
+                wait(static_cast<uint16_t>(data[current_pos + 1] | (data[current_pos + 2] << 8)));
                 break;
-            case 0x63: // Wait 1/50 second
-                chip.advance_time(882); // 44100 / 50
-                current_pos += 1;
+            case VgmHandler::Wait735: // Wait 1/60 second
+                wait(735); // 44100 / 60
                 break;
-            case 0x66: // End of sound data
-                return true;
-            
-            case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75:
-            case 0x76: case 0x77: case 0x78: case 0x79: case 0x7a: case 0x7b:
-            case 0x7c: case 0x7d: case 0x7e: case 0x7f:
-                chip.advance_time((command_byte & 0x0F) + 1);
-                current_pos += 1;
+            case VgmHandler::Wait882: // Wait 1/50 second
+                wait(882); // 44100 / 50
                 break;
-
-            case 0xb3: // WonderSwan I/O write
-            case 0xbc: { // WonderSwan Custom I/O write
-                if (current_pos + 2 >= file_data.size()) return true;
-                uint8_t port = file_data[current_pos + 1];
-                uint8_t value = file_data[current_pos + 2];
-                chip.write_port(port, value);
-                current_pos += 3;
+            case VgmHandler::WaitShort:
+                wait((command_byte & 0x0F) + 1);
                 break;
-            }
+            case VgmHandler::WaitNibble:
+                // YM2612 DAC write, we can ignore for WS but must keep its wait
+                if (command_byte & 0x0F) wait(command_byte & 0x0F);
+                break;
+            case VgmHandler::EndOfData:
+                VGM_LOG_DEBUG("end of sound data");
+                finished = true;
+                return current_pos + 1;
 
-            // Ignored commands
-            case 0x67: { // data block
-                if (current_pos + 6 >= file_data.size()) return true;
-                current_pos += 6 + (*reinterpret_cast<uint32_t*>(&file_data[current_pos + 2]));
+            case VgmHandler::WonderSwanPort:
+                target.template write<ChipId::WonderSwan>(data[current_pos + 1], data[current_pos + 2]);
                 break;
-            }
-            case 0x80: case 0x81: case 0x82: case 0x83: case 0x84: case 0x85:
-            case 0x86: case 0x87: case 0x88: case 0x89: case 0x8a: case 0x8b:
-            case 0x8c: case 0x8d: case 0x8e: case 0x8f:
-                // DAC stream, we can ignore for WS
-                current_pos += 3;
+            case VgmHandler::WonderSwanMemory:
+                target.template write_memory<ChipId::WonderSwan>(
+                    static_cast<uint16_t>((data[current_pos + 1] << 8) | data[current_pos + 2]), data[current_pos + 3]);
+                break;
+            case VgmHandler::DmgPort:
+                target.template write<ChipId::Dmg>(data[current_pos + 1], data[current_pos + 2]);
+                break;
+            case VgmHandler::Sn76489Write:
+                target.template write<ChipId::Sn76489>(0, data[current_pos + 1]);
                 break;
 
-            default:
-                // Unknown or unhandled command, just skip
-                current_pos++;
+            case VgmHandler::DataBlock: {
+                // 0x67 0x66 tt ss ss ss ss, followed by the payload
+                uint32_t block_size = 0;
+                data.read_le32(current_pos + 3, block_size);
+                VGM_STATS(stats->data_block_bytes += block_size);
+                VGM_LOG_DEBUG("data block type 0x%02X, %u bytes", data[current_pos + 2], block_size);
+                size_t block_end = opcode.length + static_cast<size_t>(block_size);
+                size_t available = data.size() - current_pos;
+                if (block_end > available) {
+                    // The payload continues in the following chunks.
+                    skip_remaining = block_end - available;
+                    return data.size();
+                }
+                current_pos += block_end;
+                continue;
+            }
+
+            case VgmHandler::Skip:
+                // Command for another chip, skipped by its specified length
+                VGM_STATS(stats->skipped_bytes += opcode.length);
                 break;
         }
+        current_pos += opcode.length;
     }
 
-    return true;
+    return current_pos;
 }
+
+template class BasicVgmReader<VgmChipModel>;
+template bool BasicVgmReader<VgmChipModel>::parse_into(ByteSpan, WonderSwanRenderer&);
@@ -1,20 +1,113 @@
 #ifndef VGM_READER_H
 #define VGM_READER_H
 
+#include <array>
+#include <atomic>
+#include <memory>
 #include <string>
 #include <vector>
 #include <cstdint>
-#include "WonderSwanChip.h"
+#include "ByteSpan.h"
+#include "GzipInflater.h"
+#include "ConversionStats.h"
+#include "ChipModel.h"
+#include "SpscQueue.h"
 
-class VgmReader {
+struct SeekIndex;
+
+// A decoded command on its way from the decoding to the chip thread (pipelined mode).
+struct VgmCommand {
+    // One write type per chip keeps the dispatch on the chip thread compile-time.
+    enum Type : uint8_t { WonderSwanPort, WonderSwanMemory, DmgPort, Sn76489Write, Wait, LoopStart, Clocks } type;
+    uint8_t port;   // Register, or the value of a memory write
+    uint16_t value; // Register value, memory offset or wait length in samples
+};
+
+struct VgmCommandBlock {
+    uint32_t count = 0;
+    std::array<VgmCommand, 4096> commands;
+};
+
+using VgmCommandQueue = SpscBlockQueue<VgmCommandBlock, 8>;
+
+// Parses a VGM stream into a chip model (ChipModel<Backends...>). Instantiated in
+// VgmReader.cpp for VgmChipModel; another backend set needs its own explicit
+// instantiation there.
+template <typename Model>
+class BasicVgmReader {
 public:
-    VgmReader(WonderSwanChip& chip);
+    BasicVgmReader(Model& chip);
+    // Maps the file read-only when possible and falls back to reading it into memory.
     bool load_and_parse(const std::string& filename);
+    // Parses a complete VGM image, or a gzip-compressed one (.vgz) which is inflated
+    // in bounded chunks while parsing. The bytes must stay valid for the call.
+    bool parse(ByteSpan data);
+    // Same result as parse(), but decoding (and inflating) the commands runs on the
+    // calling thread while the chip model consumes them on a second thread, fed in
+    // blocks through a lock-free queue. Combine with MidiWriter::start_encoder_thread()
+    // for a third stage.
+    bool parse_pipelined(ByteSpan data);
+    // Makes parse() and load_and_parse() use parse_pipelined().
+    void set_pipelined(bool pipelined) { this->pipelined = pipelined; }
+    // With more than one thread, parse() and load_and_parse() split a large stream into
+    // segments that are parsed and simulated concurrently, with the same result as
+    // the sequential parser (see parse_parallel()). Not combined with stopping at the
+    // loop end or unrolling loops, which need the whole history.
+    void set_parse_threads(unsigned threads) { parse_threads = threads; }
+    // Parses only as much as the output window needs: resumes from the latest
+    // checkpoint of `index` at or before the window start (when the index was built
+    // from these bytes) and stops once the window has closed. A .vgz image is inflated
+    // as a whole first, since checkpoints refer to offsets in the uncompressed stream.
+    bool parse_window(ByteSpan data, const SeekIndex* index, const OutputWindow& window);
+    // One pass over the whole stream without MIDI output, recording a chip state
+    // checkpoint before the first wait of every `interval` samples.
+    bool build_index(ByteSpan data, uint32_t interval, SeekIndex& index);
+    // Feeds a whole VGM/VGZ image to another command target than the chip model, such
+    // as WonderSwanRenderer. Each target type needs an explicit instantiation in
+    // VgmReader.cpp.
+    template <typename Target>
+    bool parse_into(ByteSpan data, Target& target);
+    // Counts commands and times loading/parsing into `stats` (may be null).
+    void set_stats(ConversionStats* stats) { this->stats = stats; }
 
 private:
-    WonderSwanChip& chip;
-    std::vector<uint8_t> file_data;
-    bool parse();
+    Model& chip;
+    std::vector<uint8_t> file_data;     // Fallback buffer for inputs that cannot be mapped
+    std::vector<uint8_t> stream_buffer; // Decompressed chunk buffer for .vgz input
+    std::vector<uint8_t> image_buffer;  // Whole decompressed .vgz image for seeking
+    GzipInflater inflater;              // Kept so its window is reused by later .vgz inputs
+    size_t skip_remaining;              // Bytes still to skip (header, data block payload)
+    size_t loop_offset;                 // Absolute offset of the loop start, 0 if the stream does not loop
+    uint32_t loop_samples;              // Length of one loop pass
+    VgmChipClocks clocks;               // Chip clocks declared by the header
+    bool finished;                      // End of sound data reached
+    bool pipelined;
+    unsigned parse_threads;
+    std::unique_ptr<VgmCommandQueue> command_queue; // Allocated by the first parse_pipelined()
+    ConversionStats* stats;
+
+    bool read_into_buffer(const std::string& filename);
+    bool parse_header(ByteSpan data, size_t& vgm_data_offset);
+    bool uncompressed_image(ByteSpan data, ByteSpan& image, size_t& vgm_data_offset);
+    void run_chip(VgmCommandQueue& queue, std::atomic<bool>& stopped);
+    bool parse_parallel(ByteSpan data);
+    // The commands go to `target`: the chip model itself, or the queue feeding the
+    // chip thread. It provides write<ChipId>(), advance_time(), set_clocks(),
+    // mark_loop_start() and window_closed() like ChipModel.
+    template <typename Target>
+    bool parse_stream(ByteSpan data, Target& target);
+    template <typename Target>
+    bool parse_gzip(ByteSpan compressed, Target& target);
+    // `before_wait(offset, samples)` runs ahead of every wait command and may end the
+    // stream by returning false.
+    template <typename Target, typename WaitHook>
+    size_t parse_commands(ByteSpan data, bool end_of_input, Target& target, WaitHook&& before_wait);
 };
 
+class WonderSwanRenderer;
+
+extern template class BasicVgmReader<VgmChipModel>;
+extern template bool BasicVgmReader<VgmChipModel>::parse_into(ByteSpan, WonderSwanRenderer&);
+using VgmReader = BasicVgmReader<VgmChipModel>;
+
 #endif // VGM_READER_H
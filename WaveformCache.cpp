@@ -0,0 +1,155 @@
+#include "WaveformCache.h"
+#include "ResultCache.h"
+#include "Logger.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+namespace {
+
+// File: "VWWC" format:u32 classifier_version:u32 count:u32, then per entry the 16
+// waveform bytes and the program:u8.
+const uint32_t CACHE_FORMAT = 1;
+const size_t CACHE_HEADER_SIZE = 16;
+const size_t ENTRY_SIZE = 17;
+
+const int SAMPLES = 32;
+const int HARMONICS = SAMPLES / 2;
+
+struct DftTable {
+    std::array<double, SAMPLES> cos;
+    std::array<double, SAMPLES> sin;
+};
+
+const DftTable& dft_table() {
+    static const DftTable table = [] {
+        DftTable t;
+        for (int n = 0; n < SAMPLES; ++n) {
+            double angle = 2.0 * 3.14159265358979323846 * n / SAMPLES;
+            t.cos[n] = std::cos(angle);
+            t.sin[n] = std::sin(angle);
+        }
+        return t;
+    }();
+    return table;
+}
+
+void put_le32(std::vector<uint8_t>& out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+uint32_t get_le32(const uint8_t* in) {
+    return static_cast<uint32_t>(in[0]) | (static_cast<uint32_t>(in[1]) << 8) |
+           (static_cast<uint32_t>(in[2]) << 16) | (static_cast<uint32_t>(in[3]) << 24);
+}
+
+} // namespace
+
+uint8_t classify_waveform(const Waveform& wave) {
+    double samples[SAMPLES];
+    double mean = 0.0;
+    for (int i = 0; i < SAMPLES; ++i) {
+        samples[i] = (wave[i / 2] >> (4 * (i & 1))) & 0x0F;
+        mean += samples[i];
+    }
+    mean /= SAMPLES;
+
+    // Power of harmonics 1-16 of the DC-free period; 32 points are few enough for
+    // the direct transform.
+    const DftTable& table = dft_table();
+    double power[HARMONICS + 1] = {};
+    double total = 0.0;
+    for (int h = 1; h <= HARMONICS; ++h) {
+        double re = 0.0, im = 0.0;
+        for (int n = 0; n < SAMPLES; ++n) {
+            int phase = (h * n) % SAMPLES;
+            re += (samples[n] - mean) * table.cos[phase];
+            im -= (samples[n] - mean) * table.sin[phase];
+        }
+        power[h] = re * re + im * im;
+        total += power[h];
+    }
+    if (total < 1e-9) return 80;
+
+    double even = 0.0, centroid = 0.0;
+    for (int h = 1; h <= HARMONICS; ++h) {
+        if (h % 2 == 0) even += power[h];
+        centroid += h * power[h];
+    }
+    double fundamental = power[1] / total;
+    even /= total;
+    centroid /= total;
+
+    if (fundamental >= 0.9) return 79; // Ocarina: sine and triangle
+    if (centroid >= 3.5) return 84;    // Lead 5 (charang): bright, thin pulses
+    if (even < 0.15) return 80;        // Lead 1 (square): odd harmonics
+    if (fundamental < 0.4) return 85;  // Lead 6 (voice): energy in the upper partials
+    return 81;                         // Lead 2 (sawtooth)
+}
+
+size_t WaveformCache::WaveformHash::operator()(const Waveform& wave) const {
+    return static_cast<size_t>(hash_bytes(ByteSpan(wave.data(), wave.size())));
+}
+
+uint8_t WaveformCache::program_for(const Waveform& wave) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = programs.find(wave);
+        if (it != programs.end()) return it->second;
+    }
+    // Classified outside the lock; two threads meeting the same new waveform both
+    // compute the same program.
+    uint8_t program = classify_waveform(wave);
+    std::lock_guard<std::mutex> lock(mutex);
+    programs.emplace(wave, program);
+    return program;
+}
+
+size_t WaveformCache::size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return programs.size();
+}
+
+bool WaveformCache::load(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) return false;
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    if (data.size() < CACHE_HEADER_SIZE || data[0] != 'V' || data[1] != 'W' || data[2] != 'W' || data[3] != 'C' ||
+        get_le32(&data[4]) != CACHE_FORMAT || get_le32(&data[8]) != WAVEFORM_CLASSIFIER_VERSION) {
+        VGM_LOG_WARN("waveform cache %s has another format or classifier version, ignored", filename.c_str());
+        return false;
+    }
+    size_t count = get_le32(&data[12]);
+    if (data.size() != CACHE_HEADER_SIZE + count * ENTRY_SIZE) return false;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    const uint8_t* p = data.data() + CACHE_HEADER_SIZE;
+    for (size_t i = 0; i < count; ++i, p += ENTRY_SIZE) {
+        Waveform wave;
+        std::copy(p, p + wave.size(), wave.begin());
+        programs.emplace(wave, static_cast<uint8_t>(p[wave.size()] & 0x7F));
+    }
+    VGM_LOG_INFO("waveform cache %s: %zu entries", filename.c_str(), count);
+    return true;
+}
+
+bool WaveformCache::save(const std::string& filename) const {
+    std::vector<uint8_t> data;
+    std::lock_guard<std::mutex> lock(mutex);
+    data.reserve(CACHE_HEADER_SIZE + programs.size() * ENTRY_SIZE);
+    data.insert(data.end(), {'V', 'W', 'W', 'C'});
+    put_le32(data, CACHE_FORMAT);
+    put_le32(data, WAVEFORM_CLASSIFIER_VERSION);
+    put_le32(data, static_cast<uint32_t>(programs.size()));
+    for (const auto& entry : programs) {
+        data.insert(data.end(), entry.first.begin(), entry.first.end());
+        data.push_back(entry.second);
+    }
+
+    std::ofstream file(filename, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    return file.good();
+}
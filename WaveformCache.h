@@ -0,0 +1,52 @@
+#ifndef WAVEFORM_CACHE_H
+#define WAVEFORM_CACHE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// One period of a wavetable channel: 32 4-bit samples, two per byte, the earlier
+// sample in the low nibble (the WonderSwan layout; Game Boy wave RAM is converted).
+using Waveform = std::array<uint8_t, 16>;
+
+// Bump whenever classify_waveform() changes; cache files of other versions are ignored.
+const uint32_t WAVEFORM_CLASSIFIER_VERSION = 1;
+
+// GM program (0-indexed) whose timbre is closest to `wave`, from the share of the
+// fundamental, of the even harmonics and the spectral centroid of its harmonics:
+// near-sine waves map to Ocarina (79), odd-only spectra to Square Lead (80), full
+// spectra to Sawtooth Lead (81), formant-like spectra with a weak fundamental to
+// Voice Lead (85) and bright ones to Charang (84). A flat waveform is silent whatever
+// the program and keeps the default Square Lead.
+uint8_t classify_waveform(const Waveform& wave);
+
+// Memo of classify_waveform() keyed on the waveform bytes, so a waveform seen before
+// (in this conversion, an earlier one or, through load()/save(), an earlier run) costs
+// one hash lookup. Thread-safe: one cache can serve every worker of a batch.
+class WaveformCache {
+public:
+    WaveformCache() = default;
+    WaveformCache(const WaveformCache&) = delete;
+    WaveformCache& operator=(const WaveformCache&) = delete;
+
+    uint8_t program_for(const Waveform& wave);
+    size_t size() const;
+
+    // Adds the entries of a file written by save(); fails on a missing file or one
+    // written by another classifier version.
+    bool load(const std::string& filename);
+    bool save(const std::string& filename) const;
+
+private:
+    struct WaveformHash {
+        size_t operator()(const Waveform& wave) const;
+    };
+
+    mutable std::mutex mutex;
+    std::unordered_map<Waveform, uint8_t, WaveformHash> programs;
+};
+
+#endif // WAVEFORM_CACHE_H
@@ -1,151 +1,219 @@
 #include "WonderSwanChip.h"
-#include <cmath>
-#include <iostream>
-#include <fstream>
-#include <iomanip>
-
-// Conversion factor from VGM samples (at 44100 Hz) to MIDI ticks (at 480 PPQN, 120 BPM)
-const double SAMPLES_TO_TICKS = (480.0 * 120.0) / (44100.0 * 60.0);
-
-WonderSwanChip::WonderSwanChip(MidiWriter& midi_writer)
-    : midi_writer(midi_writer),
-      io_ram(256, 0),
-      channel_periods(4, 0),
-      channel_volumes_left(4, 0),
-      channel_volumes_right(4, 0),
-      channel_enabled(4, false),
-      channel_last_note(4, 0),
-      channel_last_velocity(4, -1), // Initialize with -1 to force initial CC message
-      current_time(0) {
-    log_file.open("vgm_ws_to_mid/debug_output.txt", std::ios::out | std::ios::trunc);
-    if (!log_file.is_open()) {
-        std::cerr << "Failed to open vgm_ws_to_mid/debug_output.txt for writing." << std::endl;
-    }
+#include <algorithm>
+#include <cstdint>
+
+namespace {
+
+// Sweep timing in 1/147 clocks of the 3.072 MHz system clock, where one 44100 Hz
+// sample is exactly 10240 units and a sweep step (0x8D + 1) * 8192 * 147 units.
+const uint32_t SWEEP_UNITS_PER_SAMPLE = 10240;
+const uint32_t SWEEP_UNITS_PER_STEP = 8192 * 147;
+
+const int VOICE_NOTE = 60; // Voice samples have no pitch of their own: middle C
+
+// GM percussion key for channel 4's noise rate (3.072 MHz / (2048 - period)).
+int noise_drum(int period) {
+    if (period >= 1984) return 42; // Above 48 kHz: Closed Hi-Hat
+    if (period >= 1792) return 38; // Above 12 kHz: Acoustic Snare
+    return 36;                     // Bass Drum 1
+}
+
+} // namespace
 
-    // Set default instrument to Square Wave (GM 81) for all channels
+WonderSwanChip::WonderSwanChip(const MidiMappingTables& mapping)
+    : mapping(mapping), sweep_timer(0), wave_changed(0x0F), wave_cache(nullptr), stats(nullptr) {
+    reset();
+}
+
+void WonderSwanChip::reset() {
+    io_ram.fill(0);
+    sweep_timer = 0;
+    ram.fill(0);
+    decode_registers();
+}
+
+void WonderSwanChip::save_registers(uint8_t* out) const {
+    std::copy(io_ram.begin(), io_ram.end(), out);
+    for (int i = 0; i < 4; ++i) out[io_ram.size() + i] = static_cast<uint8_t>(sweep_timer >> (8 * i));
+    std::copy(ram.begin(), ram.end(), out + io_ram.size() + 4);
+}
+
+void WonderSwanChip::load_registers(const uint8_t* in) {
+    std::copy(in, in + io_ram.size(), io_ram.begin());
+    sweep_timer = 0;
+    for (int i = 3; i >= 0; --i) sweep_timer = (sweep_timer << 8) | in[io_ram.size() + i];
+    std::copy(in + io_ram.size() + 4, in + io_ram.size() + 4 + ram.size(), ram.begin());
+    decode_registers();
+}
+
+const char* WonderSwanChip::channel_name(int channel) {
+    static const char* const names[CHANNELS] = {"WonderSwan Ch1", "WonderSwan Ch2", "WonderSwan Ch3", "WonderSwan Ch4",
+                                                "WonderSwan Ch2 Voice", "WonderSwan Ch4 Noise"};
+    return names[channel];
+}
+
+// Rebuilds the per-channel fields that write_port() derives from the register file.
+void WonderSwanChip::decode_registers() {
     for (int i = 0; i < 4; ++i) {
-        midi_writer.add_program_change(i, 80, 0); // GM uses 0-indexed programs, so 80 is Square Wave
+        channel_periods[i] = ((io_ram[0x81 + 2 * i] & 0x07) << 8) | io_ram[0x80 + 2 * i];
+        channel_volumes_left[i] = (io_ram[0x88 + i] >> 4) & 0x0F;
+        channel_volumes_right[i] = io_ram[0x88 + i] & 0x0F;
+        channel_enabled[i] = (io_ram[0x90] & (1 << i)) != 0;
     }
+    // The waveforms are classified again on the next evaluation; a cache hit at most.
+    waveforms.fill(Waveform{});
+    programs.fill(classify_waveform(Waveform{}));
+    wave_changed = 0x0F;
 }
 
-WonderSwanChip::~WonderSwanChip() {
-    if (log_file.is_open()) {
-        log_file.close();
+// Program of tone channel `channel` for its current waveform; only waveforms that
+// differ from the last one of the channel are looked up.
+uint8_t WonderSwanChip::channel_program(int channel) {
+    if (wave_changed & (1 << channel)) {
+        wave_changed &= ~(1 << channel);
+        size_t base = (size_t(io_ram[0x8F]) << 6) + 16 * channel;
+        Waveform wave;
+        std::copy(ram.begin() + base, ram.begin() + base + wave.size(), wave.begin());
+        if (wave != waveforms[channel]) {
+            waveforms[channel] = wave;
+            programs[channel] = wave_cache ? wave_cache->program_for(wave) : classify_waveform(wave);
+        }
     }
+    return programs[channel];
 }
 
-void WonderSwanChip::advance_time(uint16_t samples) {
-    current_time += samples;
-}
+ChannelOutput WonderSwanChip::evaluate(int channel) {
+    ChannelOutput output;
+    uint8_t control = io_ram[0x90];
+    if (channel == 4) {
+        // 0x94: bit 1/0 right channel at full/half volume, bit 3/2 left channel.
+        uint8_t voice = io_ram[0x94];
+        int level = (voice & 0x0A) ? 15 : (voice & 0x05) ? 8 : 0;
+        output.on = channel_enabled[1] && (control & 0x20) && level > 0;
+        output.note = VOICE_NOTE;
+        output.velocity = mapping.velocity[level];
+        return output;
+    }
 
-void WonderSwanChip::check_state_and_update_midi(int channel) {
-    bool is_on = channel_enabled[channel] && (channel_volumes_left[channel] > 0 || channel_volumes_right[channel] > 0);
-    int current_note_pitch = period_to_midi_note(channel_periods[channel]);
-    
-    // Apply a non-linear curve to map volume for better dynamics and audibility.
-    int vgm_vol = std::max(channel_volumes_left[channel], channel_volumes_right[channel]);
-    double normalized_vol = vgm_vol / 15.0;
-    // A power of ~0.3 provides a more aggressive boost to lower volumes.
-    double curved_vol = pow(normalized_vol, 0.3); 
-    int velocity = static_cast<int>(curved_vol * 127.0);
-    if (velocity > 127) velocity = 127;
-
-    int last_note = channel_last_note[channel];
-    bool was_on = last_note > 0;
-
-    uint32_t midi_time = static_cast<uint32_t>(current_time * SAMPLES_TO_TICKS);
-
-    if (is_on && !was_on) {
-        midi_writer.add_note_on(channel, current_note_pitch, velocity, midi_time);
-        channel_last_note[channel] = current_note_pitch;
-        channel_last_velocity[channel] = velocity;
-    } else if (!is_on && was_on) {
-        midi_writer.add_note_off(channel, last_note, midi_time);
-        channel_last_note[channel] = 0;
-        channel_last_velocity[channel] = -1;
-    } else if (is_on && was_on) {
-        // Note is currently on, check for changes
-        if (current_note_pitch != last_note) {
-            // Pitch change (legato)
-            midi_writer.add_note_off(channel, last_note, midi_time);
-            midi_writer.add_note_on(channel, current_note_pitch, velocity, midi_time);
-            channel_last_note[channel] = current_note_pitch;
-            channel_last_velocity[channel] = velocity;
-        } else if (velocity != channel_last_velocity[channel]) {
-            // Volume change (software envelope)
-            // Use CC#11 (Expression) for dynamic volume changes, which is more standard than CC#7.
-            midi_writer.add_control_change(channel, 11, velocity, midi_time); // CC 11 is Expression
-            channel_last_velocity[channel] = velocity;
-        }
+    // Channel 4's noise plays through the tone channel's volume.
+    int hardware = channel == 5 ? 3 : channel;
+    bool audible = channel_enabled[hardware] && (channel_volumes_left[hardware] > 0 || channel_volumes_right[hardware] > 0);
+    // Map volume through the profile's non-linear curve for better dynamics and audibility.
+    int vgm_vol = std::max(channel_volumes_left[hardware], channel_volumes_right[hardware]);
+    output.velocity = mapping.velocity[vgm_vol];
+    if (channel == 5) {
+        output.on = audible && (control & 0x80) && (io_ram[0x8E] & 0x10);
+        output.note = noise_drum(channel_periods[3]);
+        output.retrigger = (io_ram[0x8E] & 0x08) != 0;
+        io_ram[0x8E] &= ~0x08; // The LFSR reset bit clears itself
+        return output;
     }
+
+    // Channels 2 and 4 are silent as tone channels while in voice or noise mode.
+    bool special_mode = (channel == 1 && (control & 0x20)) || (channel == 3 && (control & 0x80));
+    output.on = audible && !special_mode;
+    output.note = period_to_midi_note(channel_periods[channel]);
+    output.cents = mapping.pitch[channel_periods[channel]].cents; // Periods are 11 bits
+    output.program = channel_program(channel);
+    return output;
+}
+
+uint8_t WonderSwanChip::advance(uint32_t samples) {
+    if ((io_ram[0x90] & 0x40) == 0) return 0;
+    // Sweep steps completed by the end of the wait, computed at once rather than
+    // stepped, so a long wait costs the same as a short one.
+    uint64_t step = uint64_t((io_ram[0x8D] & 0x1F) + 1) * SWEEP_UNITS_PER_STEP;
+    uint64_t elapsed = sweep_timer + uint64_t(samples) * SWEEP_UNITS_PER_SAMPLE;
+    uint64_t steps = elapsed / step;
+    sweep_timer = static_cast<uint32_t>(elapsed % step);
+    int8_t amount = static_cast<int8_t>(io_ram[0x8C]);
+    if (steps == 0 || amount == 0) return 0;
+
+    // The period register wraps around like the hardware's 11-bit adder.
+    int64_t delta = static_cast<int64_t>(steps % 2048) * amount;
+    int period = static_cast<int>((channel_periods[2] + delta) & 0x7FF);
+    if (period == channel_periods[2]) return 0;
+    channel_periods[2] = period;
+    io_ram[0x84] = static_cast<uint8_t>(period);
+    io_ram[0x85] = static_cast<uint8_t>((io_ram[0x85] & 0xF8) | (period >> 8));
+    return 0x04;
 }
 
-void WonderSwanChip::write_port(uint8_t port, uint8_t value) {
+uint8_t WonderSwanChip::write_port(uint8_t port, uint8_t value) {
     uint8_t addr = port + 0x80;
+    uint8_t previous = io_ram[addr];
     io_ram[addr] = value;
+    VGM_STATS(++stats->port_writes[addr]);
 
     switch (addr) {
         case 0x80: case 0x81:
             channel_periods[0] = ((io_ram[0x81] & 0x07) << 8) | io_ram[0x80];
-            check_state_and_update_midi(0);
-            break;
+            return 0x01;
         case 0x82: case 0x83:
             channel_periods[1] = ((io_ram[0x83] & 0x07) << 8) | io_ram[0x82];
-            check_state_and_update_midi(1);
-            break;
+            return 0x02;
         case 0x84: case 0x85:
             channel_periods[2] = ((io_ram[0x85] & 0x07) << 8) | io_ram[0x84];
-            check_state_and_update_midi(2);
-            break;
+            return 0x04;
         case 0x86: case 0x87:
             channel_periods[3] = ((io_ram[0x87] & 0x07) << 8) | io_ram[0x86];
-            check_state_and_update_midi(3);
-            break;
+            return 0x28;
         case 0x88:
             channel_volumes_left[0] = (io_ram[0x88] >> 4) & 0x0F;
             channel_volumes_right[0] = io_ram[0x88] & 0x0F;
-            check_state_and_update_midi(0);
-            break;
+            return 0x01;
         case 0x89:
             channel_volumes_left[1] = (io_ram[0x89] >> 4) & 0x0F;
             channel_volumes_right[1] = io_ram[0x89] & 0x0F;
-            check_state_and_update_midi(1);
-            break;
+            // In voice mode this is the next PCM sample, which is not followed note by note.
+            return (io_ram[0x90] & 0x20) ? 0 : 0x02;
         case 0x8A:
             channel_volumes_left[2] = (io_ram[0x8A] >> 4) & 0x0F;
             channel_volumes_right[2] = io_ram[0x8A] & 0x0F;
-            check_state_and_update_midi(2);
-            break;
+            return 0x04;
         case 0x8B:
             channel_volumes_left[3] = (io_ram[0x8B] >> 4) & 0x0F;
             channel_volumes_right[3] = io_ram[0x8B] & 0x0F;
-            check_state_and_update_midi(3);
-            break;
+            return 0x28;
+        case 0x8D:
+            sweep_timer = 0;
+            return 0;
+        case 0x8E:
+            return 0x20;
+        case 0x8F:
+            wave_changed = 0x0F;
+            return value != previous ? 0x0F : 0;
         case 0x90:
             channel_enabled[0] = (io_ram[0x90] & 0x01) != 0;
             channel_enabled[1] = (io_ram[0x90] & 0x02) != 0;
             channel_enabled[2] = (io_ram[0x90] & 0x04) != 0;
             channel_enabled[3] = (io_ram[0x90] & 0x08) != 0;
-            for (int i = 0; i < 4; ++i) {
-                check_state_and_update_midi(i);
-            }
-            break;
+            if ((value & 0x40) && !(previous & 0x40)) sweep_timer = 0; // Sweep starts counting
+            return 0x3F;
         case 0x91:
-            for (int i = 0; i < 4; ++i) {
-                check_state_and_update_midi(i);
-            }
-            break;
+            return 0x0F;
+        case 0x94:
+            return 0x10;
     }
+    return 0;
+}
+
+uint8_t WonderSwanChip::write_memory(uint16_t offset, uint8_t value) {
+    offset &= RAM_BYTES - 1;
+    if (ram[offset] == value) return 0;
+    ram[offset] = value;
+    // Only the 64 bytes at the wavetable base are heard.
+    size_t relative = offset - (size_t(io_ram[0x8F]) << 6);
+    if (relative >= 64) return 0;
+    uint8_t channel = static_cast<uint8_t>(1 << (relative / 16));
+    wave_changed |= channel;
+    return channel;
 }
 
-int WonderSwanChip::period_to_midi_note(int period) {
+int WonderSwanChip::period_to_midi_note(int period) const {
     if (period >= 2048) return 0;
 
-    double freq = (3072000.0 / (2048.0 - period)) / 32.0;
-    if (freq <= 0) return 0;
-    
-    // The pitch is now at its original calculated octave.
-    int note = static_cast<int>(round(69 + 12 * log2(freq / 440.0)));
-    
-    return note;
+    // freq = (3072000 / (2048 - period)) / 32, note = round(69 + 12 * log2(freq / 440)),
+    // precomputed for every period in MidiMapping.h.
+    return mapping.pitch[period].note;
 }
@@ -1,32 +1,97 @@
 #ifndef WONDERSWAN_CHIP_H
 #define WONDERSWAN_CHIP_H
 
-#include "MidiWriter.h"
+#include "ChipBackend.h"
+#include "MidiMapping.h"
+#include "ConversionStats.h"
+#include "WaveformCache.h"
+#include <array>
 #include <cstdint>
-#include <vector>
-#include <fstream>
 
+// WonderSwan sound backend (see ChipBackend.h): four wavetable channels, driven by
+// 0xBC writes to the I/O ports 0x80-0x94. Channels 1-4 play on MIDI channels 1-4.
+// The special modes of channels 2-4 are modelled as well:
+//  - Channel 2 in voice mode (0x90 bit 5) plays the 8-bit samples written to 0x89 at
+//    the voice volume of 0x94. It is routed to MIDI channel 9 as a fixed note; the
+//    sample writes themselves produce no events.
+//  - Channel 3's frequency sweep (0x90 bit 6) adds the signed 0x8C to its period
+//    every (0x8D + 1) * 8192 clocks. advance() works out the period at the end of a
+//    wait in one step, and the channel is re-evaluated once per wait.
+//  - Channel 4 in noise mode (0x90 bit 7, LFSR enabled by 0x8E bit 4) plays on the
+//    GM percussion channel (MIDI channel 10), its rate selecting the drum; an LFSR
+//    reset (0x8E bit 3) restarts the hit.
+// The 16 KiB of internal RAM written by 0xC6 commands is modelled too: the
+// wavetables of the tone channels live at 0x8F * 64, channel n's 16 bytes at offset
+// 16 * n. A channel whose waveform changes (a RAM write into it, or a new 0x8F) is
+// re-evaluated, and a waveform it has not played before is classified into a GM
+// program (WaveformCache.h), so the channel's instrument follows its timbre.
 class WonderSwanChip {
 public:
-    WonderSwanChip(MidiWriter& midi_writer);
-    ~WonderSwanChip();
-    void write_port(uint8_t port, uint8_t value);
-    void advance_time(uint16_t samples);
+    static constexpr ChipId ID = ChipId::WonderSwan;
+    // 0-3: channels 1-4 as tone channels, 4: channel 2 in voice mode, 5: channel 4 in
+    // noise mode.
+    static constexpr int CHANNELS = 6;
+    static constexpr std::array<uint8_t, CHANNELS> MIDI_CHANNELS = {0, 1, 2, 3, 8, 9};
+    // The I/O space, indexed by address, the sweep timer (u32, in 1/147 clocks), then
+    // the internal RAM.
+    static constexpr size_t RAM_BYTES = 0x4000;
+    static constexpr size_t REGISTER_BYTES = 256 + 4 + RAM_BYTES;
+    // The converter was written for this chip and always assumed it.
+    static constexpr bool ALWAYS_ACTIVE = true;
+    // Everything but a running sweep follows from the last register writes.
+    static constexpr bool SEGMENTABLE = true;
+    static constexpr bool TIMED = true;
+
+    // `mapping` selects the pitch/velocity profile, see MidiMapping.h.
+    explicit WonderSwanChip(const MidiMappingTables& mapping = DEFAULT_MIDI_MAPPING);
+    void reset();
+    void set_clock(uint32_t) {} // The pitch table assumes the 3.072 MHz system clock
+    // Counts register writes per I/O address into `stats` (may be null).
+    void set_stats(ConversionStats* stats) { this->stats = stats; }
+    // Shared memo of the waveform classification; null classifies every new waveform.
+    void set_waveform_cache(WaveformCache* cache) { wave_cache = cache; }
+
+    uint8_t write_port(uint8_t port, uint8_t value);
+    // `offset` into the internal RAM (0xC6 mm ll dd: offset mmll, value dd).
+    uint8_t write_memory(uint16_t offset, uint8_t value);
+    uint8_t advance(uint32_t samples);
+    ChannelOutput evaluate(int channel);
+
+    void save_registers(uint8_t* out) const;
+    void load_registers(const uint8_t* in);
+    static int register_index(uint8_t port) { return static_cast<uint8_t>(port + 0x80); }
+    static int memory_index(uint16_t offset) { return static_cast<int>(256 + 4 + (offset & (RAM_BYTES - 1))); }
+    // A non-zero sweep step moves channel 3's period over time, and an enabled sweep
+    // runs its timer (which the register writes alone do not give) even at step 0.
+    static bool starts_history(uint8_t port, uint8_t value) {
+        return (port == 0x0C && value != 0) || (port == 0x10 && (value & 0x40));
+    }
+
+    static const char* channel_name(int channel);
+    // GM uses 0-indexed programs, so 80 is Square Wave and 54 Synth Voice; the
+    // percussion channel gets the standard kit.
+    static uint8_t default_program(int channel) { return channel == 4 ? 54 : channel == 5 ? 0 : 80; }
 
 private:
-    MidiWriter& midi_writer;
-    std::vector<uint8_t> io_ram;
-    std::vector<int> channel_periods;
-    std::vector<int> channel_volumes_left;
-    std::vector<int> channel_volumes_right;
-    std::vector<bool> channel_enabled;
-    std::vector<int> channel_last_note;
-    std::vector<int> channel_last_velocity; // For volume dynamics
-    uint32_t current_time;
-    std::ofstream log_file;
-
-    int period_to_midi_note(int period);
-    void check_state_and_update_midi(int channel);
+    const MidiMappingTables& mapping;
+    std::array<uint8_t, 256> io_ram;
+    std::array<int, 4> channel_periods; // Hardware channels 1-4
+    std::array<int, 4> channel_volumes_left;
+    std::array<int, 4> channel_volumes_right;
+    std::array<bool, 4> channel_enabled;
+    uint32_t sweep_timer; // Time since the last sweep step
+    std::array<uint8_t, RAM_BYTES> ram;
+    // Tone channels: the waveform last classified and its program; bit n of
+    // `wave_changed`: channel n's waveform may differ from `waveforms[n]`.
+    std::array<Waveform, 4> waveforms;
+    std::array<uint8_t, 4> programs;
+    uint8_t wave_changed;
+    WaveformCache* wave_cache;
+    ConversionStats* stats;
+
+    void decode_registers();
+    uint8_t channel_program(int channel);
+    int period_to_midi_note(int period) const;
 };
 
 #endif // WONDERSWAN_CHIP_H
@@ -0,0 +1,198 @@
+#include "WonderSwanRenderer.h"
+#include <algorithm>
+#include <fstream>
+
+namespace {
+
+const uint64_t SYSTEM_CLOCK = 3072000;
+// Full scale of one channel: a +-7.5 swing at volume 15 gives +-7200, so the four
+// channels together stay below the 16-bit limit.
+const float OUTPUT_SCALE = 64.0f;
+// Voice samples are centered and scaled to the +-8 swing of a wavetable.
+const float VOICE_SCALE = 1.0f / 16.0f;
+
+const uint32_t SWEEP_UNITS_PER_SAMPLE = 10240;
+const uint32_t SWEEP_UNITS_PER_STEP = 8192 * 147;
+
+// Second feedback tap of the noise LFSR (the first is bit 7) for 0x8E bits 0-2.
+const int NOISE_TAPS[8] = {14, 10, 13, 4, 8, 6, 9, 11};
+
+// Wavetable steps per output sample in 32.27 fixed point, see render_wavetable().
+uint64_t step_increment(int period) {
+    return (SYSTEM_CLOCK << 27) / (uint64_t(WonderSwanRenderer::SAMPLE_RATE) * uint64_t(2048 - period));
+}
+
+void put_le(std::vector<uint8_t>& out, uint32_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i) out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+} // namespace
+
+WonderSwanRenderer::WonderSwanRenderer() : keep_pcm(true) {
+    reset();
+}
+
+void WonderSwanRenderer::reset() {
+    io_ram.fill(0);
+    ram.fill(0);
+    phases.fill(0);
+    wave_dirty = 0x0F;
+    lfsr = 0;
+    noise_phase = 0;
+    sweep_timer = 0;
+    rendered = 0;
+    pcm_samples.clear();
+}
+
+void WonderSwanRenderer::write_port(uint8_t port, uint8_t value) {
+    uint8_t addr = port + 0x80;
+    uint8_t previous = io_ram[addr];
+    io_ram[addr] = value;
+    switch (addr) {
+        case 0x8D:
+            sweep_timer = 0;
+            break;
+        case 0x8E:
+            if (value & 0x08) lfsr = 0; // LFSR reset, the bit clears itself
+            io_ram[0x8E] &= ~0x08;
+            break;
+        case 0x8F:
+            if (value != previous) wave_dirty = 0x0F;
+            break;
+        case 0x90:
+            if ((value & 0x40) && !(previous & 0x40)) sweep_timer = 0;
+            break;
+    }
+}
+
+void WonderSwanRenderer::write_ram(uint16_t offset, uint8_t value) {
+    offset &= ram.size() - 1;
+    ram[offset] = value;
+    size_t relative = offset - (size_t(io_ram[0x8F]) << 6);
+    if (relative < 64) wave_dirty |= static_cast<uint8_t>(1 << (relative / 16));
+}
+
+void WonderSwanRenderer::advance_time(uint16_t samples) {
+    size_t remaining = samples;
+    while (remaining > 0) {
+        size_t count = std::min(remaining, BLOCK);
+        bool sweeping = (io_ram[0x90] & 0x40) != 0;
+        uint32_t step = ((io_ram[0x8D] & 0x1F) + 1) * SWEEP_UNITS_PER_STEP;
+        if (sweeping) {
+            // End the block on the sample that completes the next sweep step.
+            uint32_t until_step = (step - sweep_timer + SWEEP_UNITS_PER_SAMPLE - 1) / SWEEP_UNITS_PER_SAMPLE;
+            count = std::min<size_t>(count, std::max<uint32_t>(until_step, 1));
+        }
+        render_block(count);
+        remaining -= count;
+        if (!sweeping) continue;
+
+        sweep_timer += static_cast<uint32_t>(count) * SWEEP_UNITS_PER_SAMPLE;
+        if (sweep_timer >= step) {
+            sweep_timer -= step;
+            int next = (period(2) + static_cast<int8_t>(io_ram[0x8C])) & 0x7FF;
+            io_ram[0x84] = static_cast<uint8_t>(next);
+            io_ram[0x85] = static_cast<uint8_t>((io_ram[0x85] & 0xF8) | (next >> 8));
+        }
+    }
+}
+
+void WonderSwanRenderer::render_block(size_t count) {
+    uint8_t control = io_ram[0x90];
+    float left[CHANNELS], right[CHANNELS], levels[CHANNELS];
+    const float* inputs[CHANNELS];
+    for (int channel = 0; channel < CHANNELS; ++channel) {
+        float* out = buffers[channel];
+        inputs[channel] = out;
+        uint8_t volume = io_ram[0x88 + channel];
+        left[channel] = ((volume >> 4) & 0x0F) * OUTPUT_SCALE;
+        right[channel] = (volume & 0x0F) * OUTPUT_SCALE;
+
+        bool voice = channel == 1 && (control & 0x20);
+        if (voice) {
+            // 0x94: bit 3/2 left channel at full/half volume, bit 1/0 right channel.
+            uint8_t voice_volume = io_ram[0x94];
+            left[channel] = (voice_volume & 0x08) ? 15 * OUTPUT_SCALE : (voice_volume & 0x04) ? 7.5f * OUTPUT_SCALE : 0;
+            right[channel] = (voice_volume & 0x02) ? 15 * OUTPUT_SCALE : (voice_volume & 0x01) ? 7.5f * OUTPUT_SCALE : 0;
+        }
+        if (!(control & (1 << channel)) || (left[channel] == 0 && right[channel] == 0)) {
+            // Silent channels are not rendered; their phase stands still meanwhile.
+            left[channel] = right[channel] = 0;
+            std::fill(out, out + count, 0.0f);
+        } else if (voice) {
+            std::fill(out, out + count, (int(io_ram[0x89]) - 128) * VOICE_SCALE);
+        } else if (channel == 3 && (control & 0x80)) {
+            render_noise(step_increment(period(3)), out, count);
+        } else {
+            if (wave_dirty & (1 << channel)) {
+                wave_dirty &= ~(1 << channel);
+                const uint8_t* table = ram.data() + (size_t(io_ram[0x8F]) << 6) + 16 * channel;
+                uint8_t samples[32];
+                for (int i = 0; i < 32; ++i) samples[i] = (table[i / 2] >> (4 * (i & 1))) & 0x0F;
+                waves[channel].assign(samples);
+            }
+            render_wavetable(waves[channel], phases[channel], step_increment(period(channel)), out, count);
+        }
+        levels[channel] = (left[channel] + right[channel]) * 0.5f;
+    }
+
+    if (channel_sink) channel_sink(rendered, inputs, levels, count);
+    int16_t* out = mix_buffer.data();
+    if (keep_pcm) {
+        pcm_samples.resize(pcm_samples.size() + 2 * count);
+        out = pcm_samples.data() + pcm_samples.size() - 2 * count;
+    }
+    mix_to_pcm16(inputs, left, right, CHANNELS, count, out);
+    rendered += count;
+}
+
+// Each output sample is the mean LFSR output over the steps taken during it, the
+// current output if none was.
+void WonderSwanRenderer::render_noise(uint64_t increment, float* out, size_t count) {
+    uint8_t control = io_ram[0x8E];
+    if (!(control & 0x10)) {
+        std::fill(out, out + count, 0.0f); // LFSR stopped: a constant level, silent
+        return;
+    }
+    int tap = NOISE_TAPS[control & 0x07];
+    uint64_t phase = noise_phase;
+    for (size_t i = 0; i < count; ++i) {
+        phase += increment;
+        uint64_t steps = phase >> 27;
+        phase &= 0x07FFFFFF;
+        int high = 0;
+        for (uint64_t s = 0; s < steps; ++s) {
+            int feedback = 1 ^ (((lfsr >> 7) ^ (lfsr >> tap)) & 1);
+            lfsr = static_cast<uint16_t>(((lfsr << 1) | feedback) & 0x7FFF);
+            high += lfsr & 1;
+        }
+        float level = steps ? float(high) / float(steps) : float(lfsr & 1);
+        out[i] = (level - 0.5f) * 15.0f;
+    }
+    noise_phase = static_cast<uint32_t>(phase);
+}
+
+bool WonderSwanRenderer::write_wav(const std::string& filename) const {
+    uint32_t data_bytes = static_cast<uint32_t>(pcm_samples.size() * 2);
+    std::vector<uint8_t> header;
+    header.insert(header.end(), {'R', 'I', 'F', 'F'});
+    put_le(header, 36 + data_bytes, 4);
+    header.insert(header.end(), {'W', 'A', 'V', 'E', 'f', 'm', 't', ' '});
+    put_le(header, 16, 4);
+    put_le(header, 1, 2); // PCM
+    put_le(header, 2, 2); // Stereo
+    put_le(header, SAMPLE_RATE, 4);
+    put_le(header, SAMPLE_RATE * 4, 4); // Bytes per second
+    put_le(header, 4, 2);               // Bytes per frame
+    put_le(header, 16, 2);              // Bits per sample
+    header.insert(header.end(), {'d', 'a', 't', 'a'});
+    put_le(header, data_bytes, 4);
+
+    std::ofstream file(filename, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(header.data()), header.size());
+    std::vector<uint8_t> data;
+    data.reserve(data_bytes);
+    for (int16_t sample : pcm_samples) put_le(data, static_cast<uint16_t>(sample), 2);
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    return file.good();
+}
@@ -0,0 +1,89 @@
+#ifndef WONDERSWAN_RENDERER_H
+#define WONDERSWAN_RENDERER_H
+
+#include "ChipBackend.h"
+#include "PcmKernels.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Reference PCM rendering of the WonderSwan's four channels from the same command
+// stream that WonderSwanChip turns into MIDI, for checking the MIDI against what the
+// registers actually play (see render_compare.cpp). It is a command target of
+// BasicVgmReader::parse_into(), like ChipModel, and ignores the other chips.
+//
+// Output is 44100 Hz, one sample per VGM sample. Tone channels play their wavetable
+// through PcmKernels' resampler, channel 2 in voice mode its 8-bit samples, and
+// channel 4 in noise mode a 15-bit LFSR; channel 3's sweep is applied at the sample
+// each step completes rather than once per wait. Rendering runs in blocks of at most
+// BLOCK samples, so memory use does not grow with the stream unless the mixed PCM
+// is kept.
+class WonderSwanRenderer {
+public:
+    static constexpr uint32_t SAMPLE_RATE = 44100;
+    static constexpr int CHANNELS = 4;
+    static constexpr size_t BLOCK = 1024;
+
+    // Receives every rendered block: each hardware channel's signal before the
+    // volume (a tone channel swings about +-7.5), and its mean left/right gain over
+    // the block. `start` is the sample index of the block's first sample.
+    using ChannelSink = std::function<void(uint64_t start, const float* const* channels, const float* levels,
+                                           size_t count)>;
+
+    WonderSwanRenderer();
+    WonderSwanRenderer(const WonderSwanRenderer&) = delete;
+    WonderSwanRenderer& operator=(const WonderSwanRenderer&) = delete;
+
+    // Power-on state, no samples rendered; the options are kept.
+    void reset();
+    // Keep the mixed stereo PCM for pcm()/write_wav() (default on).
+    void set_keep_pcm(bool keep) { keep_pcm = keep; }
+    void set_channel_sink(ChannelSink sink) { channel_sink = std::move(sink); }
+
+    // Command target interface used by the reader.
+    template <ChipId Id>
+    void write(uint8_t reg, uint8_t value) {
+        if constexpr (Id == ChipId::WonderSwan) write_port(reg, value);
+    }
+    template <ChipId Id>
+    void write_memory(uint16_t offset, uint8_t value) {
+        if constexpr (Id == ChipId::WonderSwan) write_ram(offset, value);
+    }
+    void advance_time(uint16_t samples);
+    void set_clocks(const VgmChipClocks&) {}
+    void mark_loop_start(uint32_t) {}
+    bool window_closed() const { return false; }
+
+    uint64_t samples() const { return rendered; }
+    // Interleaved 16-bit stereo, empty unless set_keep_pcm() is on.
+    const std::vector<int16_t>& pcm() const { return pcm_samples; }
+    // pcm() as a 16-bit stereo RIFF WAVE file.
+    bool write_wav(const std::string& filename) const;
+
+private:
+    std::array<uint8_t, 256> io_ram;
+    std::array<uint8_t, 0x4000> ram;
+    std::array<WavetableSteps, CHANNELS> waves;
+    std::array<uint32_t, CHANNELS> phases;
+    uint8_t wave_dirty; // Bit n: waves[n] must be rebuilt from RAM
+    uint16_t lfsr;
+    uint32_t noise_phase; // Fraction of a noise step, 2^27 = one step
+    uint32_t sweep_timer; // In 1/147 clocks, as in WonderSwanChip
+    uint64_t rendered;
+    bool keep_pcm;
+    ChannelSink channel_sink;
+    std::vector<int16_t> pcm_samples;
+    alignas(32) float buffers[CHANNELS][BLOCK];
+    std::array<int16_t, 2 * BLOCK> mix_buffer;
+
+    void write_port(uint8_t port, uint8_t value);
+    void write_ram(uint16_t offset, uint8_t value);
+    void render_block(size_t count);
+    void render_noise(uint64_t increment, float* out, size_t count);
+    int period(int channel) const { return ((io_ram[0x81 + 2 * channel] & 0x07) << 8) | io_ram[0x80 + 2 * channel]; }
+};
+
+#endif // WONDERSWAN_RENDERER_H
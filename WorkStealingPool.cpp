@@ -0,0 +1,111 @@
+#include "WorkStealingPool.h"
+
+namespace {
+// Pool whose worker runs on this thread (null for outside threads) and the worker's
+// index in it. A worker may submit to another pool, which must not see the index.
+thread_local const WorkStealingPool* current_pool = nullptr;
+thread_local unsigned current_worker = 0;
+}
+
+WorkStealingPool::WorkStealingPool(unsigned thread_count)
+    : queued(0), pending(0), stopping(false), next_queue(0) {
+    if (thread_count == 0) {
+        thread_count = std::thread::hardware_concurrency();
+        if (thread_count == 0) thread_count = 1;
+    }
+
+    for (unsigned i = 0; i < thread_count; ++i) {
+        queues.push_back(std::make_unique<WorkerQueue>());
+    }
+    for (unsigned i = 0; i < thread_count; ++i) {
+        threads.emplace_back(&WorkStealingPool::worker_loop, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        stopping = true;
+    }
+    work_available.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void WorkStealingPool::submit(Job job) {
+    unsigned index = (current_pool == this)
+        ? current_worker
+        : next_queue.fetch_add(1, std::memory_order_relaxed) % size();
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->jobs.push_back(std::move(job));
+    }
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        ++queued;
+        ++pending;
+    }
+    work_available.notify_one();
+}
+
+void WorkStealingPool::wait() {
+    std::unique_lock<std::mutex> lock(state_mutex);
+    all_done.wait(lock, [this] { return pending == 0; });
+}
+
+bool WorkStealingPool::try_pop(unsigned index, Job& job) {
+    {
+        WorkerQueue& own = *queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.jobs.empty()) {
+            job = std::move(own.jobs.back());
+            own.jobs.pop_back();
+            return true;
+        }
+    }
+
+    for (unsigned offset = 1; offset < size(); ++offset) {
+        WorkerQueue& victim = *queues[(index + offset) % size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty()) {
+            job = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingPool::worker_loop(unsigned index) {
+    current_pool = this;
+    current_worker = index;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(state_mutex);
+            work_available.wait(lock, [this] { return stopping || queued > 0; });
+            if (stopping && queued == 0) return;
+        }
+
+        Job job;
+        if (!try_pop(index, job)) {
+            // Another worker took it between the wake-up and the pop.
+            std::this_thread::yield();
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            --queued;
+        }
+
+        job();
+
+        bool finished;
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            finished = (--pending == 0);
+        }
+        if (finished) all_done.notify_all();
+    }
+}
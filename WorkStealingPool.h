@@ -0,0 +1,53 @@
+#ifndef WORK_STEALING_POOL_H
+#define WORK_STEALING_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size thread pool with one job deque per worker.
+// A worker pops from the back of its own deque and, when that runs dry, steals
+// from the front of the other workers' deques, so long files do not leave cores idle.
+class WorkStealingPool {
+public:
+    using Job = std::function<void()>;
+
+    explicit WorkStealingPool(unsigned thread_count = 0); // 0 = hardware concurrency
+    ~WorkStealingPool();
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // Jobs submitted from a worker of this pool go to that worker's own deque, other
+    // submissions are spread over the deques in turn.
+    void submit(Job job);
+    // Blocks until every submitted job has finished.
+    void wait();
+    unsigned size() const { return static_cast<unsigned>(threads.size()); }
+
+private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> threads;
+    std::mutex state_mutex;
+    std::condition_variable work_available;
+    std::condition_variable all_done;
+    size_t queued;  // Jobs sitting in a deque, guarded by state_mutex
+    size_t pending; // Jobs submitted but not finished, guarded by state_mutex
+    bool stopping;
+    std::atomic<unsigned> next_queue;
+
+    bool try_pop(unsigned index, Job& job);
+    void worker_loop(unsigned index);
+};
+
+#endif // WORK_STEALING_POOL_H
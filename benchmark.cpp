@@ -0,0 +1,307 @@
+// Micro-benchmark suite for the conversion pipeline.
+//
+// Generates deterministic synthetic VGM streams (SyntheticVgm.h) and times each
+// stage of the converter on its own as well as end to end:
+//   encoder       MidiWriter fed the MIDI events of the conversion, plus finish()
+//   chip+encoder  VgmChipModel driven by the stream's register and RAM writes and waits
+//   end_to_end    VgmReader::parse on the in-memory stream, plus finish()
+//   pipelined     end_to_end with decoding, chip and encoder on three threads
+// The chip always drives a MidiWriter and the reader always drives a chip, so the
+// exclusive cost of the chip model and of the parser is derived by subtraction.
+//
+// Usage: benchmark [--commands N] [--iterations N] [--seed N] [--json]
+// The workloads, their checksums and the output format only depend on the options,
+// so runs are directly comparable; --json prints a single machine-readable document.
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "MidiEvent.h"
+#include "MidiWriter.h"
+#include "SyntheticVgm.h"
+#include "VgmReader.h"
+#include "ChipModel.h"
+
+namespace {
+
+struct BenchmarkOptions {
+    size_t commands = 1000000;
+    int iterations = 5;
+    uint32_t seed = 12345;
+    bool json = false;
+};
+
+struct Timing {
+    double best = 0.0;   // Seconds
+    double median = 0.0;
+};
+
+struct StageResult {
+    std::string name;
+    bool derived;
+    Timing timing;
+    size_t units;  // Commands (or events, for the encoder) per run
+    size_t bytes;  // Bytes consumed (or produced, for the encoder) per run
+    size_t events; // MIDI events per run
+};
+
+struct WorkloadResult {
+    std::string name;
+    SyntheticVgm vgm;
+    size_t midi_events = 0;
+    size_t midi_bytes = 0;
+    uint64_t midi_checksum = 0;
+    std::vector<StageResult> stages;
+};
+
+template <typename Fn>
+Timing measure(int iterations, Fn&& run) {
+    std::vector<double> samples;
+    for (int i = 0; i < iterations; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        samples.push_back(elapsed.count());
+    }
+    std::sort(samples.begin(), samples.end());
+    Timing timing;
+    timing.best = samples.front();
+    timing.median = samples[samples.size() / 2];
+    return timing;
+}
+
+uint64_t fnv1a(const std::vector<uint8_t>& data) {
+    uint64_t hash = 14695981039346656037ull;
+    for (uint8_t byte : data) {
+        hash ^= byte;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+bool read_variable_length(const std::vector<uint8_t>& data, size_t& pos, size_t end, uint32_t& value) {
+    value = 0;
+    for (int i = 0; i < 4 && pos < end; ++i) {
+        uint8_t byte = data[pos++];
+        value = (value << 7) | (byte & 0x7F);
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+// Channel messages of an SMF image, merged over all tracks in time order.
+std::vector<MidiEvent> decode_midi_events(const std::vector<uint8_t>& image) {
+    std::vector<MidiEvent> events;
+    size_t pos = 14;
+    while (pos + 8 <= image.size()) {
+        size_t length = (static_cast<size_t>(image[pos + 4]) << 24) | (image[pos + 5] << 16) |
+                        (image[pos + 6] << 8) | image[pos + 7];
+        size_t end = std::min(image.size(), pos + 8 + length);
+        pos += 8;
+        uint32_t time = 0;
+        uint8_t status = 0;
+        while (pos < end) {
+            uint32_t delta;
+            if (!read_variable_length(image, pos, end, delta) || pos >= end) break;
+            time += delta;
+            if (image[pos] & 0x80) status = image[pos++];
+            if (status == 0xFF || status == 0xF0 || status == 0xF7) {
+                if (status == 0xFF) ++pos; // Meta type
+                uint32_t size;
+                if (!read_variable_length(image, pos, end, size)) break;
+                pos += size;
+                status = 0;
+                continue;
+            }
+            size_t data_bytes = ((status & 0xE0) == 0xC0) ? 1 : 2;
+            if (status < 0x80 || pos + data_bytes > end) break;
+            MidiEvent event = {time, static_cast<uint8_t>(status & 0xF0), static_cast<uint8_t>(status & 0x0F),
+                               image[pos], static_cast<uint8_t>(data_bytes == 2 ? image[pos + 1] : 0)};
+            events.push_back(event);
+            pos += data_bytes;
+        }
+        pos = end;
+    }
+    std::stable_sort(events.begin(), events.end(),
+                     [](const MidiEvent& a, const MidiEvent& b) { return a.time < b.time; });
+    return events;
+}
+
+std::vector<uint8_t> run_encoder(const std::vector<MidiEvent>& events) {
+    MidiWriter midi_writer;
+    for (const auto& e : events) {
+        switch (e.type) {
+            case 0x90:
+                if (e.data2 > 0) midi_writer.add_note_on(e.channel, e.data1, e.data2, e.time);
+                else midi_writer.add_note_off(e.channel, e.data1, e.time);
+                break;
+            case 0x80: midi_writer.add_note_off(e.channel, e.data1, e.time); break;
+            case 0xB0: midi_writer.add_control_change(e.channel, e.data1, e.data2, e.time); break;
+            case 0xC0: midi_writer.add_program_change(e.channel, e.data1, e.time); break;
+        }
+    }
+    return midi_writer.finish();
+}
+
+std::vector<uint8_t> run_chip(const SyntheticVgm& vgm) {
+    MidiWriter midi_writer;
+    VgmChipModel chip(midi_writer);
+    for (const auto& op : vgm.chip_ops) {
+        if (op.samples > 0) chip.advance_time(op.samples);
+        else if (op.memory) chip.write_memory<ChipId::WonderSwan>(op.address, op.value);
+        else chip.write<ChipId::WonderSwan>(static_cast<uint8_t>(op.address), op.value);
+    }
+    chip.flush();
+    return midi_writer.finish();
+}
+
+std::vector<uint8_t> run_end_to_end(const SyntheticVgm& vgm) {
+    MidiWriter midi_writer;
+    VgmChipModel chip(midi_writer);
+    VgmReader reader(chip);
+    reader.parse(ByteSpan(vgm.data));
+    return midi_writer.finish();
+}
+
+std::vector<uint8_t> run_pipelined(const SyntheticVgm& vgm) {
+    MidiWriter midi_writer;
+    VgmChipModel chip(midi_writer);
+    VgmReader reader(chip);
+    midi_writer.start_encoder_thread();
+    reader.parse_pipelined(ByteSpan(vgm.data));
+    return midi_writer.finish();
+}
+
+StageResult derive(const std::string& name, const StageResult& total, const StageResult& part) {
+    StageResult stage = total;
+    stage.name = name;
+    stage.derived = true;
+    stage.timing.best = std::max(0.0, total.timing.best - part.timing.best);
+    stage.timing.median = std::max(0.0, total.timing.median - part.timing.median);
+    return stage;
+}
+
+WorkloadResult run_workload(const std::string& name, bool foreign_chips, const BenchmarkOptions& options) {
+    WorkloadResult result;
+    result.name = name;
+    SyntheticVgmOptions generator;
+    generator.command_count = options.commands;
+    generator.seed = options.seed;
+    generator.foreign_chips = foreign_chips;
+    generator.data_blocks = foreign_chips;
+    result.vgm = make_synthetic_vgm(generator);
+    const SyntheticVgm& vgm = result.vgm;
+
+    // Reference output, also the encoder's input.
+    std::vector<uint8_t> image = run_end_to_end(vgm);
+    std::vector<MidiEvent> events = decode_midi_events(image);
+    result.midi_events = events.size();
+    result.midi_bytes = image.size();
+    result.midi_checksum = fnv1a(image);
+    if (run_chip(vgm) != image || run_encoder(events) != image || run_pipelined(vgm) != image) {
+        std::cerr << "warning: " << name << ": stage replays do not reproduce the end-to-end output" << std::endl;
+    }
+
+    size_t input_bytes = vgm.data.size();
+    StageResult encoder = {"encoder", false, measure(options.iterations, [&] { run_encoder(events); }),
+                           events.size(), image.size(), events.size()};
+    StageResult chip = {"chip+encoder", false, measure(options.iterations, [&] { run_chip(vgm); }),
+                        vgm.commands, input_bytes, events.size()};
+    StageResult end_to_end = {"end_to_end", false, measure(options.iterations, [&] { run_end_to_end(vgm); }),
+                              vgm.commands, input_bytes, events.size()};
+    StageResult pipelined = {"pipelined", false, measure(options.iterations, [&] { run_pipelined(vgm); }),
+                             vgm.commands, input_bytes, events.size()};
+
+    result.stages = {encoder, chip, end_to_end, pipelined, derive("chip", chip, encoder),
+                     derive("parser", end_to_end, chip)};
+    return result;
+}
+
+double per_second(double amount, double seconds) {
+    return seconds > 0.0 ? amount / seconds : 0.0;
+}
+
+void print_text(const BenchmarkOptions& options, const std::vector<WorkloadResult>& workloads) {
+    std::cout << "Best of " << options.iterations << " runs, seed " << options.seed << std::endl;
+    for (const auto& w : workloads) {
+        std::cout << "\n" << w.name << ": " << w.vgm.data.size() << " bytes, " << w.vgm.commands << " commands ("
+                  << w.vgm.register_writes << " writes, " << w.vgm.memory_writes << " RAM writes, " << w.vgm.waits
+                  << " waits, " << w.vgm.data_blocks << " data blocks, " << w.vgm.skipped << " skipped) -> "
+                  << w.midi_events << " MIDI events, "
+                  << w.midi_bytes << " bytes, checksum " << std::hex << w.midi_checksum << std::dec << std::endl;
+        for (const auto& s : w.stages) {
+            std::string label = s.derived ? s.name + " (derived)" : s.name;
+            std::cout << "  " << std::left << std::setw(18) << label << std::right << std::fixed
+                      << std::setprecision(2)
+                      << std::setw(10) << (s.timing.best * 1e3) << " ms"
+                      << std::setw(10) << (s.timing.best * 1e9 / s.units)
+                      << (s.name == "encoder" ? " ns/event  " : " ns/command")
+                      << std::setw(10) << (per_second(s.bytes, s.timing.best) / 1e6) << " MB/s"
+                      << std::setw(10) << std::setprecision(1) << (per_second(s.events, s.timing.best) / 1e6)
+                      << " M events/s" << std::endl;
+        }
+    }
+}
+
+void print_json(const BenchmarkOptions& options, const std::vector<WorkloadResult>& workloads) {
+    std::cout << std::setprecision(9);
+    std::cout << "{\"benchmark\":\"vgm_ws_to_mid\",\"commands\":" << options.commands
+              << ",\"iterations\":" << options.iterations << ",\"seed\":" << options.seed << ",\"workloads\":[";
+    for (size_t i = 0; i < workloads.size(); ++i) {
+        const WorkloadResult& w = workloads[i];
+        std::cout << (i ? "," : "") << "{\"name\":\"" << w.name << "\",\"input_bytes\":" << w.vgm.data.size()
+                  << ",\"commands\":" << w.vgm.commands << ",\"register_writes\":" << w.vgm.register_writes
+                  << ",\"memory_writes\":" << w.vgm.memory_writes
+                  << ",\"waits\":" << w.vgm.waits << ",\"data_blocks\":" << w.vgm.data_blocks
+                  << ",\"skipped\":" << w.vgm.skipped << ",\"midi_events\":" << w.midi_events
+                  << ",\"midi_bytes\":" << w.midi_bytes << ",\"midi_checksum\":\"" << std::hex
+                  << w.midi_checksum << std::dec << "\",\"stages\":[";
+        for (size_t j = 0; j < w.stages.size(); ++j) {
+            const StageResult& s = w.stages[j];
+            std::cout << (j ? "," : "") << "{\"name\":\"" << s.name << "\",\"derived\":"
+                      << (s.derived ? "true" : "false") << ",\"best_s\":" << s.timing.best
+                      << ",\"median_s\":" << s.timing.median
+                      << ",\"ns_per_unit\":" << (s.timing.best * 1e9 / s.units)
+                      << ",\"unit\":\"" << (s.name == "encoder" ? "event" : "command") << "\""
+                      << ",\"mb_per_s\":" << (per_second(s.bytes, s.timing.best) / 1e6)
+                      << ",\"events_per_s\":" << per_second(s.events, s.timing.best) << "}";
+        }
+        std::cout << "]}";
+    }
+    std::cout << "]}" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    BenchmarkOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--commands" && i + 1 < argc) {
+            options.commands = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--iterations" && i + 1 < argc) {
+            options.iterations = std::atoi(argv[++i]);
+        } else if (arg == "--seed" && i + 1 < argc) {
+            options.seed = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--json") {
+            options.json = true;
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--commands N] [--iterations N] [--seed N] [--json]" << std::endl;
+            return 1;
+        }
+    }
+    if (options.commands < 1) options.commands = 1;
+    if (options.iterations < 1) options.iterations = 1;
+
+    std::vector<WorkloadResult> workloads;
+    workloads.push_back(run_workload("wonderswan", false, options));
+    workloads.push_back(run_workload("mixed", true, options));
+
+    if (options.json) print_json(options, workloads);
+    else print_text(options, workloads);
+    return 0;
+}
@@ -1,31 +1,405 @@
 #include <iostream>
-#include "MidiWriter.h"
-#include "WonderSwanChip.h"
-#include "VgmReader.h"
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Converter.h"
+#include "BatchConverter.h"
+#include "ConversionServer.h"
+#include "Logger.h"
+#include "MappedFile.h"
+#include "ResultCache.h"
+#include "SeekIndex.h"
+#include "WaveformCache.h"
 
-int main(int argc, char* argv[]) {
-    if (argc < 3) {
-        std::cerr << "Usage: " << argv[0] << " <input.vgm> <output.mid>" << std::endl;
+static void print_usage(const char* program) {
+    std::cerr << "Usage: " << program << " [options] <input.vgm> <output.mid|->" << std::endl;
+    std::cerr << "       " << program << " --batch [options] [-j threads] [-o output_dir] [--max-input-mb N] <dir|glob|@manifest>..." << std::endl;
+    std::cerr << "       " << program << " --server [options] [-j threads] [--socket PATH] [--max-input-mb N]" << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  --format1         SMF format 1: conductor track plus one named track per channel" << std::endl;
+    std::cerr << "  --running-status  Omit repeated status bytes (implied by --format1)" << std::endl;
+    std::cerr << "  --cc11-tolerance N       Drop CC#11 events within N of the last kept level" << std::endl;
+    std::cerr << "  --cc11-min-spacing TICKS Keep CC#11 events of a channel at least TICKS apart" << std::endl;
+    std::cerr << "  --stats FILE      Write conversion statistics and stage timings as JSON (\"-\" = stdout)" << std::endl;
+    std::cerr << "  --start SECONDS   Convert from this point on; notes already sounding start at tick 0" << std::endl;
+    std::cerr << "  --end SECONDS     Stop converting here, releasing held notes" << std::endl;
+    std::cerr << "  --pipelined       Decode, simulate and encode on three threads (same output, for long streams)" << std::endl;
+    std::cerr << "  --parse-threads N Parse one large stream as N segments in parallel (same output)" << std::endl;
+    std::cerr << "  --no-loop-markers Omit the loopStart/loopEnd markers and CC#111 at the header's loop points" << std::endl;
+    std::cerr << "  --stop-at-loop-end Stop at the end of the first loop pass, releasing held notes" << std::endl;
+    std::cerr << "  --loops N         Append N more loop passes after the first (implies --stop-at-loop-end)" << std::endl;
+    std::cerr << "  --ppqn N          MIDI ticks per quarter note (1-32767, default 480)" << std::endl;
+    std::cerr << "  --tempo BPM|auto  Tempo of the file (default 120); auto picks one near 120 at which 50/60 Hz" << std::endl;
+    std::cerr << "                    frames are whole tick counts (needs a PPQN divisible by 3)" << std::endl;
+    std::cerr << "  --pitch-bend SEMITONES  Glide mode: bend held notes within this range (1-24) instead of retriggering" << std::endl;
+    std::cerr << "  --index FILE      Seek index for --start (built and saved if missing or stale)" << std::endl;
+    std::cerr << "  --seek-interval SECONDS  Checkpoint spacing of a new index (default 5)" << std::endl;
+    std::cerr << "  --cache DIR       Reuse results of earlier conversions stored in DIR" << std::endl;
+    std::cerr << "  --cache-max-mb N  Evict least recently used results beyond N MiB (default 1024)" << std::endl;
+    std::cerr << "  --wave-cache FILE Keep the waveform -> instrument classifications in FILE across runs" << std::endl;
+    std::cerr << "  --log FILE        Write a debug log (\"-\" = stderr)" << std::endl;
+    std::cerr << "  --log-level LEVEL trace, debug, info (default), warn or error" << std::endl;
+}
+
+static uint64_t seconds_to_samples(const char* text) {
+    double samples = std::strtod(text, nullptr) * 44100.0 + 0.5;
+    if (!(samples > 0.0)) return 0;
+    return samples >= 18446744073709551616.0 ? UINT64_MAX : static_cast<uint64_t>(samples);
+}
+
+// Handles options shared by single-file, batch and server mode; returns false if argv[i] is not one.
+// An invalid value is reported through `error`.
+static bool parse_conversion_option(int argc, char* argv[], int& i, ConversionOptions& options, std::string& error) {
+    std::string arg = argv[i];
+    if (arg == "--format1") {
+        options.midi.per_channel_tracks = true;
+        options.midi.running_status = true;
+    } else if (arg == "--running-status") {
+        options.midi.running_status = true;
+    } else if (arg == "--cc11-tolerance" && i + 1 < argc) {
+        options.midi.expression_thinning.max_value_error = std::atoi(argv[++i]);
+    } else if (arg == "--cc11-min-spacing" && i + 1 < argc) {
+        options.midi.expression_thinning.min_spacing = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+    } else if (arg == "--start" && i + 1 < argc) {
+        options.window.start = seconds_to_samples(argv[++i]);
+    } else if (arg == "--end" && i + 1 < argc) {
+        options.window.end = seconds_to_samples(argv[++i]);
+        options.window.bounded = true;
+    } else if (arg == "--pipelined") {
+        options.pipelined = true;
+    } else if (arg == "--parse-threads" && i + 1 < argc) {
+        options.parse_threads = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+    } else if (arg == "--no-loop-markers") {
+        options.loop.markers = false;
+    } else if (arg == "--stop-at-loop-end") {
+        options.loop.stop_at_loop_end = true;
+    } else if (arg == "--loops" && i + 1 < argc) {
+        options.loop.extra_loops = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+    } else if (arg == "--ppqn" && i + 1 < argc) {
+        unsigned long ppqn = std::strtoul(argv[++i], nullptr, 10);
+        if (ppqn >= 1 && ppqn <= 0x7FFF) {
+            options.midi.ppqn = static_cast<uint16_t>(ppqn);
+        } else {
+            error = std::string("Invalid PPQN: ") + argv[i];
+        }
+    } else if (arg == "--tempo" && i + 1 < argc) {
+        std::string value = argv[++i];
+        double bpm = std::strtod(value.c_str(), nullptr);
+        if (value == "auto") {
+            options.midi.tempo = 0;
+        } else if (bpm >= 4.0 && bpm <= 60000000.0) {
+            options.midi.tempo = static_cast<uint32_t>(std::lround(60000000.0 / bpm));
+        } else {
+            error = "Invalid tempo: " + value;
+        }
+    } else if (arg == "--pitch-bend" && i + 1 < argc) {
+        unsigned long semitones = std::strtoul(argv[++i], nullptr, 10);
+        if (semitones >= 1 && semitones <= 24) {
+            options.pitch_bend_range = static_cast<unsigned>(semitones);
+        } else {
+            error = std::string("Invalid pitch-bend range: ") + argv[i];
+        }
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Checks the conversion options that are only valid together; returns the error, if any.
+static std::string check_conversion_options(const ConversionOptions& options) {
+    if (options.midi.tempo == 0 && auto_tempo(options.midi.ppqn) == 0) {
+        return "--tempo auto needs a PPQN divisible by 3, not " + std::to_string(options.midi.ppqn);
+    }
+    return std::string();
+}
+
+struct LogOptions {
+    std::string path; // Empty: no log
+    LogLevel level = LogLevel::Info;
+};
+
+// Handles --log/--log-level; returns false if argv[i] is not one of them.
+// An unknown level is reported through `error`.
+static bool parse_log_option(int argc, char* argv[], int& i, LogOptions& options, std::string& error) {
+    std::string arg = argv[i];
+    if (arg == "--log" && i + 1 < argc) {
+        options.path = argv[++i];
+    } else if (arg == "--log-level" && i + 1 < argc) {
+        if (!Logger::parse_level(argv[++i], options.level)) {
+            error = std::string("Unknown log level: ") + argv[i];
+        }
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool start_logging(const LogOptions& options) {
+    if (options.path.empty()) return true;
+    if (!Logger::start(options.path, options.level)) {
+        std::cerr << "Cannot open log file: " << options.path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+struct CacheOptions {
+    std::string directory; // Empty: no cache
+    uint64_t max_bytes = 1024ull * 1024 * 1024;
+};
+
+// Handles --cache/--cache-max-mb; returns false if argv[i] is not one of them.
+static bool parse_cache_option(int argc, char* argv[], int& i, CacheOptions& options) {
+    std::string arg = argv[i];
+    if (arg == "--cache" && i + 1 < argc) {
+        options.directory = argv[++i];
+    } else if (arg == "--cache-max-mb" && i + 1 < argc) {
+        options.max_bytes = std::strtoull(argv[++i], nullptr, 10) * 1024 * 1024;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool open_cache(const CacheOptions& options, std::unique_ptr<ResultCache>& cache) {
+    if (options.directory.empty()) return true;
+    cache.reset(new ResultCache(options.directory, options.max_bytes));
+    if (!cache->open()) {
+        std::cerr << "Cannot use cache directory: " << options.directory << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Loads the waveform cache file if one was named (a missing or outdated file just
+// starts an empty cache) and attaches the cache to the conversions.
+static void open_wave_cache(const std::string& path, WaveformCache& cache, ConversionOptions& options) {
+    if (path.empty()) return;
+    cache.load(path);
+    options.waveform_cache = &cache;
+}
+
+static bool save_wave_cache(const std::string& path, const WaveformCache& cache) {
+    if (path.empty() || cache.save(path)) return true;
+    std::cerr << "Cannot write waveform cache: " << path << std::endl;
+    return false;
+}
+
+// Loads the seek index for `input`, or builds and saves a new one when the file is
+// missing, belongs to other input bytes or uses another checkpoint interval.
+static bool prepare_index(const std::string& path, const std::string& input, uint32_t interval,
+                          const ConversionOptions& options, SeekIndex& index, std::ostream& progress) {
+    MappedFile mapped;
+    if (!mapped.open(input)) {
+        std::cerr << "Cannot map input for indexing: " << input << std::endl;
+        return false;
+    }
+    if (index.load(path) && index.interval == interval && index.pitch_bend_range == options.pitch_bend_range &&
+        index.matches(mapped.span())) {
+        progress << "Using seek index " << path << " (" << index.checkpoints.size() << " checkpoints)." << std::endl;
+        return true;
+    }
+
+    ConversionOptions index_options;
+    index_options.pitch_bend_range = options.pitch_bend_range; // The only option the tracked state depends on
+    VgmConverter converter(index_options);
+    if (!converter.build_index(mapped.span(), interval, index)) return false;
+    if (!index.save(path)) {
+        std::cerr << "Cannot write seek index: " << path << std::endl;
+        return false;
+    }
+    progress << "Seek index written to " << path << " (" << index.checkpoints.size() << " checkpoints)." << std::endl;
+    return true;
+}
+
+static bool write_stats(const std::string& path, const std::string& input, const std::string& output,
+                        const ConversionResult& result) {
+    std::ofstream file;
+    if (path != "-") {
+        file.open(path);
+        if (!file) {
+            std::cerr << "Cannot open statistics file: " << path << std::endl;
+            return false;
+        }
+    }
+    std::ostream& out = (path == "-") ? std::cout : file;
+    out << "{\"input\":";
+    write_json_string(out, input);
+    out << ",\"output\":";
+    write_json_string(out, output);
+    out << ",\"success\":" << (result.success ? "true" : "false") << ",\"stats\":";
+    result.stats.write_json(out);
+    out << '}' << std::endl;
+    return out.good();
+}
+
+static int run_batch_mode(int argc, char* argv[]) {
+    BatchOptions options;
+    LogOptions log;
+    CacheOptions cache_options;
+    std::string wave_cache_path;
+    std::string error;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (parse_conversion_option(argc, argv, i, options.conversion, error) ||
+            parse_log_option(argc, argv, i, log, error) || parse_cache_option(argc, argv, i, cache_options)) {
+            continue;
+        } else if ((arg == "-j" || arg == "--jobs") && i + 1 < argc) {
+            options.jobs = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        } else if ((arg == "-o" || arg == "--output-dir") && i + 1 < argc) {
+            options.output_dir = argv[++i];
+        } else if (arg == "--max-input-mb" && i + 1 < argc) {
+            options.max_input_size = std::strtoull(argv[++i], nullptr, 10) * 1024 * 1024;
+        } else if (arg == "--wave-cache" && i + 1 < argc) {
+            wave_cache_path = argv[++i];
+        } else if (arg == "--stats" && i + 1 < argc) {
+            options.stats_path = argv[++i];
+            options.conversion.collect_stats = true;
+        } else {
+            options.inputs.push_back(arg);
+        }
+    }
+
+    if (error.empty()) error = check_conversion_options(options.conversion);
+    if (!error.empty()) std::cerr << error << std::endl;
+    if (options.inputs.empty() || !error.empty()) {
+        print_usage(argv[0]);
         return 1;
     }
+    if (!start_logging(log)) return 1;
+    std::unique_ptr<ResultCache> cache;
+    if (!open_cache(cache_options, cache)) return 1;
+    options.conversion.cache = cache.get();
+    WaveformCache wave_cache;
+    open_wave_cache(wave_cache_path, wave_cache, options.conversion);
+    int status = run_batch(options);
+    if (!save_wave_cache(wave_cache_path, wave_cache) && status == 0) status = 1;
+    return status;
+}
 
-    std::string input_filename = argv[1];
-    std::string output_filename = argv[2];
+static int run_server_mode(int argc, char* argv[]) {
+    ServerOptions options;
+    LogOptions log;
+    CacheOptions cache_options;
+    std::string error;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (parse_conversion_option(argc, argv, i, options.conversion, error) ||
+            parse_log_option(argc, argv, i, log, error) || parse_cache_option(argc, argv, i, cache_options)) {
+            continue;
+        } else if ((arg == "-j" || arg == "--jobs") && i + 1 < argc) {
+            options.jobs = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--socket" && i + 1 < argc) {
+            options.socket_path = argv[++i];
+        } else if (arg == "--max-input-mb" && i + 1 < argc) {
+            options.max_request_size = std::strtoull(argv[++i], nullptr, 10) * 1024 * 1024;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (error.empty()) error = check_conversion_options(options.conversion);
+    if (!error.empty()) {
+        std::cerr << error << std::endl;
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (!start_logging(log)) return 1;
+    std::unique_ptr<ResultCache> cache;
+    if (!open_cache(cache_options, cache)) return 1;
+    options.cache = cache.get();
+    return run_server(options);
+}
 
-    std::cout << "VGM to MIDI conversion process started." << std::endl;
+int main(int argc, char* argv[]) {
+    if (argc >= 2 && std::string(argv[1]) == "--batch") {
+        return run_batch_mode(argc, argv);
+    }
+    if (argc >= 2 && std::string(argv[1]) == "--server") {
+        return run_server_mode(argc, argv);
+    }
+
+    ConversionOptions options;
+    std::string stats_path;
+    std::string index_path;
+    uint32_t seek_interval = 5 * 44100;
+    std::string wave_cache_path;
+    LogOptions log;
+    CacheOptions cache_options;
+    std::vector<std::string> files;
+    std::string error;
+    for (int i = 1; i < argc; ++i) {
+        if (parse_conversion_option(argc, argv, i, options, error) || parse_log_option(argc, argv, i, log, error) ||
+            parse_cache_option(argc, argv, i, cache_options)) {
+            continue;
+        } else if (std::string(argv[i]) == "--index" && i + 1 < argc) {
+            index_path = argv[++i];
+        } else if (std::string(argv[i]) == "--seek-interval" && i + 1 < argc) {
+            uint64_t interval = std::max<uint64_t>(1, seconds_to_samples(argv[++i]));
+            seek_interval = static_cast<uint32_t>(std::min<uint64_t>(interval, UINT32_MAX));
+        } else if (std::string(argv[i]) == "--wave-cache" && i + 1 < argc) {
+            wave_cache_path = argv[++i];
+        } else if (std::string(argv[i]) == "--stats" && i + 1 < argc) {
+            stats_path = argv[++i];
+            options.collect_stats = true;
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
 
-    MidiWriter midi_writer;
-    WonderSwanChip chip(midi_writer);
-    VgmReader reader(chip);
+    if (error.empty()) error = check_conversion_options(options);
+    if (!error.empty()) std::cerr << error << std::endl;
+    if (files.size() != 2 || !error.empty()) {
+        print_usage(argv[0]);
+        return 1;
+    }
 
-    if (!reader.load_and_parse(input_filename)) {
-        std::cerr << "Failed to load or parse VGM file." << std::endl;
+    std::string input_filename = files[0];
+    std::string output_filename = files[1];
+    if (output_filename == "-" && stats_path == "-") {
+        std::cerr << "MIDI output and statistics cannot both go to standard output." << std::endl;
         return 1;
     }
 
-    midi_writer.write_to_file(output_filename);
+    if (!start_logging(log)) return 1;
+    std::unique_ptr<ResultCache> cache;
+    if (!open_cache(cache_options, cache)) return 1;
+    options.cache = cache.get();
+    WaveformCache wave_cache;
+    open_wave_cache(wave_cache_path, wave_cache, options);
+
+    // Keep standard output clean when the MIDI data or the statistics are written there.
+    std::ostream& progress = (output_filename == "-" || stats_path == "-") ? std::cerr : std::cout;
+    progress << "VGM to MIDI conversion process started." << std::endl;
+
+    SeekIndex index;
+    if (!index_path.empty()) {
+        if (!prepare_index(index_path, input_filename, seek_interval, options, index, progress)) return 1;
+        options.seek_index = &index;
+    }
 
-    std::cout << "VGM to MIDI conversion completed successfully." << std::endl;
+    ConversionResult result = convert_file(input_filename, output_filename, options);
+    if (!save_wave_cache(wave_cache_path, wave_cache)) return 1;
+    if (!stats_path.empty() && !write_stats(stats_path, input_filename, output_filename, result)) {
+        return 1;
+    }
+    if (!result.success) {
+        std::cerr << "Conversion failed: " << result.error << "." << std::endl;
+        return 1;
+    }
+
+    if (options.midi.expression_thinning.enabled()) {
+        progress << "Expression thinning removed " << result.expression_events_removed << " CC#11 events." << std::endl;
+    }
+    if (result.cached) {
+        progress << "Result taken from the cache." << std::endl;
+    }
+    progress << "VGM to MIDI conversion completed successfully." << std::endl;
 
     return 0;
 }
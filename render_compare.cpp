@@ -0,0 +1,559 @@
+// A/B check of the MIDI output against a PCM rendering of the same register stream.
+//
+// Every input is converted to MIDI in memory and rendered by WonderSwanRenderer; the
+// rendering is cut into 1024-sample frames per hardware channel and compared with
+// the MIDI channels the converter routes that channel to:
+//  - envelope: the channel is audible in the rendering (RMS above a small gate) in
+//    the same frames in which the MIDI holds a note;
+//  - pitch: in steady frames with a note on a tone channel, the period found by YIN
+//    (de Cheveigne & Kawahara) is within 70 cents of the note plus its pitch bend.
+// Frames around a MIDI note or pitch change are skipped, since the MIDI tick grid
+// shifts the change by up to a tick. A file whose mismatch rate exceeds the limit of
+// either check is reported as DIVERGENT and makes the exit status 1.
+//
+// Files are processed in parallel on a WorkStealingPool, each worker keeping a warm
+// VgmConverter and renderer; analysis runs on each block as it is rendered, so memory
+// use does not grow with the length of the stream unless --wav keeps the mix.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Converter.h"
+#include "MappedFile.h"
+#include "PcmKernels.h"
+#include "WonderSwanRenderer.h"
+#include "WorkStealingPool.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const size_t FRAME = 1024;
+const size_t HISTORY = 2048;      // Samples kept per channel for the pitch analysis
+const uint64_t GUARD = 64;        // Margin around a MIDI change, more than one tick
+const double RMS_GATE = 0.5;      // In 16-bit sample units
+const size_t YIN_WINDOW = 512;
+const size_t YIN_MAX_LAG = HISTORY - YIN_WINDOW;
+const double YIN_THRESHOLD = 0.15;
+const double PITCH_TOLERANCE_CENTS = 70.0;
+const unsigned PITCH_EVERY = 4;   // Pitch is checked on every 4th eligible frame
+const double YIN_TARGET_LAG = 64; // Low notes are decimated to about this period first
+
+struct CompareOptions {
+    std::vector<std::string> inputs;
+    unsigned jobs = 0;
+    std::string wav_dir;
+    double max_envelope_mismatch = 5.0; // Percent
+    double max_pitch_mismatch = 5.0;
+    unsigned pitch_bend_range = 0;
+};
+
+struct FileReport {
+    std::string input;
+    std::string error;
+    uint64_t samples = 0;
+    uint64_t envelope_frames = 0;
+    uint64_t envelope_mismatches = 0;
+    uint64_t pitch_frames = 0;
+    uint64_t pitch_mismatches = 0;
+    double milliseconds = 0.0;
+
+    double envelope_percent() const { return envelope_frames ? 100.0 * envelope_mismatches / envelope_frames : 0.0; }
+    double pitch_percent() const { return pitch_frames ? 100.0 * pitch_mismatches / pitch_frames : 0.0; }
+};
+
+// State of one MIDI channel from `start` (in samples) until the next segment.
+struct Segment {
+    uint64_t start;
+    bool on;
+    double pitch; // Note plus pitch bend, in semitones
+};
+
+// Per-MIDI-channel note timelines of a Standard MIDI File. The converter keeps one
+// note per channel, which is all this follows.
+class MidiTimeline {
+public:
+    bool parse(const std::vector<uint8_t>& smf, std::string& error);
+    const std::vector<Segment>& channel(int midi_channel) const { return segments[midi_channel]; }
+
+private:
+    struct Event {
+        uint64_t tick;
+        uint32_t order; // Position in the file, to keep same-tick events in order
+        uint8_t status;
+        uint8_t data1;
+        uint8_t data2;
+        uint32_t tempo; // Set meta events only
+    };
+
+    std::vector<Segment> segments[16];
+};
+
+uint32_t read_be(const std::vector<uint8_t>& data, size_t pos, int bytes) {
+    uint32_t value = 0;
+    for (int i = 0; i < bytes; ++i) value = (value << 8) | data[pos + i];
+    return value;
+}
+
+bool read_variable_length(const std::vector<uint8_t>& data, size_t& pos, size_t end, uint32_t& value) {
+    value = 0;
+    for (int i = 0; i < 4; ++i) {
+        if (pos >= end) return false;
+        uint8_t byte = data[pos++];
+        value = (value << 7) | (byte & 0x7F);
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+bool MidiTimeline::parse(const std::vector<uint8_t>& smf, std::string& error) {
+    if (smf.size() < 14 || read_be(smf, 0, 4) != 0x4D546864) { // "MThd"
+        error = "MIDI output has no header";
+        return false;
+    }
+    uint32_t track_count = read_be(smf, 10, 2);
+    uint32_t division = read_be(smf, 12, 2);
+    if (division == 0 || (division & 0x8000)) {
+        error = "MIDI output uses SMPTE time";
+        return false;
+    }
+
+    std::vector<Event> events;
+    size_t pos = 8 + read_be(smf, 4, 4);
+    for (uint32_t track = 0; track < track_count; ++track) {
+        if (pos + 8 > smf.size() || read_be(smf, pos, 4) != 0x4D54726B) { // "MTrk"
+            error = "MIDI output has a truncated track";
+            return false;
+        }
+        size_t end = pos + 8 + read_be(smf, pos + 4, 4);
+        if (end > smf.size()) end = smf.size();
+        pos += 8;
+        uint64_t tick = 0;
+        uint8_t running = 0;
+        while (pos < end) {
+            uint32_t delta;
+            if (!read_variable_length(smf, pos, end, delta) || pos >= end) break;
+            tick += delta;
+            uint8_t status = smf[pos];
+            if (status == 0xFF) {
+                uint32_t length;
+                uint8_t type = pos + 1 < end ? smf[pos + 1] : 0;
+                pos += 2;
+                if (!read_variable_length(smf, pos, end, length) || pos + length > end) break;
+                if (type == 0x51 && length == 3) {
+                    events.push_back({tick, uint32_t(events.size()), 0xFF, 0x51, 0, read_be(smf, pos, 3)});
+                }
+                pos += length;
+                continue;
+            }
+            if (status == 0xF0 || status == 0xF7) {
+                uint32_t length;
+                ++pos;
+                if (!read_variable_length(smf, pos, end, length)) break;
+                pos += length;
+                continue;
+            }
+            if (status & 0x80) {
+                running = status;
+                ++pos;
+            }
+            if (!(running & 0x80)) break;
+            int data_bytes = ((running & 0xE0) == 0xC0) ? 1 : 2;
+            if (pos + data_bytes > end) break;
+            uint8_t data1 = smf[pos];
+            uint8_t data2 = data_bytes == 2 ? smf[pos + 1] : 0;
+            pos += data_bytes;
+            events.push_back({tick, uint32_t(events.size()), running, data1, data2, 0});
+        }
+        pos = end;
+    }
+    std::sort(events.begin(), events.end(),
+              [](const Event& a, const Event& b) { return a.tick != b.tick ? a.tick < b.tick : a.order < b.order; });
+
+    // Tick -> sample through the tempo map, exact in integers between tempo changes.
+    uint64_t tempo_tick = 0, tempo_sample_us = 0; // Sample time at tempo_tick, in samples * 10^6
+    uint32_t tempo = 500000;
+    auto sample_of = [&](uint64_t tick) {
+        uint64_t us = tempo_sample_us + (tick - tempo_tick) * tempo * uint64_t(WonderSwanRenderer::SAMPLE_RATE) / division;
+        return (us + 500000) / 1000000;
+    };
+
+    struct ChannelState {
+        int note = -1;
+        int bend = 0; // -8192..8191
+        double range = 2.0;
+        uint8_t rpn_msb = 0x7F, rpn_lsb = 0x7F;
+    } states[16];
+    for (auto& list : segments) list.assign(1, {0, false, 0.0});
+
+    for (size_t i = 0; i < events.size();) {
+        uint64_t tick = events[i].tick;
+        uint16_t touched = 0;
+        for (; i < events.size() && events[i].tick == tick; ++i) {
+            const Event& event = events[i];
+            if (event.status == 0xFF) {
+                tempo_sample_us += (tick - tempo_tick) * tempo * uint64_t(WonderSwanRenderer::SAMPLE_RATE) / division;
+                tempo_tick = tick;
+                tempo = event.tempo;
+                continue;
+            }
+            int channel = event.status & 0x0F;
+            ChannelState& state = states[channel];
+            switch (event.status & 0xF0) {
+                case 0x90:
+                    if (event.data2 > 0) {
+                        state.note = event.data1;
+                        break;
+                    }
+                    [[fallthrough]];
+                case 0x80:
+                    if (state.note == event.data1) state.note = -1;
+                    break;
+                case 0xE0:
+                    state.bend = ((event.data2 << 7) | event.data1) - 8192;
+                    break;
+                case 0xB0:
+                    if (event.data1 == 101) state.rpn_msb = event.data2;
+                    if (event.data1 == 100) state.rpn_lsb = event.data2;
+                    if (event.data1 == 6 && state.rpn_msb == 0 && state.rpn_lsb == 0) state.range = event.data2;
+                    break;
+            }
+            touched |= static_cast<uint16_t>(1u << channel);
+        }
+        for (int channel = 0; channel < 16; ++channel) {
+            if (!(touched & (1u << channel))) continue;
+            const ChannelState& state = states[channel];
+            Segment next{sample_of(tick), state.note >= 0, state.note + state.bend * state.range / 8192.0};
+            Segment& last = segments[channel].back();
+            if (last.on == next.on && (!next.on || last.pitch == next.pitch)) continue;
+            if (last.start == next.start) {
+                last = next;
+            } else {
+                segments[channel].push_back(next);
+            }
+        }
+    }
+    return true;
+}
+
+// Walks a segment list forward in time.
+class SegmentCursor {
+public:
+    explicit SegmentCursor(const std::vector<Segment>& list) : list(list), index(0) {}
+
+    // Segment holding sample `t`; `t` must not decrease between calls.
+    const Segment& at(uint64_t t) {
+        while (index + 1 < list.size() && list[index + 1].start <= t) ++index;
+        return list[index];
+    }
+    // Start of the segment after the current one, UINT64_MAX if there is none.
+    uint64_t next_start() const { return index + 1 < list.size() ? list[index + 1].start : UINT64_MAX; }
+
+private:
+    const std::vector<Segment>& list;
+    size_t index;
+};
+
+// Period of `x` (window + max_lag samples) in samples, 0 if none was found.
+double yin_period(const float* x, size_t window, size_t max_lag) {
+    std::vector<double> difference(max_lag + 1, 0.0);
+    for (size_t lag = 1; lag <= max_lag; ++lag) {
+        double sum = 0.0;
+        for (size_t j = 0; j < window; ++j) {
+            double d = double(x[j]) - double(x[j + lag]);
+            sum += d * d;
+        }
+        difference[lag] = sum;
+    }
+    // Cumulative mean normalized difference.
+    std::vector<double> normalized(max_lag + 1, 1.0);
+    double running = 0.0;
+    for (size_t lag = 1; lag <= max_lag; ++lag) {
+        running += difference[lag];
+        normalized[lag] = running > 0.0 ? difference[lag] * lag / running : 1.0;
+    }
+    size_t best = 0;
+    for (size_t lag = 2; lag <= max_lag; ++lag) {
+        if (normalized[lag] < YIN_THRESHOLD) {
+            while (lag + 1 <= max_lag && normalized[lag + 1] < normalized[lag]) ++lag;
+            best = lag;
+            break;
+        }
+    }
+    if (best == 0) return 0.0;
+    if (best + 1 > max_lag) return double(best);
+    double a = normalized[best - 1], b = normalized[best], c = normalized[best + 1];
+    double curvature = a - 2 * b + c;
+    return curvature > 0.0 ? best + 0.5 * (a - c) / curvature : double(best);
+}
+
+// Frame analysis of one hardware channel against its MIDI channels.
+struct ChannelCheck {
+    int hardware;
+    SegmentCursor tone;     // MIDI channel of the tone channel
+    SegmentCursor special;  // Voice or noise channel, or the tone channel again
+    std::vector<float> recent; // Last samples of the rendered channel, recent[0] at recent_start
+    uint64_t recent_start = 0;
+    unsigned pitch_candidates = 0;
+    std::vector<float> decimated;
+
+    ChannelCheck(int hardware, const MidiTimeline& midi, int special_channel)
+        : hardware(hardware), tone(midi.channel(hardware)), special(midi.channel(special_channel)) {}
+
+    // True if no MIDI change lies within GUARD samples of [start, end).
+    bool steady(SegmentCursor& cursor, uint64_t start, uint64_t end) {
+        const Segment& segment = cursor.at(end - 1);
+        return (segment.start == 0 || segment.start + GUARD <= start) && cursor.next_start() >= end + GUARD;
+    }
+
+    void analyze_frame(uint64_t end, FileReport& report) {
+        uint64_t start = end - FRAME;
+        const float* frame = recent.data() + (start - recent_start);
+        bool steady_frame = steady(tone, start, end) & steady(special, start, end);
+        if (!steady_frame) return;
+        const Segment& tone_state = tone.at(end - 1);
+        bool midi_on = tone_state.on || special.at(end - 1).on;
+
+        double mean = 0.0, power = 0.0;
+        for (size_t i = 0; i < FRAME; ++i) mean += frame[i];
+        mean /= FRAME;
+        for (size_t i = 0; i < FRAME; ++i) power += (frame[i] - mean) * (frame[i] - mean);
+        bool audible = std::sqrt(power / FRAME) > RMS_GATE;
+
+        if (audible || midi_on) {
+            ++report.envelope_frames;
+            if (audible != midi_on) ++report.envelope_mismatches;
+        }
+        if (!audible || !tone_state.on) return;
+
+        double expected = 440.0 * std::pow(2.0, (tone_state.pitch - 69.0) / 12.0);
+        double expected_lag = WonderSwanRenderer::SAMPLE_RATE / expected;
+        size_t max_lag = std::min<size_t>(YIN_MAX_LAG, static_cast<size_t>(2.2 * expected_lag) + 2);
+        uint64_t analysis_start = end - YIN_WINDOW - max_lag;
+        if (max_lag < 4 || analysis_start < recent_start || !steady(tone, analysis_start, end)) return;
+        if (++pitch_candidates % PITCH_EVERY != 0) return;
+
+        // The cost grows with window * lags, so long periods are box-averaged down to
+        // about YIN_TARGET_LAG samples first.
+        const float* x = recent.data() + (analysis_start - recent_start);
+        size_t factor = std::max<size_t>(1, static_cast<size_t>(expected_lag / YIN_TARGET_LAG));
+        decimated.resize((YIN_WINDOW + max_lag) / factor);
+        for (size_t i = 0; i < decimated.size(); ++i) {
+            float sum = 0.0f;
+            for (size_t j = 0; j < factor; ++j) sum += x[i * factor + j];
+            decimated[i] = sum;
+        }
+        double period = factor * yin_period(decimated.data(), YIN_WINDOW / factor, max_lag / factor);
+        ++report.pitch_frames;
+        double cents = period > 0.0 ? 1200.0 * std::log2(expected_lag / period) : 1e9;
+        if (std::fabs(cents) > PITCH_TOLERANCE_CENTS) ++report.pitch_mismatches;
+    }
+};
+
+bool load_input(const std::string& filename, MappedFile& mapped, std::vector<uint8_t>& buffer, ByteSpan& span) {
+    if (mapped.open(filename)) {
+        span = mapped.span();
+        return true;
+    }
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) return false;
+    buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    span = ByteSpan(buffer);
+    return true;
+}
+
+void compare_file(const CompareOptions& options, FileReport& report) {
+    auto started = std::chrono::steady_clock::now();
+    MappedFile mapped;
+    std::vector<uint8_t> buffer;
+    ByteSpan input;
+    if (!load_input(report.input, mapped, buffer, input)) {
+        report.error = "cannot read input";
+        return;
+    }
+
+    // Each worker keeps a warm converter and renderer across files.
+    thread_local VgmConverter converter;
+    thread_local WonderSwanRenderer renderer;
+    thread_local std::vector<uint8_t> midi;
+    ConversionOptions conversion;
+    conversion.pitch_bend_range = options.pitch_bend_range;
+    converter.set_options(conversion);
+    ConversionResult result = converter.convert(input, midi);
+    MidiTimeline timeline;
+    if (!result.success) {
+        report.error = result.error;
+        return;
+    }
+    if (!timeline.parse(midi, report.error)) return;
+
+    // Hardware channels 2 and 4 also play through the voice and noise MIDI channels.
+    std::vector<ChannelCheck> checks;
+    checks.reserve(WonderSwanRenderer::CHANNELS);
+    const int special_channels[WonderSwanRenderer::CHANNELS] = {0, 8, 2, 9};
+    for (int channel = 0; channel < WonderSwanRenderer::CHANNELS; ++channel) {
+        checks.emplace_back(channel, timeline, special_channels[channel]);
+    }
+    uint64_t next_frame_end = FRAME;
+    renderer.set_keep_pcm(!options.wav_dir.empty());
+    renderer.set_channel_sink([&](uint64_t start, const float* const* channels, const float* levels, size_t count) {
+        for (ChannelCheck& check : checks) {
+            const float* in = channels[check.hardware];
+            float level = levels[check.hardware];
+            for (size_t i = 0; i < count; ++i) check.recent.push_back(in[i] * level);
+        }
+        uint64_t end = start + count;
+        for (; next_frame_end <= end; next_frame_end += FRAME) {
+            for (ChannelCheck& check : checks) check.analyze_frame(next_frame_end, report);
+        }
+        for (ChannelCheck& check : checks) {
+            if (check.recent.size() > HISTORY) {
+                size_t drop = check.recent.size() - HISTORY;
+                check.recent.erase(check.recent.begin(), check.recent.begin() + drop);
+                check.recent_start += drop;
+            }
+        }
+    });
+    bool rendered = converter.render(input, renderer);
+    renderer.set_channel_sink(nullptr);
+    if (!rendered) {
+        report.error = "failed to render VGM data";
+        return;
+    }
+    report.samples = renderer.samples();
+
+    if (!options.wav_dir.empty()) {
+        fs::path wav = fs::path(options.wav_dir) / fs::path(report.input).filename().replace_extension(".wav");
+        if (!renderer.write_wav(wav.string())) report.error = "cannot write " + wav.string();
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - started;
+    report.milliseconds = elapsed.count();
+}
+
+void collect_inputs(const std::string& input, std::vector<FileReport>& reports) {
+    if (!fs::is_directory(input)) {
+        reports.push_back({});
+        reports.back().input = input;
+        return;
+    }
+    std::vector<std::string> found;
+    for (const auto& entry : fs::recursive_directory_iterator(input)) {
+        std::string extension = entry.path().extension().string();
+        if (entry.is_regular_file() && (extension == ".vgm" || extension == ".vgz")) found.push_back(entry.path().string());
+    }
+    std::sort(found.begin(), found.end());
+    for (const std::string& file : found) {
+        reports.push_back({});
+        reports.back().input = file;
+    }
+}
+
+void print_usage(const char* program) {
+    std::cerr << "Usage: " << program << " [options] <file.vgm|dir>..." << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  -j, --jobs N                 Worker threads (default: hardware concurrency)" << std::endl;
+    std::cerr << "  --wav DIR                    Also write each rendering to DIR/<name>.wav" << std::endl;
+    std::cerr << "  --kernel scalar|sse2|avx2    PCM kernels (default: best supported)" << std::endl;
+    std::cerr << "  --max-envelope-mismatch PCT  Divergence limit of the envelope check (default 5)" << std::endl;
+    std::cerr << "  --max-pitch-mismatch PCT     Divergence limit of the pitch check (default 5)" << std::endl;
+    std::cerr << "  --pitch-bend N               Convert in glide mode with a bend range of N semitones" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    CompareOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if ((arg == "-j" || arg == "--jobs") && i + 1 < argc) {
+            options.jobs = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--wav" && i + 1 < argc) {
+            options.wav_dir = argv[++i];
+        } else if (arg == "--kernel" && i + 1 < argc) {
+            std::string name = argv[++i];
+            PcmKernel kernel = name == "scalar" ? PcmKernel::Scalar : name == "sse2" ? PcmKernel::Sse2 : PcmKernel::Avx2;
+            if (name != "scalar" && name != "sse2" && name != "avx2") {
+                std::cerr << "Unknown kernel: " << name << std::endl;
+                return 1;
+            }
+            if (set_pcm_kernel(kernel) != kernel) {
+                std::cerr << "Kernel " << name << " is not supported here, using "
+                          << pcm_kernel_name(current_pcm_kernel()) << "." << std::endl;
+            }
+        } else if (arg == "--max-envelope-mismatch" && i + 1 < argc) {
+            options.max_envelope_mismatch = std::atof(argv[++i]);
+        } else if (arg == "--max-pitch-mismatch" && i + 1 < argc) {
+            options.max_pitch_mismatch = std::atof(argv[++i]);
+        } else if (arg == "--pitch-bend" && i + 1 < argc) {
+            options.pitch_bend_range = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "-h" || arg == "--help") {
+            print_usage(argv[0]);
+            return 0;
+        } else if (!arg.empty() && arg[0] == '-') {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            print_usage(argv[0]);
+            return 1;
+        } else {
+            options.inputs.push_back(arg);
+        }
+    }
+    if (options.inputs.empty()) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (!options.wav_dir.empty()) {
+        std::error_code ec;
+        fs::create_directories(options.wav_dir, ec);
+    }
+
+    std::vector<FileReport> reports;
+    for (const std::string& input : options.inputs) collect_inputs(input, reports);
+    if (reports.empty()) {
+        std::cerr << "No input files found." << std::endl;
+        return 1;
+    }
+
+    auto started = std::chrono::steady_clock::now();
+    {
+        WorkStealingPool pool(options.jobs);
+        std::cout << "Comparing " << reports.size() << " file(s) on " << pool.size() << " thread(s), "
+                  << pcm_kernel_name(current_pcm_kernel()) << " kernels." << std::endl;
+        for (FileReport& report : reports) {
+            FileReport* target = &report;
+            pool.submit([&options, target] { compare_file(options, *target); });
+        }
+        pool.wait();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+
+    size_t divergent = 0, failed = 0;
+    uint64_t total_samples = 0;
+    std::cout << std::fixed << std::setprecision(1);
+    for (const FileReport& report : reports) {
+        if (!report.error.empty()) {
+            ++failed;
+            std::cout << "FAILED     " << report.input << ": " << report.error << std::endl;
+            continue;
+        }
+        total_samples += report.samples;
+        bool diverges = report.envelope_percent() > options.max_envelope_mismatch ||
+                        report.pitch_percent() > options.max_pitch_mismatch;
+        if (diverges) ++divergent;
+        std::cout << (diverges ? "DIVERGENT  " : "OK         ") << report.input << "  envelope "
+                  << report.envelope_percent() << "% of " << report.envelope_frames << " frames, pitch "
+                  << report.pitch_percent() << "% of " << report.pitch_frames << " frames, "
+                  << report.milliseconds << " ms" << std::endl;
+    }
+    double audio_seconds = double(total_samples) / WonderSwanRenderer::SAMPLE_RATE;
+    std::cout << reports.size() - divergent - failed << " OK, " << divergent << " divergent, " << failed
+              << " failed; " << audio_seconds << " s of audio in " << elapsed.count() << " s ("
+              << (elapsed.count() > 0 ? audio_seconds / elapsed.count() : 0.0) << "x real time)." << std::endl;
+    return (divergent || failed) ? 1 : 0;
+}
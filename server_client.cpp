@@ -0,0 +1,270 @@
+// Test and load-generation client for the conversion server (converter --server).
+//
+//   server_client --socket PATH [-n requests] [-c connections] [-p pipeline] [--format1]
+//                 [-o output_dir] <file.vgm|.vgz>...
+//       Sends the files round-robin over `connections` parallel connections, keeping
+//       up to `pipeline` requests outstanding on each, then prints throughput, client
+//       side latency percentiles and the server's own status document. With -o the
+//       returned MIDI files are written to output_dir for checking.
+//   server_client --socket PATH --status
+//       Prints the server status (queue depth, counters, latency percentiles).
+//   server_client --emit [--format1] <file.vgm|.vgz>... > requests.bin
+//       Writes request frames to standard output, to drive stdin mode:
+//       converter --server < requests.bin > responses.bin
+//
+// POSIX only (Unix domain sockets).
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "ServerProtocol.h"
+
+namespace {
+
+struct ClientOptions {
+    std::string socket_path;
+    size_t requests = 100;
+    unsigned connections = 4;
+    unsigned pipeline = 1;
+    uint16_t flags = 0;
+    std::string output_dir;
+    bool status_only = false;
+    bool emit = false;
+    std::vector<std::string> files;
+};
+
+bool read_fully(int fd, uint8_t* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = ::read(fd, data, size);
+        if (n <= 0) return false;
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool write_fully(int fd, const uint8_t* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = ::write(fd, data, size);
+        if (n <= 0) return false;
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+int connect_to(const std::string& path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) return -1;
+    path.copy(address.sun_path, path.size());
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+bool send_request(int fd, const RequestHeader& header, const std::vector<uint8_t>& payload) {
+    uint8_t frame[REQUEST_HEADER_SIZE];
+    encode_request_header(frame, header);
+    return write_fully(fd, frame, sizeof(frame)) && write_fully(fd, payload.data(), payload.size());
+}
+
+bool receive_response(int fd, ResponseHeader& header, std::vector<uint8_t>& payload) {
+    uint8_t frame[RESPONSE_HEADER_SIZE];
+    if (!read_fully(fd, frame, sizeof(frame)) || !decode_response_header(ByteSpan(frame, sizeof(frame)), header)) {
+        return false;
+    }
+    payload.resize(header.size);
+    return read_fully(fd, payload.data(), payload.size());
+}
+
+std::string query_status(const std::string& path) {
+    int fd = connect_to(path);
+    if (fd < 0) return "";
+    RequestHeader request;
+    request.type = REQUEST_STATUS;
+    ResponseHeader response;
+    std::vector<uint8_t> payload;
+    bool ok = send_request(fd, request, {}) && receive_response(fd, response, payload);
+    ::close(fd);
+    return ok ? std::string(payload.begin(), payload.end()) : "";
+}
+
+std::string base_name(const std::string& path) {
+    size_t slash = path.find_last_of("/\\");
+    std::string name = (slash == std::string::npos) ? path : path.substr(slash + 1);
+    size_t dot = name.find_last_of('.');
+    return dot == std::string::npos ? name : name.substr(0, dot);
+}
+
+struct LoadResult {
+    std::mutex mutex;
+    std::vector<double> latencies; // Milliseconds
+    size_t failures = 0;
+    size_t received_bytes = 0;
+};
+
+// One connection: keeps up to `pipeline` requests in flight until its share is done.
+void run_connection(const ClientOptions& options, const std::vector<std::vector<uint8_t>>& inputs,
+                    std::atomic<size_t>& next_request, LoadResult& result) {
+    int fd = connect_to(options.socket_path);
+    if (fd < 0) {
+        std::lock_guard<std::mutex> lock(result.mutex);
+        ++result.failures;
+        return;
+    }
+
+    std::map<uint32_t, std::chrono::steady_clock::time_point> sent;
+    std::vector<double> latencies;
+    size_t failures = 0;
+    size_t received_bytes = 0;
+    bool more = true;
+    ResponseHeader response;
+    std::vector<uint8_t> payload;
+
+    while (more || !sent.empty()) {
+        while (more && sent.size() < options.pipeline) {
+            size_t index = next_request.fetch_add(1);
+            if (index >= options.requests) {
+                more = false;
+                break;
+            }
+            RequestHeader request;
+            request.id = static_cast<uint32_t>(index);
+            request.flags = options.flags;
+            request.size = static_cast<uint32_t>(inputs[index % inputs.size()].size());
+            sent[request.id] = std::chrono::steady_clock::now();
+            if (!send_request(fd, request, inputs[index % inputs.size()])) {
+                more = false;
+                failures += sent.size();
+                sent.clear();
+            }
+        }
+        if (sent.empty()) break;
+
+        if (!receive_response(fd, response, payload)) {
+            failures += sent.size();
+            break;
+        }
+        auto it = sent.find(response.id);
+        if (it == sent.end()) continue;
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - it->second;
+        sent.erase(it);
+        latencies.push_back(elapsed.count());
+        received_bytes += payload.size();
+        if (response.status != STATUS_OK) {
+            ++failures;
+            std::cerr << "Request " << response.id << " failed: " << std::string(payload.begin(), payload.end()) << std::endl;
+        } else if (!options.output_dir.empty() && response.id < options.files.size()) {
+            std::ofstream out(options.output_dir + "/" + base_name(options.files[response.id]) + ".mid", std::ios::binary);
+            out.write(reinterpret_cast<const char*>(payload.data()), payload.size());
+        }
+    }
+    ::close(fd);
+
+    std::lock_guard<std::mutex> lock(result.mutex);
+    result.latencies.insert(result.latencies.end(), latencies.begin(), latencies.end());
+    result.failures += failures;
+    result.received_bytes += received_bytes;
+}
+
+double percentile(const std::vector<double>& sorted, double fraction) {
+    if (sorted.empty()) return 0.0;
+    return sorted[static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5)];
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    ClientOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--socket" && i + 1 < argc) options.socket_path = argv[++i];
+        else if (arg == "-n" && i + 1 < argc) options.requests = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "-c" && i + 1 < argc) options.connections = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        else if (arg == "-p" && i + 1 < argc) options.pipeline = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        else if (arg == "-o" && i + 1 < argc) options.output_dir = argv[++i];
+        else if (arg == "--format1") options.flags |= FLAG_FORMAT1;
+        else if (arg == "--running-status") options.flags |= FLAG_RUNNING_STATUS;
+        else if (arg == "--status") options.status_only = true;
+        else if (arg == "--emit") options.emit = true;
+        else options.files.push_back(arg);
+    }
+    if (options.connections == 0) options.connections = 1;
+    if (options.pipeline == 0) options.pipeline = 1;
+
+    if (options.status_only) {
+        std::string status = query_status(options.socket_path);
+        if (status.empty()) {
+            std::cerr << "Cannot query " << options.socket_path << std::endl;
+            return 1;
+        }
+        std::cout << status << std::endl;
+        return 0;
+    }
+
+    if (options.files.empty() || (!options.emit && options.socket_path.empty())) {
+        std::cerr << "Usage: " << argv[0] << " --socket PATH [-n requests] [-c connections] [-p pipeline]"
+                  << " [--format1] [-o output_dir] <file>...\n       " << argv[0] << " --socket PATH --status\n       "
+                  << argv[0] << " --emit [--format1] <file>... > requests.bin" << std::endl;
+        return 1;
+    }
+
+    std::vector<std::vector<uint8_t>> inputs;
+    for (const auto& file : options.files) {
+        std::ifstream in(file, std::ios::binary);
+        if (!in) {
+            std::cerr << "Cannot open " << file << std::endl;
+            return 1;
+        }
+        inputs.emplace_back(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    if (options.emit) {
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            RequestHeader request;
+            request.id = static_cast<uint32_t>(i);
+            request.flags = options.flags;
+            request.size = static_cast<uint32_t>(inputs[i].size());
+            if (!send_request(1, request, inputs[i])) return 1;
+        }
+        return 0;
+    }
+
+    LoadResult result;
+    std::atomic<size_t> next_request(0);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < options.connections; ++i) {
+        threads.emplace_back([&] { run_connection(options, inputs, next_request, result); });
+    }
+    for (auto& thread : threads) thread.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::sort(result.latencies.begin(), result.latencies.end());
+    std::cout << "Requests: " << result.latencies.size() << " answered, " << result.failures << " failed, "
+              << options.connections << " connection(s), pipeline " << options.pipeline << std::endl;
+    std::cout << "Elapsed: " << elapsed.count() << " s, " << (result.latencies.size() / elapsed.count())
+              << " requests/s, " << (result.received_bytes / elapsed.count() / 1e6) << " MB/s of MIDI" << std::endl;
+    std::cout << "Latency ms: p50 " << percentile(result.latencies, 0.50) << ", p90 "
+              << percentile(result.latencies, 0.90) << ", p99 " << percentile(result.latencies, 0.99)
+              << ", max " << percentile(result.latencies, 1.0) << std::endl;
+    std::cout << "Server status: " << query_status(options.socket_path) << std::endl;
+    return result.failures == 0 ? 0 : 1;
+}
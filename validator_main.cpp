@@ -19,12 +19,20 @@ void outHex();
 void outAscii();
 
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        cerr << "Usage: " << argv[0] << " <midi_file>" << endl;
+    if (argc != 2 && argc != 3) {
+        cerr << "Usage: " << argv[0] << " <midi_file> [result_file]" << endl;
         return 1;
     }
 
-    fout.open("vgm_ws_to_mid/validation_result.txt", ios::out);
+    // The report is only copied to a file when one is given; writes to the
+    // unopened stream are no-ops.
+    if (argc == 3) {
+        fout.open(argv[2], ios::out);
+        if (!fout.is_open()) {
+            cerr << "Error opening result file: " << argv[2] << endl;
+            return 1;
+        }
+    }
     MIDI.open(argv[1], ios::in | ios::binary);
 
     if (!MIDI.is_open()) {